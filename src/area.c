@@ -4,15 +4,86 @@
 #include "windows.h"
 #include "stuff.h"
 
-tile_t *c_curr;
 level_t *c_levels = NULL;
 size_t c_levels_len = 0;
 size_t c_levels_curr = 0;
 
-void c_level_add(level_t *level) {
+// View known by the server, see c_area_view()
+static view_t c_view_sent;
+// View drawn last time, the whole area is drawn when it moves
+static view_t c_view_drawn;
+
+// Rectangles of the level changed since the last draw, see c_area_damage()
+#define AREA_DAMAGE_MAX 64
+static pthread_mutex_t c_damage_mutex = PTHREAD_MUTEX_INITIALIZER;
+static view_t c_damage[AREA_DAMAGE_MAX];
+static size_t c_damage_len = 0;
+
+// Rows of the debug lines, they are drawn over the level
+#define AREA_DEBUG_ROW 3
+#define AREA_DEBUG_ROWS 9
+#define AREA_DEBUG_WIDTH 40
+
+static view_t view_union(view_t a, view_t b) {
+    view_t u;
+
+    u.top_y = a.top_y < b.top_y ? a.top_y : b.top_y;
+    u.top_x = a.top_x < b.top_x ? a.top_x : b.top_x;
+    u.height = (a.top_y + a.height > b.top_y + b.height ?
+            a.top_y + a.height : b.top_y + b.height) - u.top_y;
+    u.width = (a.top_x + a.width > b.top_x + b.width ?
+            a.top_x + a.width : b.top_x + b.width) - u.top_x;
+
+    return u;
+}
+
+/*
+ * Marks the rectangle of the level to be drawn again. When there are too
+ * many rectangles, they are merged into one.
+ *
+ * y, x          : top left tile
+ * height, width : size of the rectangle
+ */
+void c_area_damage(uint32_t y, uint32_t x, uint32_t height, uint32_t width) {
+    view_t rect = { y, x, height, width };
+
+    pthread_mutex_lock(&c_damage_mutex);
+    if (c_damage_len == AREA_DAMAGE_MAX) {
+        for (size_t i = 1; i < c_damage_len; i++) {
+            c_damage[0] = view_union(c_damage[0], c_damage[i]);
+        }
+        c_damage[0] = view_union(c_damage[0], rect);
+        c_damage_len = 1;
+    } else {
+        c_damage[c_damage_len++] = rect;
+    }
+    pthread_mutex_unlock(&c_damage_mutex);
+
+    windows_damage(W_AREA, DAMAGE_PART);
+}
+
+/*
+ * Applies MSG_PUT_LEVEL header (see levels.h): switches to the level,
+ * adding it if it is new.
+ */
+void c_level_add(char *payload, size_t size) {
+    uint64_t id;
+    uint32_t max_y, max_x;
+
+    if (size != LEVEL_HEADER_SIZE) {
+        logger("[C] Broken level header!");
+        return;
+    }
+    memcpy(&id, payload, sizeof(uint64_t));
+    memcpy(&max_y, payload + 8, sizeof(uint32_t));
+    memcpy(&max_x, payload + 12, sizeof(uint32_t));
+
+    // Server forgets the view with the level
+    memset(&c_view_sent, '\0', sizeof(view_t));
+    windows_damage(W_AREA, DAMAGE_ALL);
+
     for (size_t i = 0; i < c_levels_len; i++) {
-        if (c_levels[i].id == level->id) {
-            c_curr = c_levels[i].area;
+        if (c_levels[i].id == id) {
             c_levels_curr = i;
 
             return;
@@ -25,137 +96,197 @@ void c_level_add(level_t *level) {
         panic("[C] Error allocating new level buffer!");
     }
 
-    CURR.id = level->id;
-    strncpy(CURR.name, level->name, MAX_LEVEL_NAME);
-    CURR.max_y = level->max_y;
-    CURR.max_x = level->max_x;
-    CURR.size = CURR.max_y * CURR.max_x;
-    if ((CURR.area = (tile_t *)malloc(sizeof(tile_t) * CURR.size)) == NULL) {
-        panic("[C] Error allocating new level area buffer!");
-    }
-    memset(CURR.area, '\0', sizeof(tile_t) * CURR.size);
-
-    c_curr = CURR.area;
+    CURR.id = id;
+    strncpy(CURR.name, payload + 16, MAX_LEVEL_NAME - 1);
+    CURR.name[MAX_LEVEL_NAME - 1] = '\0';
+    CURR.max_y = max_y;
+    CURR.max_x = max_x;
+    chunks_init(&CURR.chunks, (size_t)CONF_IVAL(CF_LEVEL_MEMORY) * 1024,
+            NULL, NULL, NULL);
+    memset(&CURR.overlay, '\0', sizeof(overlay_t));
 #undef CURR
 
     c_levels_curr = c_levels_len++;
 }
 
-size_t lvltilepos(uint16_t max_x, uint16_t y, uint16_t x) {
-    return y * max_x + x;
+size_t lvltilepos(uint32_t max_x, uint32_t y, uint32_t x) {
+    return (size_t)y * max_x + x;
 }
 
-size_t tilepos(uint16_t y, uint16_t x) {
+size_t tilepos(uint32_t y, uint32_t x) {
     return lvltilepos(c_levels[c_levels_curr].max_x, y, x);
 }
 
-void tile_destroy(size_t index) {
-    if (c_curr[index].top == S_NONE) {
+/*
+ * Applies MSG_PUT_AREA_DELTA to the current level.
+ *
+ * payload : sequence of tile runs (see tiles.h)
+ * size    : payload size
+ */
+void c_area_delta(char *payload, size_t size) {
+    level_t *level = c_levels + c_levels_curr;
+    size_t pos = 0;
+
+    if (c_levels_len == 0) {
+        logger("[C] Area delta before level!");
         return;
     }
 
-    tile_t *curr = c_curr[index].underlying;
+    while (pos + sizeof(tilerun_t) <= size) {
+        tilerun_t run;
+        memcpy(&run, payload + pos, sizeof(tilerun_t));
+        pos += sizeof(tilerun_t);
 
-    while (curr != NULL) {
-        tile_t *to_destroy = curr;
-        curr = curr->underlying;
-        free(to_destroy);
+        if (run.y >= level->max_y || run.x > level->max_x ||
+                run.count > level->max_x - run.x ||
+                run.count > (size - pos) / sizeof(cell_t)) {
+            logger("[C] Broken area delta!");
+            return;
+        }
+
+        chunks_write(&level->chunks, run.y, run.x, payload + pos, run.count);
+        c_area_damage(run.y, run.x, 1, run.count);
+        pos += sizeof(cell_t) * run.count;
     }
+}
+
+/*
+ * Reports the view to the server if it has changed: on resize and when the
+ * camera moves.
+ */
+static void c_area_view(uint32_t top_y, uint32_t top_x, uint32_t height,
+        uint32_t width) {
+    view_t view = { top_y, top_x, height, width };
+    mbuf_t mbuf;
 
-    memset(c_curr + index, '\0', sizeof(tile_t));
+    if (memcmp(&view, &c_view_sent, sizeof(view_t)) == 0) {
+        return;
+    }
+    c_view_sent = view;
+
+    if ((mbuf.payload = malloc(sizeof(view_t))) == NULL) {
+        panic("[C] Error allocating view buffer!");
+    }
+    memcpy(mbuf.payload, &view, sizeof(view_t));
+    mbuf.msg.type = MSG_REPORT_VIEW;
+    mbuf.msg.size = sizeof(view_t);
+
+    mqueue_put(&c2s_queue, mbuf);
 }
 
-void c_area_update(size_t ngroups, tileblock_t *tileblock) {
-    while (ngroups-- > 0) {
-        uint32_t count = tileblock->count;
-        uint32_t zcount = tileblock->zcount;
-
-        for (uint32_t i = 0; i < count; i++) {
-            size_t index = tilepos(tileblock->tiles->y, tileblock->tiles->x);
-
-            tile_destroy(index);
-
-            for (uint32_t j = 0; j < zcount; j++) {
-                tile_t *updates = tileblock->tiles;
-
-                if (c_curr[index].top == S_NONE) {
-                    c_curr[index] = *updates;
-                    tileblock = (tileblock_t*)((char *)tileblock +
-                            sizeof(tile_t));
-                    continue;
-                }
-
-                tile_t *unter;
-                if ((unter = (tile_t *)malloc(sizeof(tile_t))) == NULL) {
-                    panic("[C] Error allocating tile_t!");
-                }
-                *unter = c_curr[index];
-
-                unter->underlying = NULL;
-                c_curr[index] = *updates;
-                c_curr[index].underlying = unter;
-                tileblock = (tileblock_t*)((char *)tileblock + sizeof(tile_t));
-            }
-        }
+/*
+ * Draws the tiles of the rectangle, which are in the view.
+ *
+ * view : level part shown by the window
+ * rect : level part to draw
+ */
+static void area_paint(level_t *level, view_t view, view_t rect) {
+    uint64_t top = rect.top_y > view.top_y ? rect.top_y : view.top_y;
+    uint64_t left = rect.top_x > view.top_x ? rect.top_x : view.top_x;
+    uint64_t bottom = (uint64_t)rect.top_y + rect.height;
+    uint64_t right = (uint64_t)rect.top_x + rect.width;
 
-        tileblock = (tileblock_t*)((char *)tileblock + sizeof(tileblock_t) -
-                sizeof(tile_t));
+    if (bottom > (uint64_t)view.top_y + view.height) {
+        bottom = (uint64_t)view.top_y + view.height;
+    }
+    if (bottom > level->max_y) {
+        bottom = level->max_y;
+    }
+    if (right > (uint64_t)view.top_x + view.width) {
+        right = (uint64_t)view.top_x + view.width;
+    }
+    if (right > level->max_x) {
+        right = level->max_x;
+    }
+    if (top >= bottom || left >= right) {
+        return;
+    }
+
+    cell_t row[right - left];
+    for (uint64_t y = top; y < bottom; y++) {
+        chunks_read(&level->chunks, y, left, row, right - left);
+        for (uint64_t x = left; x < right; x++) {
+            mvwaddch(W(W_AREA), y - view.top_y, x - view.top_x,
+                    S[CELL_TOP(row[x - left])] |
+                    color2attr(CELL_COLOR(row[x - left])));
+        }
     }
 }
 
 void draw_area() {
-    if (levels_count == 0) { /* Before START_GAME */
+    if (c_levels_len == 0) { /* Before START_GAME */
         mvwprintw(W(W_AREA), 1, 1, "%s", _("Connected players:"));
-        for (size_t i = 0; i < players_len; i++) {
-            mvwaddch(W(W_AREA), 2 + i, 1, players[i].ready ? '+' : '-');
-            mvwprintw(W(W_AREA), 2 + i, 3, "%s", players[i].nickname);
+        for (size_t i = 0, row = 2; i < players_len; i++) {
+            if (! players[i].used) continue;
+
+            mvwaddch(W(W_AREA), row, 1, players[i].ready ? '+' : '-');
+            mvwprintw(W(W_AREA), row++, 3, "%s", players[i].nickname);
             mvwprintw(W(W_AREA), windows[W_AREA].max_y - 2, 1, "%s",
                     _("Write !start or !s to chat to begin"));
         }
     }
 
-    if (c_curr == NULL) {
+    if (c_levels_len == 0) {
         return;
     }
 
     /* Calculate top_y and top_x for area */
-    // TODO do we really need to check conf() every tick?
-    ssize_t top_y = 0, top_x = 0, camera = conf("player_camera").ival;
+    ssize_t top_y = 0, top_x = 0, camera = CONF_IVAL(CF_PLAYER_CAMERA);
     if (players_len > 0) {
 #define AREA (windows[W_AREA])
 #define ME (players[player_self])
         if (camera == 1) {
             // Centre view
-            top_y = ME.y - AREA.max_y / 2;
-            top_x = ME.x - AREA.max_x / 2;
+            top_y = (ssize_t)ME.y - AREA.max_y / 2;
+            top_x = (ssize_t)ME.x - AREA.max_x / 2;
         } else if (camera == 2) {
             // Part-screen movement
-            top_y = ((ME.y - (AREA.max_y / 8)) / (AREA.max_y * 6 / 8)) *
-                (AREA.max_y * 6 / 8);
-            top_x = ((ME.x - (AREA.max_x / 8)) / (AREA.max_x * 6 / 8)) *
-                (AREA.max_x * 6 / 8);
+            top_y = (((ssize_t)ME.y - (AREA.max_y / 8)) /
+                    (AREA.max_y * 6 / 8)) * (AREA.max_y * 6 / 8);
+            top_x = (((ssize_t)ME.x - (AREA.max_x / 8)) /
+                    (AREA.max_x * 6 / 8)) * (AREA.max_x * 6 / 8);
         } else {
             // Another view
         }
 
         // Corrections
-        if (top_y <  0) top_y = 0;
-        if (top_x <  0) top_x = 0;
         // TODO do all of our levels has such big size?
         // TODO change c_levels to current_level_pointer
-        if (top_y >= c_levels->max_y - AREA.max_y) top_y =
-            c_levels->max_y - AREA.max_y;
-        if (top_x >= c_levels->max_x - AREA.max_x) top_x =
-            c_levels->max_x - AREA.max_x;
-    }
-
-    tile_t *curr = c_curr;
-    for (register ssize_t y = 0; y < AREA.max_y; y++) {
-        register size_t pos = tilepos(y + top_y, top_x);
-        for (register ssize_t x = 0; x < AREA.max_x; x++, pos++) {
-            mvwaddch(W(W_AREA), y, x,
-                    S[curr[pos].top] | color2attr(curr[pos].color));
+        if (top_y >= (ssize_t)c_levels->max_y - AREA.max_y) top_y =
+            (ssize_t)c_levels->max_y - AREA.max_y;
+        if (top_x >= (ssize_t)c_levels->max_x - AREA.max_x) top_x =
+            (ssize_t)c_levels->max_x - AREA.max_x;
+        if (top_y <  0) top_y = 0;
+        if (top_x <  0) top_x = 0;
+
+        c_area_view(top_y, top_x, AREA.max_y, AREA.max_x);
+    }
+
+    level_t *level = c_levels + c_levels_curr;
+    view_t view = { top_y, top_x, AREA.max_y, AREA.max_x };
+    view_t damage[AREA_DAMAGE_MAX];
+    size_t ndamage;
+
+    pthread_mutex_lock(&c_damage_mutex);
+    ndamage = c_damage_len;
+    memcpy(damage, c_damage, ndamage * sizeof(view_t));
+    c_damage_len = 0;
+    pthread_mutex_unlock(&c_damage_mutex);
+
+    // Only the damaged tiles are drawn, unless the view has changed
+    if (AREA.redraw == DAMAGE_ALL ||
+            memcmp(&view, &c_view_drawn, sizeof(view_t)) != 0) {
+        c_view_drawn = view;
+        area_paint(level, view, view);
+    } else {
+        for (size_t i = 0; i < ndamage; i++) {
+            area_paint(level, view, damage[i]);
         }
+
+        // Debug lines are redrawn over the level, see below
+        view_t debug = { top_y + AREA_DEBUG_ROW, top_x + 1, AREA_DEBUG_ROWS,
+            AREA_DEBUG_WIDTH };
+        area_paint(level, view, debug);
     }
 
     /* Draw debug variables */
@@ -168,12 +299,19 @@ void draw_area() {
     mvwprintw(W(W_AREA), 9, 1, "%s %d x %d", _("Top YxX:"), top_y, top_x);
     mvwprintw(W(W_AREA), 10, 1, "%s %d x %d", _("Win YxX:"), 
             windows[W_AREA].max_y, windows[W_AREA].max_x);
-    mvwprintw(W(W_AREA), 11, 1, "%s %d x %d", _("My YxX:"), ME.y, ME.x);
+    mvwprintw(W(W_AREA), 11, 1, "%s %u x %u", _("My YxX:"), ME.y, ME.x);
 #undef ME
 #undef AREA
 
     /* Draw the players */
     for (size_t i = 0; i < players_len; i++) {
+        if (! players[i].used || players[i].y < view.top_y ||
+                players[i].x < view.top_x ||
+                players[i].y - view.top_y >= view.height ||
+                players[i].x - view.top_x >= view.width) {
+            continue;
+        }
+
         mvwaddch(W(W_AREA), players[i].y - top_y, players[i].x - top_x,
                 S[S_PLAYER] | color2attr(players[i].color));
     }
@@ -8,9 +8,10 @@
 
 void draw_area();
 void area_init();
-size_t lvltilepos(uint16_t max_x, uint16_t y, uint16_t x);
-size_t tilepos(uint16_t y, uint16_t x);
-void c_level_add(level_t *level);
-void c_area_update(size_t ngroups, tileblock_t *tileblock);
+size_t lvltilepos(uint32_t max_x, uint32_t y, uint32_t x);
+size_t tilepos(uint32_t y, uint32_t x);
+void c_level_add(char *payload, size_t size);
+void c_area_delta(char *payload, size_t size);
+void c_area_damage(uint32_t y, uint32_t x, uint32_t height, uint32_t width);
 
 #endif /* AREA_H */
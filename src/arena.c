@@ -0,0 +1,75 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+
+void arena_init(arena_t *arena) {
+    memset(arena, '\0', sizeof(arena_t));
+}
+
+/*
+ * size : bytes to allocate
+ *
+ * ret  : memory aligned for pointers and numbers, valid until the next
+ *        arena_reset()
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_chunk_t *chunk = arena->head;
+    size_t header = (sizeof(arena_chunk_t) + ARENA_ALIGN - 1) /
+        ARENA_ALIGN * ARENA_ALIGN;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+        if ((chunk = malloc(header + chunk_size)) == NULL) {
+            panic("Error allocating arena chunk!");
+        }
+        chunk->data = (char *)chunk + header;
+        chunk->next = arena->head;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->head = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+/*
+ * Frees everything allocated. The biggest chunk is kept, so an arena reset
+ * after every use stops calling malloc() once it has grown.
+ */
+void arena_reset(arena_t *arena) {
+    arena_chunk_t *biggest = arena->head;
+
+    for (arena_chunk_t *chunk = arena->head; chunk != NULL;
+            chunk = chunk->next) {
+        if (chunk->size > biggest->size) {
+            biggest = chunk;
+        }
+    }
+
+    while (arena->head != NULL) {
+        arena_chunk_t *chunk = arena->head;
+        arena->head = chunk->next;
+        if (chunk != biggest) {
+            free(chunk);
+        }
+    }
+
+    if (biggest != NULL) {
+        biggest->next = NULL;
+        biggest->used = 0;
+        arena->head = biggest;
+    }
+}
+
+void arena_destroy(arena_t *arena) {
+    while (arena->head != NULL) {
+        arena_chunk_t *chunk = arena->head;
+        arena->head = chunk->next;
+        free(chunk);
+    }
+}
@@ -0,0 +1,30 @@
+// vim: sw=4 ts=4 et :
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator: memory is taken from big chunks and is freed all at once
+ * by arena_reset() or arena_destroy(). Allocated memory never moves.
+ */
+#define ARENA_CHUNK 4096
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;                    // size of *data*
+    size_t used;
+    char *data;                     // memory after the header, aligned
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t *head;            // chunk allocations come from
+} arena_t;
+
+void arena_init(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
+
+#endif /* ARENA_H */
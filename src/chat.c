@@ -9,20 +9,32 @@
 char input[CHAT_MSG_MAXLEN + 2];
 size_t inputpos;
 size_t scrolloff = 0;
+// Chat history wrapped for the window
+static lines_t chat_lines;
 
 void c_chat_init() {
-    if ((chat = malloc(CHAT_MSG_MAXLEN + 1)) == NULL) {
+    if ((chat = (history_t *)malloc(sizeof(history_t))) == NULL) {
         panic("Unable to allocate chat memory!");
     }
-    
-    chat[0] = '\0';
+    history_init(chat, CHAT_MSG_BACKLOG);
+    lines_init(&chat_lines, CHAT_MSG_BACKLOG * CHAT_LINES_PER_MSG);
+
     input[0] = '\0';
-    chat_num_lines = 0;
-    strncpy(nickname, CONF_SVAL("player_nickname"), sizeof(nickname));
+    strncpy(nickname, CONF_SVAL(CF_PLAYER_NICKNAME), sizeof(nickname));
+
+    // The whole history fits the client's copy
+    uint64_t offset = 0;
+    uint32_t limit = CHAT_MSG_BACKLOG;
 
     mbuf_t mbuf;
+    if ((mbuf.payload = malloc(CHAT_GET_SIZE)) == NULL) {
+        panic("Unable to allocate chat request!");
+    }
+    memcpy(mbuf.payload, &offset, sizeof(uint64_t));
+    memcpy((char *)mbuf.payload + sizeof(uint64_t), &limit,
+            sizeof(uint32_t));
     mbuf.msg.type = MSG_GET_CHAT;
-    mbuf.msg.size = 0;
+    mbuf.msg.size = CHAT_GET_SIZE;
     mqueue_put(&c2s_queue, mbuf);
 }
 
@@ -31,49 +43,21 @@ void draw_chat() {
         return;
     }
 
-    int square = WIN(CHAT, max_x) * WIN(CHAT, max_y);
-    size_t len = strlen(chat);
-    char *chatptr = chat + len - 2;
+    int rows = WIN(CHAT, max_y), width = WIN(CHAT, max_x);
     char *inputptr = NULL;
     char *inputptr_new = NULL;
 
-    if (len < 2) {
-        goto PS1;
-    }
-
-    if (WIN(CHAT, state) == LARGE && square > WIN(CHAT, max_x)) {
-        square -= WIN(CHAT, max_x);
-    }
-
-    for (size_t soff = scrolloff; soff; soff--) {
-        while (chatptr > chat && *chatptr-- != '\n');
-
-        if (chatptr == chat) {
-            break;
-        }
-    }
-
-    int curr = 0;
-    while (chatptr > chat && curr < square) {
-        switch (*chatptr) {
-            case '\n':
-                curr += WIN(CHAT, max_x) - curr % WIN(CHAT, max_x);
-                break;
-            default:
-                if ((*chatptr & 0xC0) != 0x80) {
-                    curr++;
-                }
-        }
-        chatptr--;
+    if (WIN(CHAT, state) == LARGE && rows > 1) {
+        rows--;
     }
 
-    if (chatptr != chat && *(chatptr - 1) != '\n') {
-        while (*chatptr++ != '\n');
-    }
+    // Newest lines which fit, *scrolloff* of them are scrolled away
+    size_t last = lines_sync(&chat_lines, chat, width);
+    last = scrolloff < last ? last - scrolloff : 0;
+    size_t first = last > (size_t)rows ? last - rows : 0;
 
-    MVW(W_CHAT, 0, 0, "%s", chatptr);
+    draw_lines(W_CHAT, &chat_lines, chat, first, last);
 
-PS1:
     inputptr = input;
     inputptr_new = input;
     char PS1[6] = "> %s\n";
@@ -90,38 +74,29 @@ PS1:
     }
 }
 
-void s_chat_add(char **schat, char *str) {
-    int oldsize = strlen(*schat) + 1;
-    int newsize = oldsize + strlen(str) + 1;
-
-    // TODO take care of CHAT_MSG_BACKLOG
-    // TODO do not forget that this routine is used by both client and server
-
-    if ((*schat = realloc(*schat, newsize)) == NULL) {
-        panic("Error reallocating server chat buffer!");
-    }
-
-    strcat(*schat, str);
+/*
+ * Writes the message of the player to the history, the oldest message is
+ * forgotten if there is no room.
+ *
+ * chat   : server history
+ * sender : author of the message
+ * str    : message
+ * len    : length of *str*
+ *
+ * ret    : the message record
+ */
+history_record_t *s_chat_add(history_t *chat, uint32_t sender, char *str,
+        size_t len) {
+    return history_add(chat, chat->next, sysutime(), sender, str,
+            strnlen(str, len));
 }
 
-void c_chat_add(char *str) {
-    int oldsize = strlen(chat) + 1;
-    int newsize = oldsize + strlen(str) + 1;
-
-    // TODO take care of CHAT_MSG_BACKLOG
-    // TODO do not forget that this routine is used by both client and server
-
-    if ((chat = realloc(chat, newsize)) == NULL) {
-        panic("Error reallocating chat buffer!");
-    }
-
-    strcat(chat, str);
-
-    while (*str) {
-        if (*str++ == '\n') {
-            chat_num_lines++;
-        }
-    }
+/*
+ * Adds MSG_PUT_CHAT records to the client's history.
+ */
+void c_chat_add(char *payload, size_t size) {
+    history_decode(chat, payload, size);
+    windows_damage(W_CHAT, DAMAGE_ALL);
 }
 
 void c_chat_open() {
@@ -139,12 +114,15 @@ void c_chat_open() {
 
         wtimeout(W(W_CHAT), 10);
         last_key = mvwgetch(W(W_CHAT), 0, 0);
+        if (last_key != ERR) {
+            windows_damage(W_CHAT, DAMAGE_ALL);
+        }
 
         if (last_key == K[K_WINDOW_EXIT]) {
             break;
         } else if (last_key == K[K_SCROLL_UP]) {
             // TODO what can we do with elastic windows scrolloff ?
-            if (scrolloff < chat_num_lines - WIN(CHAT, max_y)) {
+            if (scrolloff + 1 < chat_lines.count) {
                 scrolloff++;
             }
         } else if (last_key == K[K_SCROLL_DOWN]) {
@@ -2,19 +2,27 @@
 #ifndef CHAT_H
 #define CHAT_H
 
-// #define CHAT_MSG_BACKLOG 16
+#define CHAT_MSG_BACKLOG 1024
 #define CHAT_MSG_MAXLEN 256
+// Lines kept for scrolling, long messages take more than one
+#define CHAT_LINES_PER_MSG 4
 #define CHAT_NICK_MAXLEN PLAYER_NAME_MAXLEN
 
-char *chat;
-char *schat;
+/*
+ * MSG_GET_CHAT asks for u32 limit messages before the last u64 offset ones
+ * (history_encode()), all the history if there is no payload.
+ */
+#define CHAT_GET_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+history_t *chat;
+history_t *schat;
 char nickname[CHAT_NICK_MAXLEN + 1];
-size_t chat_num_lines;
 
 void c_chat_init();
 void c_chat_open();
 void draw_chat();
-void c_chat_add(char *str);
-void s_chat_add(char **chat, char *str);
+void c_chat_add(char *payload, size_t size);
+history_record_t *s_chat_add(history_t *chat, uint32_t sender, char *str,
+        size_t len);
 
 #endif /* CHAT_H */
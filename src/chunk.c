@@ -0,0 +1,452 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+
+#define CHUNKS_LOCK pthread_mutex_lock(&chunks->mutex)
+#define CHUNKS_UNLOCK pthread_mutex_unlock(&chunks->mutex)
+
+static size_t chunks_hash(chunks_t *chunks, uint32_t cy, uint32_t cx) {
+    uint64_t key = ((uint64_t)cy << 32 | cx) * 0x9E3779B97F4A7C15ULL;
+
+    return (key >> 32) & chunks->mask;
+}
+
+/*
+ * chunks : chunks to initialize
+ * memory : budget in bytes
+ * generate     : chunk generator or NULL
+ * map          : saved chunks lookup or NULL
+ * generate_arg : argument of both
+ */
+void chunks_init(chunks_t *chunks, size_t memory,
+        void (*generate)(void *arg, chunk_t *chunk),
+        const cell_t *(*map)(void *arg, uint32_t cy, uint32_t cx),
+        void *generate_arg) {
+    memset(chunks, '\0', sizeof(chunks_t));
+    chunks->spill = -1;
+
+    chunks->max = memory / (sizeof(chunk_t) + CHUNK_BYTES);
+    if (chunks->max < CHUNKS_MIN) {
+        chunks->max = CHUNKS_MIN;
+    }
+
+    // Power of two, at least twice as much as chunks
+    for (chunks->mask = 1; chunks->mask < 2 * chunks->max;
+            chunks->mask <<= 1);
+    if ((chunks->buckets = (chunk_t **)calloc(chunks->mask,
+                    sizeof(chunk_t *))) == NULL) {
+        panic("Error allocating chunks hash table!");
+    }
+    chunks->mask--;
+
+    chunks->generate = generate;
+    chunks->map = map;
+    chunks->generate_arg = generate_arg;
+
+    if (pthread_mutex_init(&chunks->mutex, NULL) != 0) {
+        panic("Error initializing chunks mutex!");
+    }
+}
+
+static void chunks_free(chunk_t *chunk) {
+    if (! chunk->mapped) {
+        free(chunk->cells);
+    }
+    free(chunk);
+}
+
+void chunks_destroy(chunks_t *chunks) {
+    chunk_t *curr = chunks->lru_head;
+
+    while (curr != NULL) {
+        chunk_t *next = curr->lru_next;
+        chunks_free(curr);
+        curr = next;
+    }
+
+    if (chunks->spill >= 0) {
+        close(chunks->spill);
+        chunks->spill = -1;
+    }
+    free(chunks->spilled);
+    chunks->spilled = NULL;
+    chunks->spilled_len = chunks->spilled_cap = 0;
+
+    free(chunks->buckets);
+    pthread_mutex_destroy(&chunks->mutex);
+    chunks->buckets = NULL;
+}
+
+static void chunks_lru_unlink(chunks_t *chunks, chunk_t *chunk) {
+    if (chunk->lru_prev == NULL) {
+        chunks->lru_head = chunk->lru_next;
+    } else {
+        chunk->lru_prev->lru_next = chunk->lru_next;
+    }
+
+    if (chunk->lru_next == NULL) {
+        chunks->lru_tail = chunk->lru_prev;
+    } else {
+        chunk->lru_next->lru_prev = chunk->lru_prev;
+    }
+}
+
+static void chunks_lru_push(chunks_t *chunks, chunk_t *chunk) {
+    chunk->lru_prev = NULL;
+    chunk->lru_next = chunks->lru_head;
+    if (chunks->lru_head != NULL) {
+        chunks->lru_head->lru_prev = chunk;
+    } else {
+        chunks->lru_tail = chunk;
+    }
+    chunks->lru_head = chunk;
+}
+
+/*
+ * ret : position of the chunk in the spill file index or where it should
+ *       be inserted
+ */
+static size_t chunks_spilled_find(chunks_t *chunks, uint32_t cy,
+        uint32_t cx) {
+    size_t low = 0, high = chunks->spilled_len;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        chunk_key_t *key = &chunks->spilled[mid].key;
+
+        if (key->cy < cy || (key->cy == cy && key->cx < cx)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static int chunks_spilled_at(chunks_t *chunks, size_t pos, uint32_t cy,
+        uint32_t cx) {
+    return pos < chunks->spilled_len && chunks->spilled[pos].key.cy == cy &&
+        chunks->spilled[pos].key.cx == cx;
+}
+
+/*
+ * Writes modified chunk to the spill file, so it may be evicted. Every
+ * chunk keeps its slot in the file once it has got one.
+ */
+static void chunks_flush(chunks_t *chunks, chunk_t *chunk) {
+    size_t pos = chunks_spilled_find(chunks, chunk->cy, chunk->cx);
+
+    if (chunks->spill < 0) {
+        char path[] = "/tmp/itmmorgue.spill.XXXXXX";
+
+        if ((chunks->spill = mkstemp(path)) < 0) {
+            panic("Error creating chunk spill file!");
+        }
+        unlink(path);
+    }
+
+    if (! chunks_spilled_at(chunks, pos, chunk->cy, chunk->cx)) {
+        if (chunks->spilled_len == chunks->spilled_cap) {
+            chunks->spilled_cap = chunks->spilled_cap ?
+                chunks->spilled_cap * 2 : 16;
+            if ((chunks->spilled = (chunk_spilled_t *)realloc(
+                            chunks->spilled, sizeof(chunk_spilled_t) *
+                            chunks->spilled_cap)) == NULL) {
+                panic("Error allocating chunk spill index!");
+            }
+        }
+
+        memmove(chunks->spilled + pos + 1, chunks->spilled + pos,
+                sizeof(chunk_spilled_t) * (chunks->spilled_len - pos));
+        chunks->spilled[pos].key.cy = chunk->cy;
+        chunks->spilled[pos].key.cx = chunk->cx;
+        chunks->spilled[pos].slot = chunks->spilled_len++;
+    }
+
+    if (pwrite(chunks->spill, chunk->cells, CHUNK_BYTES,
+                (off_t)(chunks->spilled[pos].slot * CHUNK_BYTES)) !=
+            (ssize_t)CHUNK_BYTES) {
+        panic("Error writing chunk spill file!");
+    }
+    chunks->flushed++;
+}
+
+/*
+ * Reads the chunk back from the spill file, if it has been flushed. Until
+ * it is modified again the copy in the file is good.
+ *
+ * ret : 1 if *chunk* is filled
+ */
+static int chunks_unspill(chunks_t *chunks, chunk_t *chunk) {
+    size_t pos = chunks_spilled_find(chunks, chunk->cy, chunk->cx);
+
+    if (! chunks_spilled_at(chunks, pos, chunk->cy, chunk->cx)) {
+        return 0;
+    }
+
+    if ((chunk->cells = (cell_t *)malloc(CHUNK_BYTES)) == NULL) {
+        panic("Error allocating chunk cells!");
+    }
+    if (pread(chunks->spill, chunk->cells, CHUNK_BYTES,
+                (off_t)(chunks->spilled[pos].slot * CHUNK_BYTES)) !=
+            (ssize_t)CHUNK_BYTES) {
+        panic("Error reading chunk spill file!");
+    }
+
+    return 1;
+}
+
+/*
+ * Frees least recently used chunk. Modified chunks are flushed first,
+ * client chunks are kept.
+ */
+static void chunks_evict(chunks_t *chunks) {
+    chunk_t *victim = chunks->lru_tail;
+
+    if (victim == NULL || chunks->generate == NULL) {
+        return;
+    }
+
+    if (victim->dirty) {
+        chunks_flush(chunks, victim);
+    }
+
+    chunk_t **bucket = chunks->buckets + chunks_hash(chunks, victim->cy,
+            victim->cx);
+    while (*bucket != victim) {
+        bucket = &(*bucket)->hnext;
+    }
+    *bucket = victim->hnext;
+
+    chunks_lru_unlink(chunks, victim);
+    if (chunks->last == victim) {
+        chunks->last = NULL;
+    }
+
+    chunks_free(victim);
+    chunks->count--;
+    chunks->evicted++;
+}
+
+/*
+ * Finds the chunk and marks it as recently used. Should be called locked.
+ *
+ * create : make missing chunk even if there is no generator
+ *
+ * ret    : chunk or NULL if it is missing and wasn't created
+ */
+static chunk_t *chunks_get(chunks_t *chunks, uint32_t cy, uint32_t cx,
+        int create) {
+    chunk_t *chunk = chunks->last;
+
+    if (chunk != NULL && chunk->cy == cy && chunk->cx == cx) {
+        return chunk;
+    }
+
+    size_t hash = chunks_hash(chunks, cy, cx);
+    for (chunk = chunks->buckets[hash]; chunk != NULL; chunk = chunk->hnext) {
+        if (chunk->cy == cy && chunk->cx == cx) {
+            break;
+        }
+    }
+
+    if (chunk == NULL) {
+        if (! create && chunks->generate == NULL) {
+            return NULL;
+        }
+
+        if (chunks->count >= chunks->max) {
+            chunks_evict(chunks);
+        }
+
+        if ((chunk = (chunk_t *)malloc(sizeof(chunk_t))) == NULL) {
+            panic("Error allocating chunk!");
+        }
+        chunk->cy = cy;
+        chunk->cx = cx;
+        chunk->version = ++chunks->clock;
+        chunk->dirty = 0;
+        chunk->mapped = 0;
+
+        const cell_t *saved = NULL;
+        if (chunks_unspill(chunks, chunk)) {
+            // Modified chunk is newer than the world file
+        } else if (chunks->map != NULL && (saved = chunks->map(
+                        chunks->generate_arg, cy, cx)) != NULL) {
+            chunk->cells = (cell_t *)saved;
+            chunk->mapped = 1;
+            chunks->mapped++;
+        } else if ((chunk->cells = (cell_t *)malloc(CHUNK_BYTES)) == NULL) {
+            panic("Error allocating chunk cells!");
+        } else if (chunks->generate != NULL) {
+            chunks->generate(chunks->generate_arg, chunk);
+            chunks->generated++;
+        } else {
+            memset(chunk->cells, '\0', CHUNK_BYTES);
+        }
+
+        chunk->hnext = chunks->buckets[hash];
+        chunks->buckets[hash] = chunk;
+        chunks->count++;
+    } else {
+        chunks_lru_unlink(chunks, chunk);
+    }
+
+    chunks_lru_push(chunks, chunk);
+    chunks->last = chunk;
+
+    return chunk;
+}
+
+/*
+ * Makes sure the chunk is in memory.
+ */
+void chunks_load(chunks_t *chunks, uint32_t cy, uint32_t cx) {
+    CHUNKS_LOCK;
+    chunks_get(chunks, cy, cx, 0);
+    CHUNKS_UNLOCK;
+}
+
+/*
+ * Lists chunks which are in memory now and the flushed ones. A chunk may
+ * be listed twice.
+ *
+ * keys : malloc'ed array of chunk coordinates, caller frees it
+ *
+ * ret  : number of *keys*
+ */
+size_t chunks_keys(chunks_t *chunks, chunk_key_t **keys) {
+    size_t count = 0;
+
+    CHUNKS_LOCK;
+    if ((*keys = (chunk_key_t *)malloc(sizeof(chunk_key_t) *
+                    (chunks->count + chunks->spilled_len + 1))) == NULL) {
+        panic("Error allocating chunk keys!");
+    }
+    for (chunk_t *curr = chunks->lru_head; curr != NULL;
+            curr = curr->lru_next) {
+        (*keys)[count].cy = curr->cy;
+        (*keys)[count].cx = curr->cx;
+        count++;
+    }
+    for (size_t i = 0; i < chunks->spilled_len; i++) {
+        (*keys)[count++] = chunks->spilled[i].key;
+    }
+    CHUNKS_UNLOCK;
+
+    return count;
+}
+
+/*
+ * Copies cells of the chunk, if it has changed.
+ *
+ * version     : version known by the caller
+ * cells       : CHUNK_CELLS cells
+ * new_version : current version of the chunk
+ *
+ * ret         : 1 if *cells* were copied
+ */
+int chunks_copy(chunks_t *chunks, uint32_t cy, uint32_t cx, uint64_t version,
+        cell_t *cells, uint64_t *new_version) {
+    int rc = 0;
+
+    CHUNKS_LOCK;
+    chunk_t *chunk = chunks_get(chunks, cy, cx, 0);
+    if (chunk != NULL && chunk->version != version) {
+        memcpy(cells, chunk->cells, CHUNK_BYTES);
+        *new_version = chunk->version;
+        rc = 1;
+    }
+    CHUNKS_UNLOCK;
+
+    return rc;
+}
+
+/*
+ * ret : cell or S_NONE if there is no such chunk on the client
+ */
+cell_t chunks_cell(chunks_t *chunks, uint32_t y, uint32_t x) {
+    cell_t cell = TILE_CELL(S_NONE, 0);
+
+    CHUNKS_LOCK;
+    chunk_t *chunk = chunks_get(chunks, y >> CHUNK_BITS, x >> CHUNK_BITS, 0);
+    if (chunk != NULL) {
+        cell = chunk->cells[(y & CHUNK_MASK) << CHUNK_BITS | (x & CHUNK_MASK)];
+    }
+    CHUNKS_UNLOCK;
+
+    return cell;
+}
+
+/*
+ * Reads a horizontal line of cells, which may cross chunks.
+ */
+void chunks_read(chunks_t *chunks, uint32_t y, uint32_t x, cell_t *cells,
+        uint32_t count) {
+    CHUNKS_LOCK;
+    while (count > 0) {
+        uint32_t len = CHUNK_SIZE - (x & CHUNK_MASK);
+        if (len > count) {
+            len = count;
+        }
+
+        chunk_t *chunk = chunks_get(chunks, y >> CHUNK_BITS, x >> CHUNK_BITS,
+                0);
+        if (chunk != NULL) {
+            memcpy(cells, chunk->cells + ((y & CHUNK_MASK) << CHUNK_BITS |
+                        (x & CHUNK_MASK)), sizeof(cell_t) * len);
+        } else {
+            memset(cells, '\0', sizeof(cell_t) * len);
+        }
+
+        cells += len;
+        x += len;
+        count -= len;
+    }
+    CHUNKS_UNLOCK;
+}
+
+/*
+ * Writes a horizontal line of cells, which may cross chunks. Mapped chunks
+ * are copied before the first change. Modified chunks of generated levels
+ * are flushed to the spill file when evicted.
+ *
+ * cells : *count* cells, may be unaligned
+ */
+void chunks_write(chunks_t *chunks, uint32_t y, uint32_t x,
+        const void *cells, uint32_t count) {
+    const char *src = (const char *)cells;
+
+    CHUNKS_LOCK;
+    while (count > 0) {
+        uint32_t len = CHUNK_SIZE - (x & CHUNK_MASK);
+        if (len > count) {
+            len = count;
+        }
+
+        chunk_t *chunk = chunks_get(chunks, y >> CHUNK_BITS, x >> CHUNK_BITS,
+                1);
+        cell_t *dst = chunk->cells + ((y & CHUNK_MASK) << CHUNK_BITS |
+                (x & CHUNK_MASK));
+        if (memcmp(dst, src, sizeof(cell_t) * len) != 0) {
+            if (chunk->mapped) {
+                cell_t *copy;
+                if ((copy = (cell_t *)malloc(CHUNK_BYTES)) == NULL) {
+                    panic("Error allocating chunk cells!");
+                }
+                memcpy(copy, chunk->cells, CHUNK_BYTES);
+                dst = copy + (dst - chunk->cells);
+                chunk->cells = copy;
+                chunk->mapped = 0;
+            }
+            memcpy(dst, src, sizeof(cell_t) * len);
+            chunk->version = ++chunks->clock;
+            chunk->dirty = chunks->generate != NULL;
+        }
+
+        src += sizeof(cell_t) * len;
+        x += len;
+        count -= len;
+    }
+    CHUNKS_UNLOCK;
+}
@@ -0,0 +1,103 @@
+// vim: sw=4 ts=4 et :
+#ifndef CHUNK_H
+#define CHUNK_H
+
+/*
+ * Levels are split into square chunks, which are kept in a hash table with
+ * LRU eviction. Server maps missing chunks from the world file or generates
+ * them on first access, client fills them from MSG_PUT_AREA_DELTA.
+ *
+ * Modified chunks of the server can't be generated again, so they are
+ * flushed to a spill file when evicted and read back from it. Client
+ * chunks are never evicted: the server sends only what has changed since
+ * the chunk was sent (see connection_t.area_sent).
+ */
+#define CHUNK_BITS 6
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+#define CHUNK_CELLS (CHUNK_SIZE * CHUNK_SIZE)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_BYTES (sizeof(cell_t) * CHUNK_CELLS)
+
+// Chunks number can't be lower whatever memory budget is
+#define CHUNKS_MIN 64
+
+typedef struct chunk {
+    uint32_t cy;                    // chunk Y, cell Y >> CHUNK_BITS
+    uint32_t cx;                    // chunk X, cell X >> CHUNK_BITS
+    uint64_t version;               // changes on every modification
+    uint8_t dirty;                  // modified since it has been loaded
+    uint8_t mapped;                 // *cells* are read-only, copied on write
+    struct chunk *hnext;            // next chunk in hash bucket
+    struct chunk *lru_prev;         // more recently used chunk
+    struct chunk *lru_next;         // less recently used chunk
+    cell_t *cells;                  // CHUNK_CELLS cells row by row
+} chunk_t;
+
+typedef struct chunk_key {
+    uint32_t cy;
+    uint32_t cx;
+} chunk_key_t;
+
+// Modified chunk in the spill file, see chunks_flush()
+typedef struct chunk_spilled {
+    chunk_key_t key;
+    uint64_t slot;                  // offset in CHUNK_BYTES
+} chunk_spilled_t;
+
+typedef struct chunks {
+    chunk_t **buckets;              // hash table
+    size_t mask;                    // buckets number - 1
+    chunk_t *lru_head;              // most recently used chunk
+    chunk_t *lru_tail;              // least recently used chunk
+    chunk_t *last;                  // last accessed chunk
+    size_t count;                   // chunks in memory
+    size_t max;                     // chunks allowed in memory
+    uint64_t clock;                 // source of chunk versions
+
+    // Fills new chunk, called with the chunks locked. NULL for empty chunks.
+    void (*generate)(void *arg, chunk_t *chunk);
+    // Returns saved cells of the chunk or NULL, tried before *generate*
+    const cell_t *(*map)(void *arg, uint32_t cy, uint32_t cx);
+    void *generate_arg;
+
+    int spill;                      // spill file or -1
+    chunk_spilled_t *spilled;       // sorted by Y, then X
+    size_t spilled_len;
+    size_t spilled_cap;
+
+    size_t generated;               // statistics
+    size_t mapped;
+    size_t evicted;
+    size_t flushed;
+
+    pthread_mutex_t mutex;
+} chunks_t;
+
+/*
+ * Chunk, as it is known by the client. Server keeps a small window of such
+ * chunks around the player for every connection to send deltas.
+ */
+typedef struct chunk_sent {
+    uint8_t used;                   // slot is taken
+    uint32_t cy;
+    uint32_t cx;
+    uint64_t version;               // chunk version sent, 0 if none
+    cell_t cells[CHUNK_CELLS];
+} chunk_sent_t;
+
+void chunks_init(chunks_t *chunks, size_t memory,
+        void (*generate)(void *arg, chunk_t *chunk),
+        const cell_t *(*map)(void *arg, uint32_t cy, uint32_t cx),
+        void *generate_arg);
+void chunks_destroy(chunks_t *chunks);
+void chunks_load(chunks_t *chunks, uint32_t cy, uint32_t cx);
+size_t chunks_keys(chunks_t *chunks, chunk_key_t **keys);
+int chunks_copy(chunks_t *chunks, uint32_t cy, uint32_t cx, uint64_t version,
+        cell_t *cells, uint64_t *new_version);
+cell_t chunks_cell(chunks_t *chunks, uint32_t y, uint32_t x);
+void chunks_read(chunks_t *chunks, uint32_t y, uint32_t x, cell_t *cells,
+        uint32_t count);
+void chunks_write(chunks_t *chunks, uint32_t y, uint32_t x,
+        const void *cells, uint32_t count);
+
+#endif /* CHUNK_H */
@@ -36,9 +36,6 @@ void* worker() {
     int rc;
     struct timeval timeout;
 
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 50000;
-
     if (pthread_detach(pthread_self()) != 0) {
         panic("Error detaching pthread!");
     }
@@ -46,14 +43,14 @@ void* worker() {
     // Send nickname
     mbuf_t mbuf;
     mbuf.msg.type = MSG_REPORT_NICKNAME;
-    mbuf.msg.size = strlen(CONF_SVAL("player_nickname")) + 2;
+    mbuf.msg.size = strlen(CONF_SVAL(CF_PLAYER_NICKNAME)) + 2;
     if (NULL == (mbuf.payload = (char*)malloc(mbuf.msg.size))) {
         panic("[C] Cannot allocate nickname payload buffer");
     }
     char color[2] = "0";
-    color[0] = '0' + CONF_IVAL("player_color");
+    color[0] = '0' + CONF_IVAL(CF_PLAYER_COLOR);
     strcpy(mbuf.payload, color);
-    strcat(mbuf.payload, CONF_SVAL("player_nickname"));
+    strcat(mbuf.payload, CONF_SVAL(CF_PLAYER_NICKNAME));
     mqueue_put(&c2s_queue, mbuf);
 
     do {
@@ -61,6 +58,7 @@ void* worker() {
         FD_ZERO(&fds);
         FD_SET(sock, &fds);
         mbuf_t mbuf;
+        uint8_t header[MSG_HEADER_SIZE];
 
         // send messages to the server if any
         while (mqueue_get(&c2s_queue, &mbuf) > 0) {
@@ -69,6 +67,9 @@ void* worker() {
             }
         }
 
+        // select() eats the timeout on Linux, it is set every time
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 50000;
         do {
             rc = select(sock + 1, &fds, NULL, NULL, &timeout);
         } while (rc < 0 && errno == EINTR);
@@ -81,7 +82,7 @@ void* worker() {
             continue;
         }
 
-        if ((rc = readall(sock, &mbuf.msg, sizeof(mbuf.msg))) == 0) {
+        if ((rc = readall(sock, header, MSG_HEADER_SIZE)) == 0) {
             server_connected = 0;
             // TODO implement dialog with this message:
             logger("[C] Error getting message in worker!");
@@ -92,6 +93,14 @@ void* worker() {
             break;
         }
 
+        msg_decode(header, &mbuf.msg);
+        if (mbuf.msg.version != PROTOCOL_VERSION_WIRE) {
+            loggerf("[C] Protocol version mismatch: %d, expected %d!",
+                    mbuf.msg.version, PROTOCOL_VERSION_WIRE);
+            server_connected = 0;
+            break;
+        }
+
         // rc > 0
         switch (mbuf.msg.type) {
             case MSG_PUT_CHAT:
@@ -100,12 +109,15 @@ void* worker() {
             case MSG_PUT_SYSMSG:
                 logger("[C] [PUT_SYSMSG]");
                 break;
-            case MSG_PUT_AREA:
-                logger("[C] [PUT_AREA]");
+            case MSG_PUT_AREA_DELTA:
+                logger("[C] [PUT_AREA_DELTA]");
                 break;
             case MSG_PUT_PLAYERS_FULL:
                 logger("[C] [PUT_PLAYERS_FULL]");
                 break;
+            case MSG_PUT_PLAYER_SELF:
+                logger("[C] [PUT_PLAYER_SELF]");
+                break;
             case MSG_PUT_PLAYERS:
                 logger("[C] [PUT_PLAYERS]");
                 break;
@@ -132,12 +144,12 @@ void* worker() {
                 logger("[C] Error reading payload");
             }
 
-            loggerf("[C] Received buf: [%s]", payload);
+            loggerf("[C] Received buf: [%.*s]", (int)mbuf.msg.size, payload);
         }
 
         switch (mbuf.msg.type) {
             case MSG_PUT_CHAT:
-                c_chat_add(payload);
+                c_chat_add(payload, mbuf.msg.size);
 
                 free(payload);
 
@@ -148,26 +160,32 @@ void* worker() {
                 free(payload);
 
                 break;
-            case MSG_PUT_AREA:
-                c_area_update(1, (tileblock_t *)payload);
+            case MSG_PUT_AREA_DELTA:
+                c_area_delta(payload, mbuf.msg.size);
 
                 free(payload);
 
                 break;
             case MSG_PUT_PLAYERS_FULL:
-                c_receive_players_full((players_full_mbuf_t *)payload);
+                c_receive_players_full(payload, mbuf.msg.size);
+
+                free(payload);
+
+                break;
+            case MSG_PUT_PLAYER_SELF:
+                c_receive_player_self(payload, mbuf.msg.size);
 
                 free(payload);
 
                 break;
             case MSG_PUT_PLAYERS:
-                c_receive_players((players_mbuf_t *)payload);
+                c_receive_players(payload, mbuf.msg.size);
 
                 free(payload);
 
                 break;
             case MSG_PUT_LEVEL:
-                c_level_add((level_t *)payload);
+                c_level_add(payload, mbuf.msg.size);
 
                 free(payload);
 
@@ -182,6 +200,26 @@ void* worker() {
     return NULL;
 }
 
+/*
+ * Rebuilds the locale, glyphs, key map and windows layout when the config
+ * has been reloaded.
+ */
+static void c_config_apply() {
+    static unsigned generation = 0;
+    unsigned current = config_generation();
+
+    if (current == generation) {
+        return;
+    }
+    generation = current;
+
+    locale_init(CONF_SVAL(CF_FILE_LOCALE));
+    stuff_init();
+    keyboard_init();
+    windows_init(1);
+    windows_touch();
+}
+
 void worker_start() {
     if (pthread_create(&thr_worker, NULL, &worker, NULL) != 0) {
         panic("Error creating worker thread!");
@@ -198,7 +236,8 @@ int client() {
         panic("Unable to set locale (ru,en)UTF-8!");
     }
 
-    locale_init(CONF_SVAL("file_locale"));
+    locale_init(CONF_SVAL(CF_FILE_LOCALE));
+    config_watch();
 
     mqueue_init(&c2s_queue);
 
@@ -239,12 +278,19 @@ int client() {
 
         CHECK_CONNECTION();
 
+        c_config_apply();
+
         windows_redraw();
 
         wtimeout(stdscr, 100);
         last_key = mvgetch(max_y - 1, max_x - 1);
+        if (last_key != ERR) {
+            // The key is shown in the area
+            windows_damage(W_AREA, DAMAGE_PART);
+        }
         if (K[K_MENU_LARGE] == last_key) {
             menu(M_MAIN);
+            windows_touch();
         } else if (K[K_CHAT_LARGE] == last_key) {
             c_chat_open();
         } else if (K[K_SYSMSG_LARGE] == last_key) {
@@ -261,6 +307,8 @@ int client() {
             HANDLE_MOVE(K_MOVE_LEFT_DOWN);
             HANDLE_MOVE(K_MOVE_RIGHT_DOWN);
 #undef HANDLE_MOVE
+        } else if (K[K_MOVE_CANCEL] == last_key) {
+            c_send_cancel();
         } else if (K[K_INVENTORY_LARGE] == last_key) {
             c_inventory_open();
         } else if (K[K_EXIT] == last_key) {
@@ -268,6 +316,7 @@ int client() {
         } else if (K[K_CLR_SCR] == last_key) {
             wclear(stdscr);
             wrefresh(stdscr);
+            windows_touch();
         }
     } while (! end);
 
@@ -16,6 +16,7 @@
     while (server_connected == 0) {                                         \
         strncpy(menu_msg, _("Server connection lost!"), sizeof(menu_msg));  \
         menu(M_MAIN);                                                       \
+        windows_touch();                                                    \
     }
 
 int last_key;               // keycode of the last pressed key
@@ -57,5 +58,6 @@ extern void menu(size_t menu_id);
 extern void splash_screen();
 extern void locale_init(char *file);
 extern char *_(char*);
+extern size_t locale_len(char *str);
 
 #endif /* CLIENT_H */
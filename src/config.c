@@ -1,15 +1,73 @@
 // vim: sw=4 ts=4 et :
 #include "config.h"
-#include "default_config.h"
 #include "itmmorgue.h"
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define CONFIG_INOTIFY
+#endif /* __linux__ */
+
+// Option handles by key, used only to parse the files
 trie_t *t_conf = NULL; 
 int recursion_depth = 6;
 
+/*
+ * Values of the options by handle. Every reload builds a new snapshot and
+ * publishes it here, readers take no locks. Readers may hold strings of a
+ * snapshot for as long as they like (a world save, a locale load), so the
+ * replaced snapshots are kept until exit: they are small and reloads are
+ * rare.
+ */
+conf_t *conf_values = NULL;
+static conf_t **conf_retired = NULL;
+static size_t conf_retired_len = 0;
+
+// Snapshot parse_file() fills
+static conf_t *conf_parsing = NULL;
+
+// Main config file, see config_reload()
+static char *config_file = NULL;
+static pthread_mutex_t config_reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned config_gen = 0;
+
+// Files watched by config_watch()
+#define CONFIG_WATCH_MAX 16
+#define CONFIG_WATCH_DELAY 100  // ms to wait for the rest of a file update
+
+static struct config_watched {
+    char *file;
+    int wd;                         // inotify watch of the directory
+} config_watched[CONFIG_WATCH_MAX];
+static size_t config_watched_len = 0;
+static pthread_mutex_t config_watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef CONFIG_INOTIFY
+static int config_inotify = -1;
+static pid_t config_watcher = 0;
+#endif /* CONFIG_INOTIFY */
+
+struct conf_default {
+    char *key;
+    conf_t value;
+};
+
+static struct conf_default conf_defaults[CF_SIZE] = {
+#define C_STR(handle, key, val) \
+    [handle] = { key, { { .__sval = val }, CONF_STRING } },
+#define C_INT(handle, key, val) \
+    [handle] = { key, { { .__ival = val }, CONF_INT } },
+#define C_CHR(handle, key, val) \
+    [handle] = { key, { { .__cval = val }, CONF_CHAR } },
+#include "default_config.h"
+#undef C_STR
+#undef C_INT
+#undef C_CHR
+};
+
 enum config_parser_retval parse_option(char *buf, size_t len, size_t *offset,
         char *key, char *value, enum conf_type *type);
 
-void parse_file(char *file);
+int parse_file(char *file);
 
 // Parsers for specific value types, called by parse_option()
 static enum config_parser_retval parse_option_string(const char *opt,
@@ -27,18 +85,38 @@ static enum config_parser_retval (*parsers[])(const char *opt, conf_t *rc) = {
 };
 
 /* 
- * The only accessor to config values from other modules
+ * Config value by the option name. Use CONF_*VAL() with the handle if the
+ * option is known at compile time.
  */
 conf_t conf(char *key) {
-    conf_t *rc;
+    enum conf_handle *handle;
 
-    if ((rc = (conf_t *)trie_get(t_conf, key)) != NULL) {
-        return *rc;
-    } else {
+    if ((handle = (enum conf_handle *)trie_get(t_conf, key)) == NULL) {
         panicf("Invalid conf(%s) requested!", key);
     }
 
-    return *rc;
+    return CONF_VALUES[*handle];
+}
+
+/*
+ * ret : name of the option
+ */
+char *conf_key(enum conf_handle handle) {
+    return conf_defaults[handle].key;
+}
+
+/*
+ * Sets the option, the string it replaces is freed unless it is the default
+ * one.
+ */
+static void conf_set(enum conf_handle handle, conf_t *value) {
+    conf_t *curr = conf_parsing + handle;
+
+    if (curr->type == CONF_STRING &&
+            curr->sval != conf_defaults[handle].value.sval) {
+        free(curr->sval);
+    }
+    *curr = *value;
 }
 
 /*
@@ -126,46 +204,64 @@ void remove_spaces(char **str) {
 }
 
 /*
- * Used by trie_* to deallocate elements of conf_t type.
+ * Keys split by config_divisor(). Tries may keep the parts of the keys they
+ * store, those live in divisor_keys forever. Parts of the keys looked up
+ * are needed only until the lookup ends, so the next split on the thread
+ * reuses their memory.
  */
-void config_deallocator(void *rc) {
-    if (NULL == rc) return;
-    if (CONF_STRING == ((conf_t*)rc)->type) {
-        free(((conf_t*)rc)->sval);
-    }
-    free(rc);
-}
+static arena_t divisor_keys;
+static pthread_mutex_t divisor_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread arena_t divisor_scratch;
+static __thread int divisor_keep = 0;
 
 /* 
  * Used by trie_* to split keys
  * In config case perl equivalent is: split /_/, str
+ *
+ * ret : NULL terminated parts of *str*, see divisor_keys
  */
 char** config_divisor(const char *str) {
-    int i = 0, j = 0;
-    char **rc = malloc(sizeof(char*));
+    size_t len = strlen(str);
+    size_t parts = 1;
+    arena_t *arena = &divisor_scratch;
 
-    while (*str) {
-        while (str[i] && str[i] != '_') i++;
+    for (size_t i = 0; i < len; i++) {
+        parts += str[i] == '_';
+    }
 
-        if (i == 0) {
-            str++;
-            continue;
-        }
+    if (divisor_keep) {
+        arena = &divisor_keys;
+        pthread_mutex_lock(&divisor_keys_mutex);
+    } else {
+        arena_reset(arena);
+    }
 
-        // we have no need in memory deallocation ;-)
-        if ((rc = (char **)realloc(rc, sizeof(char *) * (j + 2))) == NULL) {
-            panic("Unable to realloc in config_divisor!");
-        }
+    // Parts are cut in place from a copy of the key
+    char **rc = (char **)arena_alloc(arena,
+            sizeof(char *) * (parts + 1) + len + 1);
+    char *copy = (char *)(rc + parts + 1);
 
-        if ((rc[j] = malloc(i + 1)) == NULL) {
-            panic("Unable to allocate memory in config_divisor!");
-        }
+    if (divisor_keep) {
+        pthread_mutex_unlock(&divisor_keys_mutex);
+    }
 
-        memcpy(rc[j], str, i);
-        rc[j++][i] = '\0';
+    memcpy(copy, str, len + 1);
 
-        str += i;
-        i = 0;
+    size_t j = 0;
+    for (char *part = copy; *part; ) {
+        char *end = strchr(part, '_');
+
+        if (end == part) {
+            part++;
+            continue;
+        }
+
+        rc[j++] = part;
+        if (end == NULL) {
+            break;
+        }
+        *end = '\0';
+        part = end + 1;
     }
 
     rc[j] = NULL;
@@ -173,8 +269,20 @@ char** config_divisor(const char *str) {
     return rc;
 }
 
+/*
+ * trie_put() for tries split by config_divisor()
+ */
+int config_trie_put(trie_t *trie, const char *key, void *val, size_t size,
+        void (*dealloc)(void *)) {
+    divisor_keep = 1;
+    int rc = trie_put(trie, key, val, size, dealloc);
+    divisor_keep = 0;
+
+    return rc;
+}
+
 /* 
- * Singleton initialization of t_conf with default values
+ * Singleton initialization of t_conf with the option handles
  */
 static void config_pre_init() {
     if (t_conf != NULL) {
@@ -185,11 +293,10 @@ static void config_pre_init() {
         panic("Unable to allocate config trie!");
     }
 
-    for (size_t i = 0; i < t_conf_default_size; i++) {
-        if (trie_put(t_conf, t_conf_default[i].key,
-                    (void*)&(t_conf_default[i].value), sizeof(conf_t),
-                    NULL) != 0) {
-            panicf("Failed to initialize t_conf[%s]!", t_conf_default[i].key);
+    for (enum conf_handle i = 0; i < CF_SIZE; i++) {
+        if (config_trie_put(t_conf, conf_defaults[i].key, (void *)&i,
+                    sizeof(enum conf_handle), NULL) != 0) {
+            panicf("Failed to initialize t_conf[%s]!", conf_defaults[i].key);
         }
     }
 }
@@ -198,45 +305,89 @@ static void config_pre_init() {
  * Dump config to STDERR for _DEBUG purposes.
  */
 void config_dump() {
-    conf_t *curr;
-
     fprintf(stderr, " === Config dump === \n");
 
-    for (size_t i = 0; i < t_conf_default_size; i++) {
-        char *key = t_conf_default[i].key;
-
-        if ((curr = (conf_t *)trie_get(t_conf, key)) != NULL) {
-            switch (curr->type) {
-                case CONF_STRING:
-                    fprintf(stderr, "conf[%s] = %s\n", key, curr->sval);
-                    break;
-                case CONF_INT:
-                    fprintf(stderr, "conf[%s] = %d\n", key, curr->ival);
-                    break;
-                case CONF_CHAR:
-                    fprintf(stderr, "conf[%s] = '%c' (%d)\n", key, curr->cval,
-                            curr->cval);
-                    break;
-                default:
-                    panic("config_dump()::switch() needs fix!");
-            }
-        } else {
-            panic("Memory corruption!");
+    for (enum conf_handle i = 0; i < CF_SIZE; i++) {
+        char *key = conf_defaults[i].key;
+        conf_t *curr = CONF_VALUES + i;
+
+        switch (curr->type) {
+            case CONF_STRING:
+                fprintf(stderr, "conf[%s] = %s\n", key, curr->sval);
+                break;
+            case CONF_INT:
+                fprintf(stderr, "conf[%s] = %d\n", key, curr->ival);
+                break;
+            case CONF_CHAR:
+                fprintf(stderr, "conf[%s] = '%c' (%d)\n", key, curr->cval,
+                        curr->cval);
+                break;
+            default:
+                panic("config_dump()::switch() needs fix!");
         }
     }
 }
 
-/* 
- * Initialize configuration from file
+/*
+ * Parse errors are fatal at start, a reload just logs them and keeps the
+ * values it has.
  */
-void config_init(char *file) {
-    config_pre_init();
+static void config_error(char *msg) {
+    if (conf_values == NULL) {
+        panic(msg);
+    }
+    logger(msg);
+}
+#define config_errorf(fmt, ...)                     \
+    do {                                            \
+        char ___buf[BUFSIZ];                        \
+        snprintf(___buf, BUFSIZ, fmt, __VA_ARGS__); \
+        config_error(___buf);                       \
+    } while(0)
+
+// Notes on missing files are shown at start only
+#define config_notef(fmt, ...)                      \
+    do {                                            \
+        if (conf_values == NULL) {                  \
+            warnf(fmt, __VA_ARGS__);                \
+        }                                           \
+    } while(0)
+
+/*
+ * Frees the strings of the snapshot, which parse_file() has allocated.
+ */
+static void config_free(conf_t *values) {
+    for (enum conf_handle i = 0; i < CF_SIZE; i++) {
+        if (values[i].type == CONF_STRING &&
+                values[i].sval != conf_defaults[i].value.sval) {
+            free(values[i].sval);
+        }
+    }
+    free(values);
+}
+
+/*
+ * Fills a new snapshot from the main config file and the user's ones.
+ *
+ * file : main config file
+ *
+ * ret  : the snapshot or NULL on parse error
+ */
+static conf_t *config_load(char *file) {
+    int rc = 0;
+
+    if ((conf_parsing = (conf_t *)malloc(sizeof(conf_t) * CF_SIZE)) == NULL) {
+        panic("Error allocating config values!");
+    }
+    for (enum conf_handle i = 0; i < CF_SIZE; i++) {
+        conf_parsing[i] = conf_defaults[i].value;
+    }
 
     if (access(file, R_OK) < 0) {
-        warnf("Unable to initialize main config: %s", file);
+        config_notef("Unable to initialize main config: %s", file);
     }
 
-    parse_file(file);
+    rc |= parse_file(file);
 
     char *home = getenv("HOME");
     if (home && *home) {
@@ -245,52 +396,266 @@ void config_init(char *file) {
         snprintf(buf, sizeof(buf), "%s/.config/%s", home, file);
 
         if (access(buf, R_OK) < 0) {
-            warnf("[info] Config: %s: not found.", buf);
+            config_notef("[info] Config: %s: not found.", buf);
         } else {
-            parse_file(buf);
+            rc |= parse_file(buf);
         }
 
         snprintf(buf, sizeof(buf), "%s/.%s", home, file);
 
         if (access(buf, R_OK) < 0) {
-            warnf("[info] Config: %s: not found.", buf);
+            config_notef("[info] Config: %s: not found.", buf);
         } else {
-            parse_file(buf);
+            rc |= parse_file(buf);
         }
     }
 
+    conf_t *values = conf_parsing;
+    conf_parsing = NULL;
+    if (rc != 0) {
+        config_free(values);
+        return NULL;
+    }
+
+    return values;
+}
+
+/*
+ * The server is forked from the client, which may be reloading the config
+ * at the moment. Config locks are taken around fork(), so the child gets
+ * them unlocked.
+ */
+static void config_fork_prepare() {
+    pthread_mutex_lock(&config_reload_mutex);
+    pthread_mutex_lock(&config_watch_mutex);
+}
+
+static void config_fork_done() {
+    pthread_mutex_unlock(&config_watch_mutex);
+    pthread_mutex_unlock(&config_reload_mutex);
+}
+
+/* 
+ * Initialize configuration from file
+ */
+void config_init(char *file) {
+    config_pre_init();
+
+    if (pthread_atfork(&config_fork_prepare, &config_fork_done,
+                &config_fork_done) != 0) {
+        panic("Unable to set config fork handlers!");
+    }
+
+    conf_values = config_load(file);
+    config_file = file;
+
 #ifdef _DEBUG
     config_dump();
 #endif
 }
 
-void parse_file(char *file) {
-    if (--recursion_depth <= 0) {
-        panic("Too big recursion depth");
+/*
+ * Parses the config files again and publishes the new values. Modules that
+ * keep values derived from the config check config_generation().
+ */
+void config_reload() {
+    pthread_mutex_lock(&config_reload_mutex);
+
+    conf_t *values = config_load(config_file);
+    if (values == NULL) {
+        logger("Config: reload failed, old values are kept");
+    } else {
+        conf_t *old = __atomic_exchange_n(&conf_values, values,
+                __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&config_gen, 1, __ATOMIC_RELEASE);
+
+        if ((conf_retired = realloc(conf_retired, (conf_retired_len + 1) *
+                        sizeof(conf_t *))) == NULL) {
+            panic("Error allocating retired config!");
+        }
+        conf_retired[conf_retired_len++] = old;
+        logger("Config: reloaded");
     }
 
-    struct stat sb;
-    int fd, rc;
-    char *buf;
-    size_t size = 0;
+    pthread_mutex_unlock(&config_reload_mutex);
+}
 
-    char *key = (char*)malloc(MAX_OPT_LEN);
-    char *value = (char*)malloc(MAX_OPT_LEN);
+/*
+ * ret : number of the reloads done, the locale files changes count too
+ */
+unsigned config_generation() {
+    return __atomic_load_n(&config_gen, __ATOMIC_ACQUIRE);
+}
 
-    if (NULL == key || NULL == value) {
-        panic("Cannot allocate memory for config key/value buffers");
+#ifdef CONFIG_INOTIFY
+static void config_watch_add(struct config_watched *watched) {
+    char dir[PATH_MAX];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", watched->file);
+    if ((slash = strrchr(dir, '/')) == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else {
+        // "/file" is in "/"
+        slash[slash == dir] = '\0';
     }
 
+    // Editors often write a new file and rename it over the old one
+    if ((watched->wd = inotify_add_watch(config_inotify, dir,
+                    IN_CLOSE_WRITE | IN_MOVED_TO)) < 0) {
+        loggerf("Config: unable to watch %s", dir);
+    }
+}
+
+/*
+ * ret : whether the inotify *event* is about a watched file
+ */
+static int config_watched_event(struct inotify_event *event) {
+    int rc = 0;
+
+    pthread_mutex_lock(&config_watch_mutex);
+    for (size_t i = 0; i < config_watched_len && rc == 0; i++) {
+        char *name = strrchr(config_watched[i].file, '/');
+
+        name = name == NULL ? config_watched[i].file : name + 1;
+        rc = config_watched[i].wd == event->wd && event->len > 0 &&
+            strcmp(name, event->name) == 0;
+    }
+    pthread_mutex_unlock(&config_watch_mutex);
+
+    return rc;
+}
+
+static void* config_watch_thread(void *arg) {
+    // Aligned for struct inotify_event
+    union {
+        struct inotify_event event;
+        char buf[4096];
+    } events;
+    struct pollfd pfd = { config_inotify, POLLIN, 0 };
+    int changed = 0;
+    ssize_t len;
+
+    for (;;) {
+        // Files are reloaded once their updates calm down
+        if (changed && poll(&pfd, 1, CONFIG_WATCH_DELAY) == 0) {
+            changed = 0;
+            config_reload();
+        }
+
+        if ((len = read(config_inotify, events.buf, sizeof(events))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            panic("Error reading config file events!");
+        }
+
+        for (char *ptr = events.buf; ptr < events.buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+
+            changed |= config_watched_event(event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    (void)arg;
+    return NULL;
+}
+
+#endif /* CONFIG_INOTIFY */
+
+/*
+ * Makes config_watch() reload the config when *file* changes.
+ */
+void config_watch_file(char *file) {
+    pthread_mutex_lock(&config_watch_mutex);
+
+    for (size_t i = 0; i < config_watched_len; i++) {
+        if (strcmp(config_watched[i].file, file) == 0) {
+            pthread_mutex_unlock(&config_watch_mutex);
+            return;
+        }
+    }
+
+    if (config_watched_len == CONFIG_WATCH_MAX) {
+        pthread_mutex_unlock(&config_watch_mutex);
+        loggerf("Config: too many files, %s is not watched", file);
+        return;
+    }
+
+    struct config_watched *watched = config_watched + config_watched_len++;
+    if ((watched->file = strdup(file)) == NULL) {
+        panic("Error allocating watched file name!");
+    }
+    watched->wd = -1;
+#ifdef CONFIG_INOTIFY
+    if (config_inotify >= 0) {
+        config_watch_add(watched);
+    }
+#endif /* CONFIG_INOTIFY */
+
+    pthread_mutex_unlock(&config_watch_mutex);
+}
+
+/*
+ * Starts the thread which reloads the config when the files change. A
+ * forked process starts its own one. Without inotify the config is
+ * reloaded only by SIGHUP to the server.
+ */
+void config_watch() {
+#ifdef CONFIG_INOTIFY
+    pthread_t watcher;
+
+    pthread_mutex_lock(&config_watch_mutex);
+
+    if (config_watcher == getpid()) {
+        pthread_mutex_unlock(&config_watch_mutex);
+        return;
+    }
+    config_watcher = getpid();
+
+    // The parent's instance stays with its thread
+    if (config_inotify >= 0) {
+        close(config_inotify);
+    }
+    if ((config_inotify = inotify_init1(IN_CLOEXEC)) < 0) {
+        panic("Unable to initialize inotify!");
+    }
+    for (size_t i = 0; i < config_watched_len; i++) {
+        config_watch_add(config_watched + i);
+    }
+
+    if (pthread_create(&watcher, NULL, &config_watch_thread, NULL) != 0) {
+        panic("Unable to start config watching thread!");
+    }
+    pthread_detach(watcher);
+
+    pthread_mutex_unlock(&config_watch_mutex);
+#endif /* CONFIG_INOTIFY */
+}
+
+/*
+ * ret : contents of *file*, '\0' terminated, or NULL on error
+ */
+static char *config_read(char *file, size_t *size) {
+    struct stat sb;
+    int fd, rc;
+    char *buf;
+
     if (file == NULL || ! *file) {
-        panic("Invalid file specified for config!");
+        config_error("Invalid file specified for config!");
+        return NULL;
     }
 
     if (stat(file, &sb) < 0) {
-        panicf("Unable to stat file : %s!", file);
+        config_errorf("Unable to stat file : %s!", file);
+        return NULL;
     }
 
     if (sb.st_size <= 0 || sb.st_size > CONFIG_SIZE_MAX) {
-        panicf("Specified config file has invalid size: %ld!", sb.st_size);
+        config_errorf("Specified config file has invalid size: %ld!",
+                sb.st_size);
+        return NULL;
     }
 
     if ((buf = malloc(sb.st_size + 1)) == NULL) {
@@ -298,49 +663,94 @@ void parse_file(char *file) {
     }
 
     if ((fd = open(file, O_RDONLY, 0)) < 0) {
-        panic("Unable to open config file!");
+        free(buf);
+        config_error("Unable to open config file!");
+        return NULL;
     }
 
+    *size = 0;
     while (sb.st_size > 0) {
-        if ((rc = read(fd, buf + size, sb.st_size)) < 0) {
-            panic("Error reading config file!");
+        if ((rc = read(fd, buf + *size, sb.st_size)) <= 0) {
+            // The file may be cut while it is being read
+            close(fd);
+            free(buf);
+            config_error("Error reading config file!");
+            return NULL;
         }
-        size += rc;
+        *size += rc;
         sb.st_size -= rc;
     }
+    close(fd);
+
+    buf[*size] = '\0';
+
+    return buf;
+}
+
+/*
+ * Puts the options from *file* into the snapshot being loaded.
+ *
+ * ret : 0 on success, -1 on error
+ */
+int parse_file(char *file) {
+    size_t size;
+    char *buf;
+    int rc = 0;
+
+    if (--recursion_depth <= 0) {
+        recursion_depth++;
+        config_error("Too big recursion depth");
+        return -1;
+    }
+
+    if ((buf = config_read(file, &size)) == NULL) {
+        recursion_depth++;
+        return -1;
+    }
+    config_watch_file(file);
+
+    char *key = (char*)malloc(MAX_OPT_LEN);
+    char *value = (char*)malloc(MAX_OPT_LEN);
 
-    buf[size] = '\0';
+    if (NULL == key || NULL == value) {
+        panic("Cannot allocate memory for config key/value buffers");
+    }
 
     size_t buflen = size + 1;
     char *bufptr = buf;
     size_t offset;
     enum conf_type ct;
 
-    while (buflen > 0 && buflen < CONFIG_SIZE_MAX) {
+    while (rc == 0 && buflen > 0 && buflen < CONFIG_SIZE_MAX) {
         if (parse_option(bufptr, buflen, &offset, key, value, &ct) !=
                 CP_SUCCESS) {
-            panic("Error parsing config file!");
+            config_error("Error parsing config file!");
+            rc = -1;
+            break;
         }
 
         if (*key) {
             conf_t config_value;
             if (CP_SUCCESS != parsers[ct](value, &config_value)) {
-                panicf("Error parsing value for %s", key);
+                config_errorf("Error parsing value for %s", key);
+                rc = -1;
+                break;
             }
 
-            if (trie_put(t_conf, key, (void *)&config_value, sizeof(conf_t),
-                        config_deallocator) != 0) {
-                panic("Failed to fill t_conf!");
-            }
+            conf_set(*(enum conf_handle *)trie_get(t_conf, key),
+                    &config_value);
         }
 
         bufptr += offset;
         buflen -= offset;
     }
 
+    free(buf);
     free(value);
     free(key);
     recursion_depth++;
+
+    return rc;
 }
 
 /*
@@ -364,7 +774,7 @@ enum config_parser_retval parse_option(char *buf, size_t len, size_t *offset,
 
     size_t off = 0;
     size_t pos = 0;
-    conf_t *curr;
+    enum conf_handle *handle;
     char *include;
 
     while (off < len) {
@@ -388,6 +798,9 @@ enum config_parser_retval parse_option(char *buf, size_t len, size_t *offset,
                     off++;
                     continue;
                 } else if (buf[off] == '\0') {
+                    // Nothing but spaces till the end
+                    key[0] = '\0';
+                    *offset = len;
                     return CP_SUCCESS;
                 } else if (buf[off] == '=') {
                     return CP_NO_KEY;
@@ -401,7 +814,11 @@ enum config_parser_retval parse_option(char *buf, size_t len, size_t *offset,
                     return CP_UNDEF;
                 } else if (buf[off] == '\n') {
                     include[pos] = '\0';
-                    parse_file(include);
+                    int rc = parse_file(include);
+                    free(include);
+                    if (rc < 0) {
+                        return CP_UNDEF;
+                    }
                     key[0] = '\0';
                     *offset = off;
                     return CP_SUCCESS;
@@ -428,10 +845,12 @@ enum config_parser_retval parse_option(char *buf, size_t len, size_t *offset,
                     state = C_WAITEQ;
                     key[pos] = '\0';
                     pos = 0;
-                    if ((curr = (conf_t *)trie_get(t_conf, key)) == NULL) {
-                        panicf("Illegal option: %s!", key);
+                    if ((handle = (enum conf_handle *)trie_get(t_conf,
+                                    key)) == NULL) {
+                        config_errorf("Illegal option: %s!", key);
+                        return CP_UNDEF;
                     }
-                    *type = curr->type;
+                    *type = conf_defaults[*handle].value.type;
                     continue;
                 } else {
                     key[pos++] = buf[off++];
@@ -3,6 +3,7 @@
 #define CONFIG_H
 
 #include <string.h>
+#include "trie/trie.h"
 
 /*
  * Maximum length of option, includes length both of *key* and *value* in
@@ -39,12 +40,36 @@ typedef struct conf {
     enum conf_type type;   // type of value
 } conf_t;
 
+// Handles of the options, see default_config.h
+enum conf_handle {
+#define C_STR(handle, key, val) handle,
+#define C_INT(handle, key, val) handle,
+#define C_CHR(handle, key, val) handle,
+#include "default_config.h"
+#undef C_STR
+#undef C_INT
+#undef C_CHR
+    CF_SIZE
+};
+
+// Values of the options by handle, replaced as a whole on reload
+extern conf_t *conf_values;
+#define CONF_VALUES __atomic_load_n(&conf_values, __ATOMIC_ACQUIRE)
+
 // Definitions for quick config value access
-#define CONF_IVAL(x) conf(x).value.__ival
-#define CONF_SVAL(x) conf(x).value.__sval
-#define CONF_CVAL(x) conf(x).value.__cval
+#define CONF_IVAL(x) CONF_VALUES[x].value.__ival
+#define CONF_SVAL(x) CONF_VALUES[x].value.__sval
+#define CONF_CVAL(x) CONF_VALUES[x].value.__cval
 
 conf_t conf(char *key);
+char *conf_key(enum conf_handle handle);
+char** config_divisor(const char *str);
+int config_trie_put(trie_t *trie, const char *key, void *val, size_t size,
+        void (*dealloc)(void *));
 void config_init(char *file);
+void config_reload();
+unsigned config_generation();
+void config_watch_file(char *file);
+void config_watch();
 
 #endif /* CONFIG_H */
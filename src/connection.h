@@ -2,20 +2,61 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+// So shity C language
+struct reactor;
+
+/*
+ * Part of the level shown by the client. Reported with MSG_REPORT_VIEW
+ * whenever it changes, numbers in host byte order.
+ */
+typedef struct view {
+    uint32_t top_y;
+    uint32_t top_x;
+    uint32_t height;
+    uint32_t width;
+} view_t;
+
 /*
  * Represents client's connection to server.
  */
 typedef struct connection {
     struct sockaddr_in curr_client; // Client socket address
     socklen_t curr_client_len;      // Size of previous field
-    int socket;                     // Client socket file descriptor
-    pthread_mutex_t socket_mutex;   // Mutex for synchronizing reading
-    pthread_t thread;               // Worker thread
+    int socket;                     // Client socket descriptor, O_NONBLOCK
     int id;                         // Number of client
+    size_t player_id;               // Index of the player in players[]
+    uint32_t player_generation;     // Generation of *player_id* slot
+    size_t player_sent;             // *player_id* + 1 known by the client
+    size_t players_dropped;         // Queue drops seen at the last roster
+    size_t level_dropped;           // Queue drops seen at the last level
     uint32_t sysmsg_mask;           // Mask of system messages (see protocol.h)
+    chunk_sent_t *area_sent;        // Chunks around the player, client's copy
+    size_t area_sent_len;           // Number of slots in *area_sent*
+    size_t area_dropped;            // Queue drops seen at the last area sync
+    view_t view;                    // Zero height until reported
+    uint64_t *sight;                // Bitmap of players known to be in view
     mqueue_t *mqueueptr;            // Message queue for current client
     struct connection *prev;        // Previous client
     struct connection *next;        // Next client
+
+    // Reactor related part, touched only by the owning reactor thread
+    struct reactor *reactor;        // Reactor which owns the socket
+    uint8_t registered;             // Socket is being watched by the reactor
+    uint8_t want_write;             // Write readiness is requested
+    volatile uint8_t pending;       // Connection is in reactor pending list
+    struct connection *pending_next;// Next connection in pending list
+    struct connection *r_prev;      // Previous connection of the reactor
+    struct connection *r_next;      // Next connection of the reactor
+
+    uint8_t in_header[MSG_HEADER_SIZE]; // Partially read message header
+    msg_t in_msg;                   // Header of the message being read
+    char *in_payload;               // Payload of the message being read
+    size_t in_got;                  // Bytes of current message already read
+
+    uint8_t out_header[MSG_HEADER_SIZE]; // Encoded header of *out_mbuf*
+    mbuf_t out_mbuf;                // Message being written to the socket
+    size_t out_sent;                // Bytes of *out_mbuf* already written
+    uint8_t out_busy;               // *out_mbuf* is valid
 } connection_t;
 
 #endif /* CONNECTION_H */
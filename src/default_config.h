@@ -1,217 +1,257 @@
-#ifdef DEFAULT_CONFIG_H
-#error Private DEFAULT_CONFIG_H multiple inclusion!
-#endif /* DEFAULT_CONFIG_H */
-#define DEFAULT_CONFIG_H
-
-#include "config.h"
-
-/* 
+/*
  * Default values for ALL config options!
  * Needs to be updated to implement any new options
+ *
+ * C_*(handle, key, value): the option is found by *key* in config files and
+ * read by *handle* with CONF_*VAL() (see enum conf_handle). This list is
+ * included with C_* defined by the includer.
  */
-#define C_STR(key, val) { key, { { .__sval = val }, CONF_STRING } } 
-#define C_INT(key, val) { key, { { .__ival = val }, CONF_INT } } 
-#define C_CHR(key, val) { key, { { .__cval = val }, CONF_CHAR } } 
-struct t_conf_default {
-    char *key;
-    conf_t value;
-} t_conf_default[] = {
-    C_INT("level_width", 256),
-    C_INT("level_height", 64),
-
-    C_INT("win_stdscr_small_y", 0),
-    C_INT("win_stdscr_small_y_ispercent", 0),
-    C_INT("win_stdscr_small_x", 0),
-    C_INT("win_stdscr_small_x_ispercent", 0),
-    C_INT("win_stdscr_small_max_y", 0),
-    C_INT("win_stdscr_small_max_y_ispercent", 0),
-    C_INT("win_stdscr_small_max_x", 0),
-    C_INT("win_stdscr_small_max_x_ispercent", 0),
-    C_INT("win_stdscr_large_y", 0),
-    C_INT("win_stdscr_large_y_ispercent", 0),
-    C_INT("win_stdscr_large_x", 0),
-    C_INT("win_stdscr_large_x_ispercent", 0),
-    C_INT("win_stdscr_large_max_y", 0),
-    C_INT("win_stdscr_large_max_y_ispercent", 0),
-    C_INT("win_stdscr_large_max_x", 0),
-    C_INT("win_stdscr_large_max_x_ispercent", 0),
-    C_INT("win_stdscr_state", 2),
-
-    C_INT("win_area_small_y", 0),
-    C_INT("win_area_small_y_ispercent", 0),
-    C_INT("win_area_small_x", 0),
-    C_INT("win_area_small_x_ispercent", 0),
-    C_INT("win_area_small_max_y", 0),
-    C_INT("win_area_small_max_y_ispercent", 0),
-    C_INT("win_area_small_max_x", 0),
-    C_INT("win_area_small_max_x_ispercent", 0),
-    C_INT("win_area_large_y", 2),
-    C_INT("win_area_large_y_ispercent", 0),
-    C_INT("win_area_large_x", 0),
-    C_INT("win_area_large_x_ispercent", 0),
-    C_INT("win_area_large_max_y", -2),
-    C_INT("win_area_large_max_y_ispercent", 0),
-    C_INT("win_area_large_max_x", 0),
-    C_INT("win_area_large_max_x_ispercent", 0),
-    C_INT("win_area_state", 2),
-
-    C_INT("win_chat_small_y", 0),
-    C_INT("win_chat_small_y_ispercent", 0),
-    C_INT("win_chat_small_x", -30),
-    C_INT("win_chat_small_x_ispercent", 1),
-    C_INT("win_chat_small_max_y", 2),
-    C_INT("win_chat_small_max_y_ispercent", 0),
-    C_INT("win_chat_small_max_x", 30),
-    C_INT("win_chat_small_max_x_ispercent", 1),
-    C_INT("win_chat_large_y", 0),
-    C_INT("win_chat_large_y_ispercent", 0),
-    C_INT("win_chat_large_x", -30),
-    C_INT("win_chat_large_x_ispercent", 1),
-    C_INT("win_chat_large_max_y", 0),
-    C_INT("win_chat_large_max_y_ispercent", 0),
-    C_INT("win_chat_large_max_x", 30),
-    C_INT("win_chat_large_max_x_ispercent", 1),
-    C_INT("win_chat_state", 1),
-
-    C_INT("win_inventory_small_y", 0),
-    C_INT("win_inventory_small_y_ispercent", 0),
-    C_INT("win_inventory_small_x", 0),
-    C_INT("win_inventory_small_x_ispercent", 0),
-    C_INT("win_inventory_small_max_y", 0),
-    C_INT("win_inventory_small_max_y_ispercent", 0),
-    C_INT("win_inventory_small_max_x", 0),
-    C_INT("win_inventory_small_max_x_ispercent", 0),
-    C_INT("win_inventory_large_y", 0),
-    C_INT("win_inventory_large_y_ispercent", 0),
-    C_INT("win_inventory_large_x", 0),
-    C_INT("win_inventory_large_x_ispercent", 0),
-    C_INT("win_inventory_large_max_y", 0),
-    C_INT("win_inventory_large_max_y_ispercent", 0),
-    C_INT("win_inventory_large_max_x", 0),
-    C_INT("win_inventory_large_max_x_ispercent", 0),
-    C_INT("win_inventory_state", 0),
-
-    C_INT("win_map_small_y", 0),
-    C_INT("win_map_small_y_ispercent", 0),
-    C_INT("win_map_small_x", 0),
-    C_INT("win_map_small_x_ispercent", 0),
-    C_INT("win_map_small_max_y", 0),
-    C_INT("win_map_small_max_y_ispercent", 0),
-    C_INT("win_map_small_max_x", 0),
-    C_INT("win_map_small_max_x_ispercent", 0),
-    C_INT("win_map_large_y", 0),
-    C_INT("win_map_large_y_ispercent", 0),
-    C_INT("win_map_large_x", 0),
-    C_INT("win_map_large_x_ispercent", 0),
-    C_INT("win_map_large_max_y", 0),
-    C_INT("win_map_large_max_y_ispercent", 0),
-    C_INT("win_map_large_max_x", 0),
-    C_INT("win_map_large_max_x_ispercent", 0),
-    C_INT("win_map_state", 0),
-
-    C_INT("win_status_small_y", 23),
-    C_INT("win_status_small_y_ispercent", 0),
-    C_INT("win_status_small_x", 0),
-    C_INT("win_status_small_x_ispercent", 0),
-    C_INT("win_status_small_max_y", 2),
-    C_INT("win_status_small_max_y_ispercent", 0),
-    C_INT("win_status_small_max_x", 0),
-    C_INT("win_status_small_max_x_ispercent", 0),
-    C_INT("win_status_large_y", -2),
-    C_INT("win_status_large_y_ispercent", 0),
-    C_INT("win_status_large_x", 0),
-    C_INT("win_status_large_x_ispercent", 0),
-    C_INT("win_status_large_max_y", 2),
-    C_INT("win_status_large_max_y_ispercent", 0),
-    C_INT("win_status_large_max_x", 0),
-    C_INT("win_status_large_max_x_ispercent", 0),
-    C_INT("win_status_state", 2),
-
-    C_INT("win_sysmsg_small_y", 0),
-    C_INT("win_sysmsg_small_y_ispercent", 0),
-    C_INT("win_sysmsg_small_x", 0),
-    C_INT("win_sysmsg_small_x_ispercent", 0),
-    C_INT("win_sysmsg_small_max_y", 2),
-    C_INT("win_sysmsg_small_max_y_ispercent", 0),
-    C_INT("win_sysmsg_small_max_x", 70),
-    C_INT("win_sysmsg_small_max_x_ispercent", 1),
-    C_INT("win_sysmsg_large_y", 0),
-    C_INT("win_sysmsg_large_y_ispercent", 0),
-    C_INT("win_sysmsg_large_x", 0),
-    C_INT("win_sysmsg_large_x_ispercent", 0),
-    C_INT("win_sysmsg_large_max_y", 100),
-    C_INT("win_sysmsg_large_max_y_ispercent", 1),
-    C_INT("win_sysmsg_large_max_x", 70),
-    C_INT("win_sysmsg_large_max_x_ispercent", 1),
-    C_INT("win_sysmsg_state", 1),
-
-    C_INT("splash_time", 1000000),
-    C_INT("splash_delay", 3000),
+    C_INT(CF_LEVEL_WIDTH, "level_width", 256)
+    C_INT(CF_LEVEL_HEIGHT, "level_height", 64)
+    // 0 means random
+    C_INT(CF_LEVEL_SEED, "level_seed", 0)
+    // more mountains, less plains
+    C_INT(CF_LEVEL_RANGE, "level_range", 40)
+    C_INT(CF_LEVEL_STEP_MIN, "level_step_min", 15)
+    C_INT(CF_LEVEL_STEP_MAX, "level_step_max", 55)
+    C_INT(CF_LEVEL_CASTLES, "level_castles", 1)
+    // KiB of chunks kept in memory
+    C_INT(CF_LEVEL_MEMORY, "level_memory", 16384)
+    // chunks sent until view is known
+    C_INT(CF_LEVEL_VIEW_CHUNKS, "level_view_chunks", 2)
+    // cells sent around the view
+    C_INT(CF_LEVEL_VIEW_MARGIN, "level_view_margin", 16)
+
+    C_INT(CF_SERVER_WORKERS, "server_workers", 1)
+    C_INT(CF_SERVER_MQUEUE_SIZE, "server_mqueue_size", 1024)
+    // see enum ev_mode
+    C_INT(CF_SERVER_TICK_MODE, "server_tick_mode", 0)
+    // ticks per second in real-time mode
+    C_INT(CF_SERVER_TICK_RATE, "server_tick_rate", 20)
+    // milliseconds in turn-based mode
+    C_INT(CF_SERVER_TURN_TIME, "server_turn_time", 4000)
+    // bytes of the biggest message payload a client may send
+    C_INT(CF_SERVER_MSG_MAXSIZE, "server_msg_maxsize", 65536)
+
+    C_INT(CF_WIN_STDSCR_SMALL_Y, "win_stdscr_small_y", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_Y_ISPERCENT, "win_stdscr_small_y_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_X, "win_stdscr_small_x", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_X_ISPERCENT, "win_stdscr_small_x_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_MAX_Y, "win_stdscr_small_max_y", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_MAX_Y_ISPERCENT,
+            "win_stdscr_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_MAX_X, "win_stdscr_small_max_x", 0)
+    C_INT(CF_WIN_STDSCR_SMALL_MAX_X_ISPERCENT,
+            "win_stdscr_small_max_x_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_Y, "win_stdscr_large_y", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_Y_ISPERCENT, "win_stdscr_large_y_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_X, "win_stdscr_large_x", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_X_ISPERCENT, "win_stdscr_large_x_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_MAX_Y, "win_stdscr_large_max_y", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_MAX_Y_ISPERCENT,
+            "win_stdscr_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_MAX_X, "win_stdscr_large_max_x", 0)
+    C_INT(CF_WIN_STDSCR_LARGE_MAX_X_ISPERCENT,
+            "win_stdscr_large_max_x_ispercent", 0)
+    C_INT(CF_WIN_STDSCR_STATE, "win_stdscr_state", 2)
+
+    C_INT(CF_WIN_AREA_SMALL_Y, "win_area_small_y", 0)
+    C_INT(CF_WIN_AREA_SMALL_Y_ISPERCENT, "win_area_small_y_ispercent", 0)
+    C_INT(CF_WIN_AREA_SMALL_X, "win_area_small_x", 0)
+    C_INT(CF_WIN_AREA_SMALL_X_ISPERCENT, "win_area_small_x_ispercent", 0)
+    C_INT(CF_WIN_AREA_SMALL_MAX_Y, "win_area_small_max_y", 0)
+    C_INT(CF_WIN_AREA_SMALL_MAX_Y_ISPERCENT,
+            "win_area_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_AREA_SMALL_MAX_X, "win_area_small_max_x", 0)
+    C_INT(CF_WIN_AREA_SMALL_MAX_X_ISPERCENT,
+            "win_area_small_max_x_ispercent", 0)
+    C_INT(CF_WIN_AREA_LARGE_Y, "win_area_large_y", 2)
+    C_INT(CF_WIN_AREA_LARGE_Y_ISPERCENT, "win_area_large_y_ispercent", 0)
+    C_INT(CF_WIN_AREA_LARGE_X, "win_area_large_x", 0)
+    C_INT(CF_WIN_AREA_LARGE_X_ISPERCENT, "win_area_large_x_ispercent", 0)
+    C_INT(CF_WIN_AREA_LARGE_MAX_Y, "win_area_large_max_y", -2)
+    C_INT(CF_WIN_AREA_LARGE_MAX_Y_ISPERCENT,
+            "win_area_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_AREA_LARGE_MAX_X, "win_area_large_max_x", 0)
+    C_INT(CF_WIN_AREA_LARGE_MAX_X_ISPERCENT,
+            "win_area_large_max_x_ispercent", 0)
+    C_INT(CF_WIN_AREA_STATE, "win_area_state", 2)
+
+    C_INT(CF_WIN_CHAT_SMALL_Y, "win_chat_small_y", 0)
+    C_INT(CF_WIN_CHAT_SMALL_Y_ISPERCENT, "win_chat_small_y_ispercent", 0)
+    C_INT(CF_WIN_CHAT_SMALL_X, "win_chat_small_x", -30)
+    C_INT(CF_WIN_CHAT_SMALL_X_ISPERCENT, "win_chat_small_x_ispercent", 1)
+    C_INT(CF_WIN_CHAT_SMALL_MAX_Y, "win_chat_small_max_y", 2)
+    C_INT(CF_WIN_CHAT_SMALL_MAX_Y_ISPERCENT,
+            "win_chat_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_CHAT_SMALL_MAX_X, "win_chat_small_max_x", 30)
+    C_INT(CF_WIN_CHAT_SMALL_MAX_X_ISPERCENT,
+            "win_chat_small_max_x_ispercent", 1)
+    C_INT(CF_WIN_CHAT_LARGE_Y, "win_chat_large_y", 0)
+    C_INT(CF_WIN_CHAT_LARGE_Y_ISPERCENT, "win_chat_large_y_ispercent", 0)
+    C_INT(CF_WIN_CHAT_LARGE_X, "win_chat_large_x", -30)
+    C_INT(CF_WIN_CHAT_LARGE_X_ISPERCENT, "win_chat_large_x_ispercent", 1)
+    C_INT(CF_WIN_CHAT_LARGE_MAX_Y, "win_chat_large_max_y", 0)
+    C_INT(CF_WIN_CHAT_LARGE_MAX_Y_ISPERCENT,
+            "win_chat_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_CHAT_LARGE_MAX_X, "win_chat_large_max_x", 30)
+    C_INT(CF_WIN_CHAT_LARGE_MAX_X_ISPERCENT,
+            "win_chat_large_max_x_ispercent", 1)
+    C_INT(CF_WIN_CHAT_STATE, "win_chat_state", 1)
+
+    C_INT(CF_WIN_INVENTORY_SMALL_Y, "win_inventory_small_y", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_Y_ISPERCENT,
+            "win_inventory_small_y_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_X, "win_inventory_small_x", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_X_ISPERCENT,
+            "win_inventory_small_x_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_MAX_Y, "win_inventory_small_max_y", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_MAX_Y_ISPERCENT,
+            "win_inventory_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_MAX_X, "win_inventory_small_max_x", 0)
+    C_INT(CF_WIN_INVENTORY_SMALL_MAX_X_ISPERCENT,
+            "win_inventory_small_max_x_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_Y, "win_inventory_large_y", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_Y_ISPERCENT,
+            "win_inventory_large_y_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_X, "win_inventory_large_x", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_X_ISPERCENT,
+            "win_inventory_large_x_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_MAX_Y, "win_inventory_large_max_y", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_MAX_Y_ISPERCENT,
+            "win_inventory_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_MAX_X, "win_inventory_large_max_x", 0)
+    C_INT(CF_WIN_INVENTORY_LARGE_MAX_X_ISPERCENT,
+            "win_inventory_large_max_x_ispercent", 0)
+    C_INT(CF_WIN_INVENTORY_STATE, "win_inventory_state", 0)
+
+    C_INT(CF_WIN_MAP_SMALL_Y, "win_map_small_y", 0)
+    C_INT(CF_WIN_MAP_SMALL_Y_ISPERCENT, "win_map_small_y_ispercent", 0)
+    C_INT(CF_WIN_MAP_SMALL_X, "win_map_small_x", 0)
+    C_INT(CF_WIN_MAP_SMALL_X_ISPERCENT, "win_map_small_x_ispercent", 0)
+    C_INT(CF_WIN_MAP_SMALL_MAX_Y, "win_map_small_max_y", 0)
+    C_INT(CF_WIN_MAP_SMALL_MAX_Y_ISPERCENT, "win_map_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_MAP_SMALL_MAX_X, "win_map_small_max_x", 0)
+    C_INT(CF_WIN_MAP_SMALL_MAX_X_ISPERCENT, "win_map_small_max_x_ispercent", 0)
+    C_INT(CF_WIN_MAP_LARGE_Y, "win_map_large_y", 0)
+    C_INT(CF_WIN_MAP_LARGE_Y_ISPERCENT, "win_map_large_y_ispercent", 0)
+    C_INT(CF_WIN_MAP_LARGE_X, "win_map_large_x", 0)
+    C_INT(CF_WIN_MAP_LARGE_X_ISPERCENT, "win_map_large_x_ispercent", 0)
+    C_INT(CF_WIN_MAP_LARGE_MAX_Y, "win_map_large_max_y", 0)
+    C_INT(CF_WIN_MAP_LARGE_MAX_Y_ISPERCENT, "win_map_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_MAP_LARGE_MAX_X, "win_map_large_max_x", 0)
+    C_INT(CF_WIN_MAP_LARGE_MAX_X_ISPERCENT, "win_map_large_max_x_ispercent", 0)
+    C_INT(CF_WIN_MAP_STATE, "win_map_state", 0)
+
+    C_INT(CF_WIN_STATUS_SMALL_Y, "win_status_small_y", 23)
+    C_INT(CF_WIN_STATUS_SMALL_Y_ISPERCENT, "win_status_small_y_ispercent", 0)
+    C_INT(CF_WIN_STATUS_SMALL_X, "win_status_small_x", 0)
+    C_INT(CF_WIN_STATUS_SMALL_X_ISPERCENT, "win_status_small_x_ispercent", 0)
+    C_INT(CF_WIN_STATUS_SMALL_MAX_Y, "win_status_small_max_y", 2)
+    C_INT(CF_WIN_STATUS_SMALL_MAX_Y_ISPERCENT,
+            "win_status_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_STATUS_SMALL_MAX_X, "win_status_small_max_x", 0)
+    C_INT(CF_WIN_STATUS_SMALL_MAX_X_ISPERCENT,
+            "win_status_small_max_x_ispercent", 0)
+    C_INT(CF_WIN_STATUS_LARGE_Y, "win_status_large_y", -2)
+    C_INT(CF_WIN_STATUS_LARGE_Y_ISPERCENT, "win_status_large_y_ispercent", 0)
+    C_INT(CF_WIN_STATUS_LARGE_X, "win_status_large_x", 0)
+    C_INT(CF_WIN_STATUS_LARGE_X_ISPERCENT, "win_status_large_x_ispercent", 0)
+    C_INT(CF_WIN_STATUS_LARGE_MAX_Y, "win_status_large_max_y", 2)
+    C_INT(CF_WIN_STATUS_LARGE_MAX_Y_ISPERCENT,
+            "win_status_large_max_y_ispercent", 0)
+    C_INT(CF_WIN_STATUS_LARGE_MAX_X, "win_status_large_max_x", 0)
+    C_INT(CF_WIN_STATUS_LARGE_MAX_X_ISPERCENT,
+            "win_status_large_max_x_ispercent", 0)
+    C_INT(CF_WIN_STATUS_STATE, "win_status_state", 2)
+
+    C_INT(CF_WIN_SYSMSG_SMALL_Y, "win_sysmsg_small_y", 0)
+    C_INT(CF_WIN_SYSMSG_SMALL_Y_ISPERCENT, "win_sysmsg_small_y_ispercent", 0)
+    C_INT(CF_WIN_SYSMSG_SMALL_X, "win_sysmsg_small_x", 0)
+    C_INT(CF_WIN_SYSMSG_SMALL_X_ISPERCENT, "win_sysmsg_small_x_ispercent", 0)
+    C_INT(CF_WIN_SYSMSG_SMALL_MAX_Y, "win_sysmsg_small_max_y", 2)
+    C_INT(CF_WIN_SYSMSG_SMALL_MAX_Y_ISPERCENT,
+            "win_sysmsg_small_max_y_ispercent", 0)
+    C_INT(CF_WIN_SYSMSG_SMALL_MAX_X, "win_sysmsg_small_max_x", 70)
+    C_INT(CF_WIN_SYSMSG_SMALL_MAX_X_ISPERCENT,
+            "win_sysmsg_small_max_x_ispercent", 1)
+    C_INT(CF_WIN_SYSMSG_LARGE_Y, "win_sysmsg_large_y", 0)
+    C_INT(CF_WIN_SYSMSG_LARGE_Y_ISPERCENT, "win_sysmsg_large_y_ispercent", 0)
+    C_INT(CF_WIN_SYSMSG_LARGE_X, "win_sysmsg_large_x", 0)
+    C_INT(CF_WIN_SYSMSG_LARGE_X_ISPERCENT, "win_sysmsg_large_x_ispercent", 0)
+    C_INT(CF_WIN_SYSMSG_LARGE_MAX_Y, "win_sysmsg_large_max_y", 100)
+    C_INT(CF_WIN_SYSMSG_LARGE_MAX_Y_ISPERCENT,
+            "win_sysmsg_large_max_y_ispercent", 1)
+    C_INT(CF_WIN_SYSMSG_LARGE_MAX_X, "win_sysmsg_large_max_x", 70)
+    C_INT(CF_WIN_SYSMSG_LARGE_MAX_X_ISPERCENT,
+            "win_sysmsg_large_max_x_ispercent", 1)
+    C_INT(CF_WIN_SYSMSG_STATE, "win_sysmsg_state", 1)
+
+    C_INT(CF_SPLASH_TIME, "splash_time", 1000000)
+    C_INT(CF_SPLASH_DELAY, "splash_delay", 3000)
 
     // TODO: multi-byte keycodes
-    C_CHR("key_exit", 'q'),
-    C_CHR("key_window_exit", '\t'),
-    C_CHR("key_clear_screen", 0x0C),
-    C_CHR("key_backspace", 0x7F),
-
-    C_CHR("key_move_left", '4'),
-    C_CHR("key_move_right", '6'),
-    C_CHR("key_move_up", '8'),
-    C_CHR("key_move_down", '2'),
-    C_CHR("key_move_left_up", '7'),
-    C_CHR("key_move_right_up", '9'),
-    C_CHR("key_move_left_down", '1'),
-    C_CHR("key_move_right_down", '3'),
-
-    C_CHR("key_scroll_up", '/'),
-    C_CHR("key_scroll_down", '*'),
-    C_CHR("key_menu_large", 'm'),
-    C_CHR("key_inventory_large", 'i'),
-    C_CHR("key_chat_large", 'c'),
-    C_CHR("key_sysmsg_large", 'P'),
-
-    C_CHR("key_chat_send", '\n'),
-
-    C_CHR("key_zero", '0'),
-    C_CHR("key_one", '1'),
-    C_CHR("key_two", '2'),
-    C_CHR("key_three", '3'),
-    C_CHR("key_four", '4'),
-    C_CHR("key_five", '5'),
-    C_CHR("key_six", '6'),
-    C_CHR("key_seven", '7'),
-    C_CHR("key_eight", '8'),
-    C_CHR("key_nine", '9'),
-
-    C_CHR("stuff_none", ' '),
-    C_CHR("stuff_floor", '.'),
-    C_CHR("stuff_wall", '#'),
-    C_CHR("stuff_door", '+'),
-    C_CHR("stuff_tree", '^'),
-    C_CHR("stuff_grass", '.'),
-    C_CHR("stuff_player", '@'),
-    C_CHR("stuff_downstairs", '>'),
-    C_CHR("stuff_upstairs", '<'),
-
-    C_CHR("stuff_trap", '^'),
-    C_CHR("stuff_food", ':'),
-
-    C_CHR("stuff_gold", '$'),
-    C_CHR("stuff_scroll", '?'),
-    C_CHR("stuff_book", '?'),
-
-    C_CHR("stuff_ring", '='),
-    C_CHR("stuff_wand", '/'),
-
-    C_STR("player_nickname", ""),
-    C_INT("player_color", 10),
-    C_INT("player_camera", 1),
-    C_STR("file_locale", ""),
-    C_STR("file_server_log", "itmmorgue.log")
-};
-#undef C_STR
-#undef C_INT
-#undef C_CHR
-
-size_t t_conf_default_size = sizeof(t_conf_default)
-    / sizeof(struct t_conf_default);
+    C_CHR(CF_KEY_EXIT, "key_exit", 'q')
+    C_CHR(CF_KEY_WINDOW_EXIT, "key_window_exit", '\t')
+    C_CHR(CF_KEY_CLEAR_SCREEN, "key_clear_screen", 0x0C)
+    C_CHR(CF_KEY_BACKSPACE, "key_backspace", 0x7F)
+
+    C_CHR(CF_KEY_MOVE_LEFT, "key_move_left", '4')
+    C_CHR(CF_KEY_MOVE_RIGHT, "key_move_right", '6')
+    C_CHR(CF_KEY_MOVE_UP, "key_move_up", '8')
+    C_CHR(CF_KEY_MOVE_DOWN, "key_move_down", '2')
+    C_CHR(CF_KEY_MOVE_LEFT_UP, "key_move_left_up", '7')
+    C_CHR(CF_KEY_MOVE_RIGHT_UP, "key_move_right_up", '9')
+    C_CHR(CF_KEY_MOVE_LEFT_DOWN, "key_move_left_down", '1')
+    C_CHR(CF_KEY_MOVE_RIGHT_DOWN, "key_move_right_down", '3')
+    C_CHR(CF_KEY_MOVE_CANCEL, "key_move_cancel", 'x')
+
+    C_CHR(CF_KEY_SCROLL_UP, "key_scroll_up", '/')
+    C_CHR(CF_KEY_SCROLL_DOWN, "key_scroll_down", '*')
+    C_CHR(CF_KEY_MENU_LARGE, "key_menu_large", 'm')
+    C_CHR(CF_KEY_INVENTORY_LARGE, "key_inventory_large", 'i')
+    C_CHR(CF_KEY_CHAT_LARGE, "key_chat_large", 'c')
+    C_CHR(CF_KEY_SYSMSG_LARGE, "key_sysmsg_large", 'P')
+
+    C_CHR(CF_KEY_CHAT_SEND, "key_chat_send", '\n')
+
+    C_CHR(CF_KEY_ZERO, "key_zero", '0')
+    C_CHR(CF_KEY_ONE, "key_one", '1')
+    C_CHR(CF_KEY_TWO, "key_two", '2')
+    C_CHR(CF_KEY_THREE, "key_three", '3')
+    C_CHR(CF_KEY_FOUR, "key_four", '4')
+    C_CHR(CF_KEY_FIVE, "key_five", '5')
+    C_CHR(CF_KEY_SIX, "key_six", '6')
+    C_CHR(CF_KEY_SEVEN, "key_seven", '7')
+    C_CHR(CF_KEY_EIGHT, "key_eight", '8')
+    C_CHR(CF_KEY_NINE, "key_nine", '9')
+
+    C_CHR(CF_STUFF_NONE, "stuff_none", ' ')
+    C_CHR(CF_STUFF_FLOOR, "stuff_floor", '.')
+    C_CHR(CF_STUFF_WALL, "stuff_wall", '#')
+    C_CHR(CF_STUFF_DOOR, "stuff_door", '+')
+    C_CHR(CF_STUFF_TREE, "stuff_tree", '^')
+    C_CHR(CF_STUFF_GRASS, "stuff_grass", '.')
+    C_CHR(CF_STUFF_PLAYER, "stuff_player", '@')
+    C_CHR(CF_STUFF_DOWNSTAIRS, "stuff_downstairs", '>')
+    C_CHR(CF_STUFF_UPSTAIRS, "stuff_upstairs", '<')
+
+    C_CHR(CF_STUFF_TRAP, "stuff_trap", '^')
+    C_CHR(CF_STUFF_FOOD, "stuff_food", ':')
+
+    C_CHR(CF_STUFF_GOLD, "stuff_gold", '$')
+    C_CHR(CF_STUFF_SCROLL, "stuff_scroll", '?')
+    C_CHR(CF_STUFF_BOOK, "stuff_book", '?')
+
+    C_CHR(CF_STUFF_RING, "stuff_ring", '=')
+    C_CHR(CF_STUFF_WAND, "stuff_wand", '/')
+
+    C_STR(CF_PLAYER_NICKNAME, "player_nickname", "")
+    C_INT(CF_PLAYER_COLOR, "player_color", 10)
+    C_INT(CF_PLAYER_CAMERA, "player_camera", 1)
+    C_STR(CF_FILE_LOCALE, "file_locale", "")
+    // compiled file_locale, empty to compile it on every start
+    C_STR(CF_FILE_LOCALE_CACHE, "file_locale_cache", "")
+    C_STR(CF_FILE_SERVER_LOG, "file_server_log", "itmmorgue.log")
+    // empty to disable saving
+    C_STR(CF_FILE_WORLD, "file_world", "itmmorgue.world")
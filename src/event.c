@@ -4,6 +4,30 @@
 // Thread object for event_loop
 pthread_t ev_thread;
 
+/*
+ * Number of players with queued actions, event loop sleeps on ev_cond for
+ * it. Changed under the player's queue mutex, so ev_mutex is always taken
+ * after it.
+ */
+static pthread_mutex_t ev_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ev_cond;
+static size_t ev_ready = 0;
+// Somebody waits for the area sync, see event_sync()
+static int ev_sync = 0;
+
+// Scheduler settings, see event_init()
+static enum ev_mode ev_mode;
+static uint64_t ev_period_ns;       // real-time tick
+static uint64_t ev_turn_ns;         // turn time limit
+
+// Timing statistics, see event_stats()
+static pthread_mutex_t ev_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ev_stats_t ev_stats;
+static uint64_t ev_stats_logged;    // time of the last stats log line
+
+// Statistics are logged once in this period
+#define EV_STATS_PERIOD 60000000000ULL
+
 // File-only defines for event queue access
 #define P_EV_QUEUE (players[player_id].ev_queue)
 #define P_EV_LOCK do {                                              \
@@ -17,46 +41,91 @@ pthread_t ev_thread;
 } while(0)
 #define P_EV_UNLOCK pthread_mutex_unlock(&P_EV_QUEUE.event_mutex)
 
-// Add an event for specified player
-void event_player_add(size_t player_id, event_t event, player_move_t *move) {
+#define P_EV_READY(delta) do {                                      \
+    pthread_mutex_lock(&ev_mutex);                                  \
+    ev_ready += (delta);                                            \
+    pthread_cond_signal(&ev_cond);                                  \
+    pthread_mutex_unlock(&ev_mutex);                                \
+} while(0)
+
+/*
+ * Queues an action of the player and wakes the event loop up.
+ *
+ * ret : 0 on success, -1 if the queue is full
+ */
+int event_player_add(size_t player_id, event_t event,
+        enum keyboard direction) {
     P_EV_LOCK;
 
-    if (P_EV_QUEUE.event_args) {
-        free(P_EV_QUEUE.event_args);
+    if (P_EV_QUEUE.len == EV_QUEUE_SIZE) {
+        P_EV_UNLOCK;
+        return -1;
+    }
+
+    event_action_t *action = P_EV_QUEUE.actions +
+        (P_EV_QUEUE.head + P_EV_QUEUE.len) % EV_QUEUE_SIZE;
+    action->event = event;
+    action->time = sysutime();
+    action->args.direction = direction;
+
+    if (P_EV_QUEUE.len++ == 0) {
+        P_EV_READY(1);
     }
-    P_EV_QUEUE.event = event;
-    P_EV_QUEUE.event_args = (void *)move;
 
     P_EV_UNLOCK;
+
+    return 0;
 }
 
-// Check if all players have made their events
-int ev_players_ready() {
-    for (size_t player_id = 0; player_id < players_len; player_id++) {
-        P_EV_LOCK;
-        if (P_EV_QUEUE.event == EV_NONE) {
-            P_EV_UNLOCK;
-            return 0;
-        }
-        P_EV_UNLOCK;
+/*
+ * Drops pending actions of the player.
+ *
+ * ret : number of dropped actions
+ */
+size_t event_player_cancel(size_t player_id) {
+    size_t len;
+
+    P_EV_LOCK;
+
+    len = P_EV_QUEUE.len;
+    if (len > 0) {
+        P_EV_QUEUE.len = 0;
+        P_EV_READY(-1);
     }
 
-    return 1;
+    P_EV_UNLOCK;
+
+    return len;
 }
 
-// Get number of ready players
-int ev_count_players() {
-    int rc = 0;
+/*
+ * Asks the event loop for the area sync (see s_sync_players()) without
+ * waiting for a turn. Real-time ticks sync anyway.
+ */
+void event_sync() {
+    if (ev_mode == EV_MODE_REALTIME) {
+        return;
+    }
 
-    for (size_t player_id = 0; player_id < players_len; player_id++) {
-        P_EV_LOCK;
-        if (P_EV_QUEUE.event != EV_NONE) {
-            rc++;
-        }
-        P_EV_UNLOCK;
+    pthread_mutex_lock(&ev_mutex);
+    ev_sync = 1;
+    pthread_cond_signal(&ev_cond);
+    pthread_mutex_unlock(&ev_mutex);
+}
+
+static uint64_t ev_now() {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        panic("[S] Unable to get monotonic time!");
     }
 
-    return rc;
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ev_timespec(uint64_t ns, struct timespec *ts) {
+    ts->tv_sec = ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
 }
 
 /* 
@@ -69,65 +138,252 @@ int ev_count_players() {
  * 5. Calculate new NPC actions and apply them
  * 6. Calculate new game state
  * 7. Send new state to the players
+ *
+ * Steps after the collection are the phases of a tick.
  */
 
-// Main event loop
-static inline void event_loop() {
-    // Do nothing before game start
-    if (! start && usleep(100000) == 0) {
-        return;
-    }
-
-    // 1. Collect all players events
+// State of the current tick shared by its phases
+typedef struct ev_tick {
+    size_t applied;             // player events applied
+} ev_tick_t;
 
-    // Wait for the first player event
-    for (; ev_count_players() == 0; usleep(10000));
+// 4. Apply player events, the oldest one of everybody
+static void ev_phase_players(ev_tick_t *tick) {
+    for (size_t player_id = 0; player_id < players_len; player_id++) {
+        P_EV_LOCK;
 
-    // Wait for the others player event
-    for (uint32_t uticks = 0; ! ev_players_ready() && uticks < EV_TURN;
-            uticks += EV_STEP) {
-        usleep(EV_STEP);
-    }
+        if (P_EV_QUEUE.len == 0) {
+            P_EV_UNLOCK;
+            continue;
+        }
 
-    // Skip this turn if there are no any players events
-    if (! ev_count_players()) {
-        return;
-    }
+        event_action_t *action = P_EV_QUEUE.actions + P_EV_QUEUE.head;
+        player_move_t move;
 
-    // 4. Apply player events
-    for (size_t player_id = 0; player_id < players_len; player_id++) {
-        P_EV_LOCK;
-        switch(P_EV_QUEUE.event) {
-            case EV_NONE:
+        switch(action->event) {
+            case EV_WAIT:
                 break;
             case EV_MOVE:
-                player_move((player_move_t *)P_EV_QUEUE.event_args);
+                move.player_id = player_id;
+                move.direction = action->args.direction;
+                player_move(&move);
                 break;
             default:
                 panic("[S] Illegal player event!");
         }
 
-        // Cleanup the event
-        P_EV_QUEUE.event = EV_NONE;
-        if (P_EV_QUEUE.event_args) {
-            free(P_EV_QUEUE.event_args);
-            P_EV_QUEUE.event_args = NULL;
+        P_EV_QUEUE.head = (P_EV_QUEUE.head + 1) % EV_QUEUE_SIZE;
+        if (--P_EV_QUEUE.len == 0) {
+            P_EV_READY(-1);
         }
+
         P_EV_UNLOCK;
+        tick->applied++;
+    }
+}
+
+// 7. Send new state to the players
+static void ev_phase_state(ev_tick_t *tick) {
+    if (tick->applied == 0) {
+        return;
+    }
+
+    s_broadcast_players();
+}
+
+// 7. Send area changes, the world to the newcomers
+static void ev_phase_area(ev_tick_t *tick) {
+    (void)tick;
+
+    s_sync_players();
+}
+
+static struct {
+    const char *name;
+    void (*run)(ev_tick_t *tick);
+} ev_phases[EV_PHASE_SIZE] = {
+    [EV_PHASE_PLAYERS] = { "players", &ev_phase_players },
+    [EV_PHASE_STATE]   = { "state",   &ev_phase_state },
+    [EV_PHASE_AREA]    = { "area",    &ev_phase_area },
+};
+
+/*
+ * Runs all the phases of a tick and updates statistics.
+ *
+ * overrun : the tick has started after its deadline
+ */
+static void ev_tick(int overrun) {
+    ev_tick_t tick;
+    uint64_t phase_ns[EV_PHASE_SIZE];
+    uint64_t begin = ev_now(), prev = begin;
+
+    memset(&tick, '\0', sizeof(ev_tick_t));
+    for (size_t i = 0; i < EV_PHASE_SIZE; i++) {
+        ev_phases[i].run(&tick);
+
+        uint64_t now = ev_now();
+        phase_ns[i] = now - prev;
+        prev = now;
+    }
+
+    pthread_mutex_lock(&ev_stats_mutex);
+    ev_stats.ticks++;
+    ev_stats.overruns += overrun;
+    ev_stats.last_ns = prev - begin;
+    ev_stats.total_ns += ev_stats.last_ns;
+    if (ev_stats.last_ns > ev_stats.max_ns) {
+        ev_stats.max_ns = ev_stats.last_ns;
+    }
+    for (size_t i = 0; i < EV_PHASE_SIZE; i++) {
+        if (phase_ns[i] > ev_stats.phase_ns[i]) {
+            ev_stats.phase_ns[i] = phase_ns[i];
+        }
+        if (ev_stats.phase_ns[i] > ev_stats.phase_ns[ev_stats.slowest]) {
+            ev_stats.slowest = i;
+        }
     }
 
-    // 7. Send new state to the players
-    for (size_t id = 0; id < players_len; id++) {
-        s_send_players_full(players + id);
+    if (prev - ev_stats_logged >= EV_STATS_PERIOD) {
+        ev_stats_logged = prev;
+        loggerf("[S] Ticks: %llu, avg %llu us, max %llu us, overruns %llu, "
+                "slowest phase %s: %llu us",
+                (unsigned long long)ev_stats.ticks,
+                (unsigned long long)(ev_stats.total_ns / ev_stats.ticks / 1000),
+                (unsigned long long)(ev_stats.max_ns / 1000),
+                (unsigned long long)ev_stats.overruns,
+                ev_phases[ev_stats.slowest].name,
+                (unsigned long long)(ev_stats.phase_ns[ev_stats.slowest] /
+                    1000));
+    }
+    pthread_mutex_unlock(&ev_stats_mutex);
+}
+
+/*
+ * Runs the area sync requested between the turns, see event_sync(). Called
+ * with ev_mutex held, which is released for the sync.
+ */
+static void ev_loop_sync() {
+    ev_tick_t tick;
+
+    ev_sync = 0;
+    pthread_mutex_unlock(&ev_mutex);
+
+    memset(&tick, '\0', sizeof(ev_tick_t));
+    ev_phases[EV_PHASE_AREA].run(&tick);
+
+    pthread_mutex_lock(&ev_mutex);
+}
+
+/*
+ * Turn-based mode: a tick happens when everybody has acted or when the
+ * turn time is over, but not before somebody has acted.
+ */
+static void ev_loop_turn() {
+    struct timespec deadline;
+
+    for (;;) {
+        // 1. Collect all players events
+
+        // Wait for the first player event, players act only after game start
+        pthread_mutex_lock(&ev_mutex);
+        while (ev_ready == 0) {
+            if (ev_sync) {
+                ev_loop_sync();
+                continue;
+            }
+            pthread_cond_wait(&ev_cond, &ev_mutex);
+        }
+
+        // Wait for the others player event, those who have fallen out of
+        // the world don't act (see player_disconnect())
+        ev_timespec(ev_now() + ev_turn_ns, &deadline);
+        while (ev_ready < __atomic_load_n(&players_total, __ATOMIC_ACQUIRE)) {
+            if (ev_sync) {
+                ev_loop_sync();
+                continue;
+            }
+            if (pthread_cond_timedwait(&ev_cond, &ev_mutex, &deadline) ==
+                    ETIMEDOUT) {
+                break;
+            }
+        }
+        // The tick syncs the area too
+        ev_sync = 0;
+        pthread_mutex_unlock(&ev_mutex);
+
+        ev_tick(0);
+    }
+}
+
+/*
+ * Real-time mode: ticks happen at fixed rate, players act when they want.
+ * Deadlines are absolute, so sleeping errors don't add up. Ticks which are
+ * late for more than a period are skipped.
+ */
+static void ev_loop_realtime() {
+    struct timespec ts;
+    uint64_t deadline = ev_now();
+
+    for (;;) {
+        deadline += ev_period_ns;
+        ev_timespec(deadline, &ts);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                    NULL) == EINTR);
+
+        uint64_t now = ev_now();
+        int overrun = now >= deadline + ev_period_ns;
+        if (overrun) {
+            deadline = now - (now - deadline) % ev_period_ns;
+        }
+
+        ev_tick(overrun);
     }
 }
 
 void* event_thread(void *args) {
-    for((void)args;;event_loop());
+    (void)args;
+
+    if (ev_mode == EV_MODE_REALTIME) {
+        ev_loop_realtime();
+    } else {
+        ev_loop_turn();
+    }
+
+    return NULL;
+}
+
+/*
+ * Copies tick timing statistics.
+ */
+void event_stats(ev_stats_t *stats) {
+    pthread_mutex_lock(&ev_stats_mutex);
+    memcpy(stats, &ev_stats, sizeof(ev_stats_t));
+    pthread_mutex_unlock(&ev_stats_mutex);
 }
 
 // Create thread for event_loop
 void event_init() {
+    pthread_condattr_t attr;
+    int rate = CONF_IVAL(CF_SERVER_TICK_RATE);
+
+    ev_mode = CONF_IVAL(CF_SERVER_TICK_MODE);
+    if (ev_mode >= EV_MODE_SIZE) {
+        panicf("Invalid server_tick_mode: %d", ev_mode);
+    }
+    if (rate <= 0) {
+        panicf("Invalid server_tick_rate: %d", rate);
+    }
+    ev_period_ns = 1000000000 / rate;
+    ev_turn_ns = (uint64_t)CONF_IVAL(CF_SERVER_TURN_TIME) * 1000000;
+    ev_stats_logged = ev_now();
+
+    if (pthread_condattr_init(&attr) != 0 ||
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+            pthread_cond_init(&ev_cond, &attr) != 0) {
+        panic("Error initializing event loop condition!");
+    }
+    pthread_condattr_destroy(&attr);
+
     if (pthread_create(&ev_thread, NULL, &event_thread, NULL) != 0) {
         panic("Error creating even_loop thread!");
     }
@@ -136,3 +392,4 @@ void event_init() {
 #undef P_EV_QUEUE
 #undef P_EV_LOCK
 #undef P_EV_UNLOCK
+#undef P_EV_READY
@@ -4,10 +4,8 @@
 
 #include "itmmorgue.h"
 
-// Player's turn time in microseconds
-#define EV_TURN 4000000
-// Player's events check period in microseconds
-#define EV_STEP 10000
+// Player's actions buffered ahead, one of them is applied per turn
+#define EV_QUEUE_SIZE 16
 
 // So shity C language
 struct player_move;
@@ -19,14 +17,57 @@ typedef enum event {
     EV_SIZE
 } event_t;
 
-typedef struct event_queue_1 {
-    event_t event;  // Only one event
-    void * event_args;
+typedef struct event_action {
+    event_t event;
+    unsigned long long time;    // when the action was received, sysutime()
+    union {
+        enum keyboard direction;    // EV_MOVE
+    } args;
+} event_action_t;
+
+/*
+ * Bounded FIFO of player's actions.
+ */
+typedef struct event_queue {
+    event_action_t actions[EV_QUEUE_SIZE];
+    uint8_t head;               // index of the oldest action
+    uint8_t len;                // number of queued actions
     pthread_mutex_t event_mutex;
 } event_queue_t;
 
-void event_player_add(size_t player_id, event_t event,
-        struct player_move *move);
+// How the game advances, see server_tick_mode
+enum ev_mode {
+    EV_MODE_TURN,       // when everybody acted or the turn time expired
+    EV_MODE_REALTIME,   // server_tick_rate times a second
+    EV_MODE_SIZE
+};
+
+/*
+ * Steps of a tick, timed separately. To add a step, put its name into this
+ * enum and its function into ev_phases[] in event.c.
+ */
+enum ev_phase {
+    EV_PHASE_PLAYERS,   // apply player events
+    EV_PHASE_STATE,     // send new state to the players
+    EV_PHASE_AREA,      // send area changes and the world to the newcomers
+    EV_PHASE_SIZE
+};
+
+typedef struct ev_stats {
+    uint64_t ticks;                 // ticks done
+    uint64_t overruns;              // real-time ticks missed their deadline
+    uint64_t last_ns;               // duration of the last tick
+    uint64_t max_ns;                // the longest tick
+    uint64_t total_ns;              // all ticks together
+    uint64_t phase_ns[EV_PHASE_SIZE];   // the longest run of every phase
+    enum ev_phase slowest;          // phase with the longest run
+} ev_stats_t;
+
+int event_player_add(size_t player_id, event_t event,
+        enum keyboard direction);
+size_t event_player_cancel(size_t player_id);
+void event_sync();
+void event_stats(ev_stats_t *stats);
 void event_init();
 
 #endif /* EVENT_H */
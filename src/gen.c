@@ -0,0 +1,611 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+#include "gen.h"
+
+// Normalization level of the surface (see gen_surface.pl)
+#define GEN_LEVELS 0.9
+// Probability magic of trees and fields
+#define GEN_THRESHOLD 0.3
+#define GEN_FIELD 0.1
+// Attempts to find free area for a building
+#define GEN_TTL 1000
+// Fields of a tile depend on the tiles this far (two gen_fields() passes)
+#define GEN_MARGIN 2
+
+// Independent PRNG streams of the generator stages
+#define GEN_STREAM_KEYLINES 0
+#define GEN_STREAM_TILES 1
+#define GEN_STREAM_CASTLES 2
+
+typedef struct gen_building {
+    uint32_t height;
+    uint32_t width;
+    char *cells;
+
+    // Place on the level, see gen_place()
+    uint32_t top;           // top left corner of the padding
+    uint32_t left;
+    uint32_t padding;       // free space around the building
+    char pchar;             // character to fill padding or '\0'
+    uint8_t placed;
+} gen_building_t;
+
+static const char *gen_castle_small[] = {
+    "###############" ,
+    "#_____________#" ,
+    "#____#___#____#" ,
+    "#____#___#____#" ,
+    "#____#___#____#" ,
+    "#____#_F_#____#" ,
+    "#____#___#____#" ,
+    "#____#####____#" ,
+    "#_____________#" ,
+    "######___######" ,
+    "     #___#     " ,
+    "^ ^ ^#___#^ ^ ^" ,
+    " ^ ^  #_#  ^ ^ " ,
+    "^ ^ ^ 111 ^ ^ ^" ,
+};
+
+// Rows are not indented to fit in 80 columns
+static const char *gen_city[] = {
+"...........................                    ...........................",
+".#######..#######..#######.                    .#######..#######..#######.",
+".#_____#..#_____#..#_____#.                    .#_____#..#_____#..#_____#.",
+".##___##..##___##..##___##.                    .##___##..##___##..##___##.",
+"..#___#....#___#....#___#........................#___#....#___#....#___#..",
+" .#___######___######___###..####.4####4.####..###___######___######___#. ",
+" .#_______________________#..#__#.4+__+4.#__#..#_______________________#. ",
+" ..#______________________####__####__####__####______________________#.. ",
+"  ..#________________________________________________________________#..  ",
+"   ..#___#####____#####____________________________#####____#####___#..   ",
+"    .#___#___#____#___#____________________________#___#____#___#___#.    ",
+"    .#___#___#____#___#____________________________#___#____#___#___#.    ",
+"    .#___#___#____#___#____________####____________#___#____#___#___#.    ",
+"    .#___#_l_#____#_l_#_________###_##_###_________#_l_#____#_l_#___#.    ",
+"    .#___#___#____#___#_______###___##___###_______#___#____#___#___#.    ",
+"    .#___#####____#####______##_____##_____##______#####____#####___#.    ",
+"    .#_______________________+______##______+_______________________#.    ",
+"    .#_______________________#______##______#_______________________#.    ",
+"    .#_______________________#____#_##_#____#_______________________#.    ",
+"    .#_______________________+______##______+_____________________C_#.    ",
+"    .#_______________________#______##______#_______________________#.    ",
+"    .################################################################.    ",
+"    ..................................................................    ",
+};
+
+static const char *gen_castle_big[] = {
+    "                             .........                           ",
+    "                          ....#######....                        ",
+    "                        ...###___l___###...                      ",
+    "                       ..##_____________##..                     ",
+    "                       .##_______________##.                     ",
+    "                      ..#_________________#..                    ",
+    "                      .##_________________##.                    ",
+    "              .........#___________________#.........            ",
+    "             ..###########+#########################..           ",
+    "             .#________#____________________________#......      ",
+    "             .#_______#_____________________________#......      ",
+    "             .#_______+_____________________________#......      ",
+    "             .#_______#_______###############_______#......      ",
+    "       .......#______#_____###_______###_____####___#.4.....     ",
+    "   .....#######______#__###_____________###______#+###+####....  ",
+    "  ..#####_____#______###___________________##_______#____#####.. ",
+    "...##_____l___#______#_______________________#______+________##..",
+    ".##___________#______#_______________________#______#__________##",
+    ".#____________#______#___________#___________#______#___________#",
+    ".##___________#______#_________##____________#______#__________##",
+    "...##_________+______#________##_____________#______#________##..",
+    "  ..#####_____#_______##_C__##_____________###______#____#####.. ",
+    "   .....########+#______####____________###__#______#######....  ",
+    "       .......#___####_____###.......###_____#______#.......     ",
+    "             .#_______######________________#_______#.           ",
+    "             .#_____________________________#_______#.           ",
+    "             .#_____________________________#_______#.           ",
+    "             .#____________________________#___l____#.           ",
+    "             ..#########################+###########..           ",
+    "              .........#___________________#.........            ",
+    "                      .##__________l______##.                    ",
+    "                      ..#_________________#..                    ",
+    "                       .##_______________##.                     ",
+    "                       ..##_____________##..                     ",
+    "                        ...###_______###...                      ",
+    "                          ....#######....                        ",
+    "                             .........                           ",
+};
+
+#define GEN_BUILDING(lines) lines, sizeof(lines) / sizeof(lines[0])
+
+static void gen_progress(const gen_params_t *params, uint8_t percent) {
+    if (params->progress != NULL) {
+        params->progress(params->progress_arg, percent);
+    }
+}
+
+/*
+ * rng  : generator to initialize
+ * seed : any value, including zero
+ */
+void gen_rng_init(gen_rng_t *rng, uint64_t seed) {
+    // splitmix64, so close seeds give unrelated sequences
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    rng->state = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * ret : uniformly distributed value in [0, 1), like perl's rand()
+ */
+double gen_rand(gen_rng_t *rng) {
+    // xorshift64*
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+
+    return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Random generator of a point of the level. It doesn't depend on the order
+ * the points are generated in, so any part of the level can be generated
+ * alone.
+ *
+ * stream : generator stage, GEN_STREAM_*
+ */
+static void gen_rng_point(gen_rng_t *rng, const gen_params_t *params,
+        uint64_t stream, uint32_t y, uint32_t x) {
+    gen_rng_init(rng, params->seed + stream);
+    gen_rng_init(rng, rng->state ^ ((uint64_t)y << 32 | x));
+}
+
+/*
+ * Height of the keypoint (gen_surface.pl keylines): keylines are
+ * range + 1 rows apart like the steepest ones of the script, keypoints on
+ * them are an average keyline step apart.
+ */
+static double gen_keypoint(const gen_params_t *params, uint32_t ky,
+        uint32_t kx) {
+    gen_rng_t rng;
+
+    gen_rng_point(&rng, params, GEN_STREAM_KEYLINES, ky, kx);
+
+    return params->range * gen_rand(&rng);
+}
+
+/*
+ * Interpolates the surface between the keypoints and converts it to tiles
+ * (print_tiles() of gen_surface.pl).
+ *
+ * top, left     : rectangle of the level
+ * height, width : size of the rectangle
+ * grid          : height * width tiles
+ */
+static void gen_surface(const gen_params_t *params, uint32_t top,
+        uint32_t left, uint32_t height, uint32_t width, char *grid) {
+    uint32_t step_y = params->range + 1;
+    uint32_t step_x = params->step_min + params->step_max / 2;
+    double scale = params->range > 0 ? GEN_LEVELS / params->range : 0;
+    gen_rng_t tiles;
+
+    if (step_x == 0) {
+        step_x = 1;
+    }
+
+    // Keypoints of the keylines above and below the row
+    uint32_t kleft = left / step_x;
+    size_t klen = (left + width - 1) / step_x - kleft + 2;
+    double *above, *below;
+    if ((above = (double *)malloc(2 * sizeof(double) * klen)) == NULL) {
+        panic("Error allocating level generator keylines!");
+    }
+    below = above + klen;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t ly = top + y;
+
+        if (y == 0 || ly % step_y == 0) {
+            for (size_t k = 0; k < klen; k++) {
+                above[k] = gen_keypoint(params, ly / step_y, kleft + k);
+                below[k] = gen_keypoint(params, ly / step_y + 1, kleft + k);
+            }
+        }
+
+        double fy = (double)(ly % step_y) / step_y;
+        char *out = grid + (size_t)y * width;
+
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t lx = left + x;
+            size_t k = lx / step_x - kleft;
+            double fx = (double)(lx % step_x) / step_x;
+            double up = above[k] + (above[k + 1] - above[k]) * fx;
+            double down = below[k] + (below[k + 1] - below[k]) * fx;
+
+            gen_rng_point(&tiles, params, GEN_STREAM_TILES, ly, lx);
+
+            double value = scale * (up + (down - up) * fy);
+            double r = value * gen_rand(&tiles);
+            double threshold = GEN_THRESHOLD * gen_rand(&tiles);
+
+            if (r > threshold + GEN_THRESHOLD) {
+                out[x] = '^';
+            } else if (r < GEN_FIELD) {
+                out[x] = '"';
+            } else {
+                out[x] = '.';
+            }
+        }
+
+        // Writing tiles takes 60% of the time
+        if ((y + 1) % (height / 8 + 1) == 0) {
+            gen_progress(params, 60 * (y + 1) / height);
+        }
+    }
+
+    free(above);
+}
+
+/*
+ * Cellular pass over plains (gen_fields.pl): field grows, where there are
+ * enough fields around it.
+ *
+ * rows     : scratch space for 2 * width chars
+ * finalize : only remove lonely fields (-f option)
+ */
+static void gen_fields(char *grid, uint32_t height, uint32_t width,
+        int finalize, char *rows) {
+    char *prev = rows, *curr = rows + width, *tmp;
+
+    memcpy(curr, grid, width);
+
+    for (uint32_t y = 0; y < height; y++) {
+        // Rows below are not modified yet, rows above are saved
+        char *next = y + 1 < height ? grid + (size_t)(y + 1) * width : NULL;
+        char *out = grid + (size_t)y * width;
+
+        for (uint32_t x = 0; x < width; x++) {
+            if (curr[x] != '"' && curr[x] != '.') {
+                continue;
+            }
+
+            uint32_t from = x > 0 ? x - 1 : x;
+            uint32_t to = x + 1 < width ? x + 1 : x;
+            int fields = curr[x] == '"' ? -1 : 0;
+
+            for (uint32_t i = from; i <= to; i++) {
+                fields += (y > 0 && prev[i] == '"') + (curr[i] == '"') +
+                    (next != NULL && next[i] == '"');
+            }
+
+            if (finalize) {
+                if (fields <= 2) {
+                    out[x] = '.';
+                }
+            } else {
+                out[x] = fields >= 4 ? '"' : '.';
+            }
+        }
+
+        tmp = prev;
+        prev = curr;
+        curr = tmp;
+        if (next != NULL) {
+            memcpy(curr, next, width);
+        }
+    }
+}
+
+static void gen_building_load(gen_building_t *building, const char **lines,
+        size_t count) {
+    building->height = count;
+    building->width = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strlen(lines[i]) > building->width) {
+            building->width = strlen(lines[i]);
+        }
+    }
+
+    if ((building->cells = (char *)malloc(building->height *
+                    building->width)) == NULL) {
+        panic("Error allocating building!");
+    }
+
+    // Short lines are padded with transparent spaces
+    memset(building->cells, ' ', building->height * building->width);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(building->cells + i * building->width, lines[i],
+                strlen(lines[i]));
+    }
+}
+
+/*
+ * direction : 0 -- nothing, 1 -- CW, 2 -- 180, 3 -- CCW
+ */
+static void gen_building_rotate(gen_building_t *building, int direction) {
+    uint32_t h = building->height, w = building->width;
+    char *old = building->cells, *cells;
+
+    if (direction == 0) {
+        return;
+    }
+
+    if ((cells = (char *)malloc(h * w)) == NULL) {
+        panic("Error allocating building!");
+    }
+
+    if (direction == 2) {
+        for (uint32_t i = 0; i < h * w; i++) {
+            cells[i] = old[h * w - 1 - i];
+        }
+    } else {
+        // Height and width are swapped
+        for (uint32_t y = 0; y < w; y++) {
+            for (uint32_t x = 0; x < h; x++) {
+                cells[y * h + x] = direction == 1 ?
+                    old[(h - 1 - x) * w + y] : old[x * w + (w - 1 - y)];
+            }
+        }
+        building->height = w;
+        building->width = h;
+    }
+
+    building->cells = cells;
+    free(old);
+}
+
+/*
+ * Finds random free area for the building (overlay_anywhere() of gen.pm).
+ * Tiles of the surface are all free, so the area must not overlap the
+ * buildings placed before only.
+ *
+ * placed : buildings placed before
+ * count  : number of *placed*
+ */
+static void gen_place(gen_rng_t *rng, const gen_params_t *params,
+        const gen_building_t *placed, size_t count,
+        gen_building_t *building) {
+    uint32_t h = building->height + 2 * building->padding;
+    uint32_t w = building->width + 2 * building->padding;
+
+    building->placed = 0;
+    if (params->height < h || params->width < w) {
+        return;
+    }
+
+    long range_y = (long)params->height - 1 - h;
+    long range_x = (long)params->width - 1 - w;
+
+    for (size_t ttl = 0; ttl < GEN_TTL; ttl++) {
+        uint32_t top = range_y > 0 ? range_y * gen_rand(rng) : 0;
+        uint32_t left = range_x > 0 ? range_x * gen_rand(rng) : 0;
+        int vacant = 1;
+
+        for (size_t i = 0; vacant && i < count; i++) {
+            const gen_building_t *other = placed + i;
+
+            vacant = ! other->placed ||
+                top >= other->top + other->height + 2 * other->padding ||
+                left >= other->left + other->width + 2 * other->padding ||
+                other->top >= top + h || other->left >= left + w;
+        }
+
+        if (vacant) {
+            building->top = top;
+            building->left = left;
+            building->placed = 1;
+            return;
+        }
+    }
+}
+
+/*
+ * Places the buildings (gen_castle.pl). The places depend on the level
+ * parameters only, buildings which don't fit the level are skipped.
+ *
+ * buildings : 3 buildings to load and place, free their cells after use
+ */
+static void gen_castles(const gen_params_t *params,
+        gen_building_t *buildings) {
+    gen_rng_t rng;
+
+    gen_rng_init(&rng, params->seed + GEN_STREAM_CASTLES);
+
+    gen_building_load(buildings + 0, GEN_BUILDING(gen_castle_small));
+    gen_building_rotate(buildings + 0, 4 * gen_rand(&rng));
+    buildings[0].padding = 2;
+    buildings[0].pchar = ',';
+    gen_place(&rng, params, buildings, 0, buildings + 0);
+
+    gen_building_load(buildings + 1, GEN_BUILDING(gen_city));
+    buildings[1].padding = 0;
+    buildings[1].pchar = '\0';
+    gen_place(&rng, params, buildings, 1, buildings + 1);
+
+    gen_building_load(buildings + 2, GEN_BUILDING(gen_castle_big));
+    gen_building_rotate(buildings + 2, gen_rand(&rng) >= 0.5 ? 0 : 2);
+    buildings[2].padding = 0;
+    buildings[2].pchar = '\0';
+    gen_place(&rng, params, buildings, 2, buildings + 2);
+}
+
+/*
+ * Puts the parts of the buildings, which are inside the rectangle of the
+ * level.
+ *
+ * grid : height * width tiles of the rectangle
+ */
+static void gen_buildings(const gen_params_t *params, uint32_t top,
+        uint32_t left, uint32_t height, uint32_t width, char *grid) {
+    gen_building_t buildings[3];
+
+    if (! params->castles) {
+        return;
+    }
+
+    gen_castles(params, buildings);
+
+    for (size_t i = 0; i < sizeof(buildings) / sizeof(buildings[0]); i++) {
+        gen_building_t *b = buildings + i;
+        uint32_t pad = b->padding;
+
+        for (uint32_t y = 0; b->placed && y < b->height + 2 * pad; y++) {
+            uint64_t ly = (uint64_t)b->top + y;
+            if (ly < top || ly >= (uint64_t)top + height) {
+                continue;
+            }
+
+            char *row = grid + (ly - top) * width;
+            for (uint32_t x = 0; x < b->width + 2 * pad; x++) {
+                uint64_t lx = (uint64_t)b->left + x;
+                if (lx < left || lx >= (uint64_t)left + width) {
+                    continue;
+                }
+
+                char c = ' ';
+                if (y >= pad && y < b->height + pad &&
+                        x >= pad && x < b->width + pad) {
+                    c = b->cells[(y - pad) * b->width + x - pad];
+                }
+
+                if (c != ' ') {
+                    row[lx - left] = c;
+                } else if (b->pchar) {
+                    row[lx - left] = b->pchar;
+                }
+            }
+        }
+
+        free(b->cells);
+    }
+}
+
+/*
+ * Replaces walkable space placeholders with IN_GEN characters
+ * (gen_placeholders.pl, see scripts/stuff).
+ */
+static void gen_placeholders(char *grid, size_t size) {
+    static const char placeholders[] = { ',', '_', '^', '.', '"' };
+
+    for (size_t i = 0; i < size; i++) {
+        if (grid[i] >= '1' && grid[i] <= '5') {
+            grid[i] = placeholders[grid[i] - '1'];
+        }
+    }
+}
+
+/*
+ * Generates a rectangle of the level, the same as this part of the whole
+ * level. Fields depend on the tiles around, so GEN_MARGIN tiles around the
+ * rectangle are generated too.
+ *
+ * params        : generation parameters
+ * top, left     : rectangle inside the level
+ * height, width : size of the rectangle
+ *
+ * ret           : height * width characters, row by row, should be freed
+ *                 by the caller
+ */
+char *gen_area(const gen_params_t *params, uint32_t top, uint32_t left,
+        uint32_t height, uint32_t width) {
+    if (height == 0 || width == 0 ||
+            (uint64_t)top + height > params->height ||
+            (uint64_t)left + width > params->width) {
+        panic("Level area out of the level can't be generated!");
+    }
+
+    uint32_t m_top = top < GEN_MARGIN ? top : GEN_MARGIN;
+    uint32_t m_left = left < GEN_MARGIN ? left : GEN_MARGIN;
+    uint32_t m_bottom = params->height - top - height;
+    uint32_t m_right = params->width - left - width;
+    if (m_bottom > GEN_MARGIN) m_bottom = GEN_MARGIN;
+    if (m_right > GEN_MARGIN) m_right = GEN_MARGIN;
+
+    uint32_t m_height = height + m_top + m_bottom;
+    uint32_t m_width = width + m_left + m_right;
+    char *grid, *rows;
+
+    if ((grid = (char *)malloc((size_t)m_height * m_width)) == NULL) {
+        panic("Error allocating level!");
+    }
+    if ((rows = (char *)malloc(2 * m_width)) == NULL) {
+        panic("Error allocating level generator rows!");
+    }
+
+    gen_surface(params, top - m_top, left - m_left, m_height, m_width, grid);
+    gen_fields(grid, m_height, m_width, 0, rows);
+    gen_progress(params, 75);
+    gen_fields(grid, m_height, m_width, 1, rows);
+    gen_progress(params, 90);
+    free(rows);
+
+    // Rows only move towards the beginning
+    for (uint32_t y = 0; y < height && (m_top || m_left || m_right); y++) {
+        memmove(grid + (size_t)y * width,
+                grid + (size_t)(y + m_top) * m_width + m_left, width);
+    }
+
+    gen_buildings(params, top, left, height, width, grid);
+    gen_placeholders(grid, (size_t)height * width);
+    gen_progress(params, 100);
+
+    return grid;
+}
+
+/*
+ * Generates the level.
+ *
+ * params : generation parameters
+ *
+ * ret    : params->height * params->width characters, row by row, should be
+ *          freed by the caller
+ */
+char *gen_level(const gen_params_t *params) {
+    if (params->height == 0 || params->width == 0) {
+        panic("Level of zero size can't be generated!");
+    }
+
+    gen_progress(params, 0);
+
+    return gen_area(params, 0, 0, params->height, params->width);
+}
+
+/*
+ * Generates a chunk of the level, see gen_area(). Tiles out of the level
+ * are floor.
+ *
+ * params : level parameters
+ * cy, cx : chunk coordinates
+ * cells  : CHUNK_CELLS cells
+ */
+void gen_chunk(const gen_params_t *params, uint32_t cy, uint32_t cx,
+        cell_t *cells) {
+    gen_params_t chunk = *params;
+    uint32_t top = cy << CHUNK_BITS, left = cx << CHUNK_BITS;
+
+    for (size_t i = 0; i < CHUNK_CELLS; i++) {
+        cells[i] = TILE_CELL(S_FLOOR, L_BLACK);
+    }
+    if (top >= params->height || left >= params->width) {
+        return;
+    }
+
+    uint32_t height = params->height - top;
+    uint32_t width = params->width - left;
+    if (height > CHUNK_SIZE) height = CHUNK_SIZE;
+    if (width > CHUNK_SIZE) width = CHUNK_SIZE;
+
+    chunk.progress = NULL;
+    char *grid = gen_area(&chunk, top, left, height, width);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            if (grid[(size_t)y * width + x] == '^') {
+                cells[y << CHUNK_BITS | x] = TILE_CELL(S_TREE, L_GREEN);
+            }
+        }
+    }
+    free(grid);
+}
@@ -0,0 +1,42 @@
+// vim: sw=4 ts=4 et :
+#ifndef GEN_H
+#define GEN_H
+
+/*
+ * Native level generator, port of scripts/Gen.sh pipeline:
+ * gen_surface.pl | gen_fields.pl | gen_fields.pl -f | gen_castle.pl |
+ * gen_placeholders.pl
+ *
+ * Result is a level of IN_GEN characters (see scripts/stuff) without
+ * newlines. The same parameters always give the same level. Every tile
+ * depends on its coordinates only, so any part of the level can be
+ * generated alone.
+ */
+
+typedef struct gen_params {
+    uint64_t seed;          // PRNG seed
+    uint32_t height;        // level height
+    uint32_t width;         // level width
+    uint32_t range;         // more mountains, less plains
+    uint32_t step_min;      // keyline distance stepping
+    uint32_t step_max;
+    uint8_t castles;        // put buildings on the level
+
+    // Optional callback, called from time to time with percent done
+    void (*progress)(void *arg, uint8_t percent);
+    void *progress_arg;
+} gen_params_t;
+
+typedef struct gen_rng {
+    uint64_t state;
+} gen_rng_t;
+
+void gen_rng_init(gen_rng_t *rng, uint64_t seed);
+double gen_rand(gen_rng_t *rng);
+char *gen_level(const gen_params_t *params);
+char *gen_area(const gen_params_t *params, uint32_t top, uint32_t left,
+        uint32_t height, uint32_t width);
+void gen_chunk(const gen_params_t *params, uint32_t cy, uint32_t cx,
+        cell_t *cells);
+
+#endif /* GEN_H */
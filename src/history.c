@@ -0,0 +1,165 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+
+void history_init(history_t *history, size_t capacity) {
+    memset(history, '\0', sizeof(history_t));
+
+    if ((history->records = (history_record_t *)calloc(capacity,
+                    sizeof(history_record_t))) == NULL) {
+        panic("Error allocating history!");
+    }
+    history->capacity = capacity;
+}
+
+void history_destroy(history_t *history) {
+    free(history->records);
+    history->records = NULL;
+}
+
+/*
+ * Puts the record in place of the oldest one.
+ *
+ * id     : number of the record, history->next for a new one. Records
+ *          older than the last one are ignored, the skipped ones are
+ *          missing.
+ * time   : time of the record
+ * sender : author of the record
+ * text   : text, cut to HISTORY_TEXT_MAXLEN
+ * len    : length of *text*
+ *
+ * ret    : the record or NULL if it is ignored
+ */
+history_record_t *history_add(history_t *history, uint64_t id,
+        uint64_t time, uint32_t sender, const char *text, size_t len) {
+    if (id < history->next) {
+        return NULL;
+    }
+
+    if (id - history->next >= history->capacity - history->count) {
+        history->count = history->capacity;
+    } else {
+        history->count += id - history->next + 1;
+    }
+    history->next = id + 1;
+
+    history_record_t *record = history->records + id % history->capacity;
+    record->id = id;
+    record->time = time;
+    record->sender = sender;
+    record->len = len < HISTORY_TEXT_MAXLEN ? len : HISTORY_TEXT_MAXLEN;
+    memcpy(record->text, text, record->len);
+    record->text[record->len] = '\0';
+
+    return record;
+}
+
+/*
+ * ret : id of the oldest record kept
+ */
+uint64_t history_first(history_t *history) {
+    return history->next - history->count;
+}
+
+/*
+ * ret : the record or NULL if it is dropped, missing or not written yet
+ */
+history_record_t *history_get(history_t *history, uint64_t id) {
+    if (id < history_first(history) || id >= history->next) {
+        return NULL;
+    }
+
+    history_record_t *record = history->records + id % history->capacity;
+
+    return record->id == id ? record : NULL;
+}
+
+/*
+ * Encodes the record into its wire format.
+ *
+ * buf : at least HISTORY_WIRE_SIZE + record->len bytes or NULL to get the
+ *       size only
+ *
+ * ret : size of the encoded record
+ */
+size_t history_record_encode(history_record_t *record, char *buf) {
+    if (buf != NULL) {
+        memcpy(buf, &record->id, sizeof(uint64_t));
+        memcpy(buf + 8, &record->time, sizeof(uint64_t));
+        memcpy(buf + 16, &record->sender, sizeof(uint32_t));
+        memcpy(buf + 20, &record->len, sizeof(uint16_t));
+        memcpy(buf + HISTORY_WIRE_SIZE, record->text, record->len);
+    }
+
+    return HISTORY_WIRE_SIZE + record->len;
+}
+
+/*
+ * Encodes *limit* records before the last *offset* ones, oldest first.
+ *
+ * payload : encoded records, allocated here
+ *
+ * ret     : size of *payload*
+ */
+size_t history_encode(history_t *history, uint64_t offset, size_t limit,
+        char **payload) {
+    uint64_t first = history_first(history), last = history->next;
+    size_t size = 0;
+
+    last = offset < last - first ? last - offset : first;
+    first = limit < last - first ? last - limit : first;
+
+    for (uint64_t id = first; id < last; id++) {
+        history_record_t *record = history_get(history, id);
+        if (record != NULL) {
+            size += history_record_encode(record, NULL);
+        }
+    }
+
+    if ((*payload = (char *)malloc(size > 0 ? size : 1)) == NULL) {
+        panic("Error allocating history payload!");
+    }
+
+    char *pos = *payload;
+    for (uint64_t id = first; id < last; id++) {
+        history_record_t *record = history_get(history, id);
+        if (record == NULL) {
+            continue;
+        }
+
+        pos += history_record_encode(record, pos);
+    }
+
+    return size;
+}
+
+/*
+ * Adds the encoded records, see history_encode().
+ *
+ * ret : number of records added
+ */
+size_t history_decode(history_t *history, const char *payload, size_t size) {
+    size_t pos = 0, added = 0;
+
+    while (size - pos >= HISTORY_WIRE_SIZE) {
+        uint64_t id, time;
+        uint32_t sender;
+        uint16_t len;
+
+        memcpy(&id, payload + pos, sizeof(uint64_t));
+        memcpy(&time, payload + pos + 8, sizeof(uint64_t));
+        memcpy(&sender, payload + pos + 16, sizeof(uint32_t));
+        memcpy(&len, payload + pos + 20, sizeof(uint16_t));
+        pos += HISTORY_WIRE_SIZE;
+
+        if (len > size - pos) {
+            logger("[C] Broken history records!");
+            break;
+        }
+
+        added += history_add(history, id, time, sender, payload + pos,
+                len) != NULL;
+        pos += len;
+    }
+
+    return added;
+}
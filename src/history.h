@@ -0,0 +1,46 @@
+// vim: sw=4 ts=4 et :
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/*
+ * History of messages: a fixed ring of records, the oldest one is dropped
+ * when a new one comes. Records are numbered from the server start, so the
+ * client's copy keeps server's numbers.
+ *
+ * On the wire a record is u64 id, u64 time, u32 sender, u16 length and the
+ * text without '\0', numbers in host byte order like area runs.
+ */
+#define HISTORY_TEXT_MAXLEN 320
+#define HISTORY_WIRE_SIZE (2 * sizeof(uint64_t) + sizeof(uint32_t) + \
+        sizeof(uint16_t))
+
+// Sender of the records not written by players
+#define HISTORY_SERVER UINT32_MAX
+
+typedef struct history_record {
+    uint64_t id;                    // number of the record
+    uint64_t time;                  // sysutime() on the server
+    uint32_t sender;                // player id or HISTORY_SERVER
+    uint16_t len;                   // length of *text*
+    char text[HISTORY_TEXT_MAXLEN + 1]; // '\0' terminated
+} history_record_t;
+
+typedef struct history {
+    history_record_t *records;
+    size_t capacity;
+    uint64_t next;                  // id of the next record
+    size_t count;                   // records kept, some may be missing
+} history_t;
+
+void history_init(history_t *history, size_t capacity);
+void history_destroy(history_t *history);
+history_record_t *history_add(history_t *history, uint64_t id,
+        uint64_t time, uint32_t sender, const char *text, size_t len);
+uint64_t history_first(history_t *history);
+history_record_t *history_get(history_t *history, uint64_t id);
+size_t history_record_encode(history_record_t *record, char *buf);
+size_t history_encode(history_t *history, uint64_t offset, size_t limit,
+        char **payload);
+size_t history_decode(history_t *history, const char *payload, size_t size);
+
+#endif /* HISTORY_H */
@@ -124,7 +124,7 @@ int readall(int fd, void *buf, size_t size) {
 }
 
 void log_init() {
-    char *log_file = CONF_SVAL("file_server_log");
+    char *log_file = CONF_SVAL(CF_FILE_SERVER_LOG);
     if (! *log_file) {
         return;
     }
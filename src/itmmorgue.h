@@ -28,6 +28,7 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 
 // Dark and light colors
 enum colors {
@@ -41,14 +42,22 @@ enum colors {
 #include "keyboard.h"
 #include "event.h"
 #include "protocol.h"
+#include "tiles.h"
+#include "chunk.h"
+#include "gen.h"
+#include "spatial.h"
+#include "history.h"
+#include "lines.h"
+#include "arena.h"
 #include "connection.h"
+#include "reactor.h"
 #include "player.h"
 #include "client.h"
 #include "server.h"
 #include "trie/trie.h"
 #include "stuff.h"
-#include "tiles.h"
 #include "levels.h"
+#include "world.h"
 
 int client(void);
 
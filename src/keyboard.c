@@ -6,41 +6,42 @@
  * Initializes keyboard by configuration values
  */
 void keyboard_init() {
-    K[K_EXIT]             = CONF_CVAL("key_exit");
-    K[K_WINDOW_EXIT]      = CONF_CVAL("key_window_exit");
-    K[K_CLR_SCR]          = CONF_CVAL("key_clear_screen");
-    K[K_BACKSPACE]        = CONF_CVAL("key_backspace");
+    K[K_EXIT]             = CONF_CVAL(CF_KEY_EXIT);
+    K[K_WINDOW_EXIT]      = CONF_CVAL(CF_KEY_WINDOW_EXIT);
+    K[K_CLR_SCR]          = CONF_CVAL(CF_KEY_CLEAR_SCREEN);
+    K[K_BACKSPACE]        = CONF_CVAL(CF_KEY_BACKSPACE);
 
     // Movement
-    K[K_MOVE_LEFT]        = CONF_CVAL("key_move_left");
-    K[K_MOVE_RIGHT]       = CONF_CVAL("key_move_right");
-    K[K_MOVE_UP]          = CONF_CVAL("key_move_up");
-    K[K_MOVE_DOWN]        = CONF_CVAL("key_move_down");
-    K[K_MOVE_LEFT_UP]     = CONF_CVAL("key_move_left_up");
-    K[K_MOVE_RIGHT_UP]    = CONF_CVAL("key_move_right_up");
-    K[K_MOVE_LEFT_DOWN]   = CONF_CVAL("key_move_left_down");
-    K[K_MOVE_RIGHT_DOWN]  = CONF_CVAL("key_move_right_down");
+    K[K_MOVE_LEFT]        = CONF_CVAL(CF_KEY_MOVE_LEFT);
+    K[K_MOVE_RIGHT]       = CONF_CVAL(CF_KEY_MOVE_RIGHT);
+    K[K_MOVE_UP]          = CONF_CVAL(CF_KEY_MOVE_UP);
+    K[K_MOVE_DOWN]        = CONF_CVAL(CF_KEY_MOVE_DOWN);
+    K[K_MOVE_LEFT_UP]     = CONF_CVAL(CF_KEY_MOVE_LEFT_UP);
+    K[K_MOVE_RIGHT_UP]    = CONF_CVAL(CF_KEY_MOVE_RIGHT_UP);
+    K[K_MOVE_LEFT_DOWN]   = CONF_CVAL(CF_KEY_MOVE_LEFT_DOWN);
+    K[K_MOVE_RIGHT_DOWN]  = CONF_CVAL(CF_KEY_MOVE_RIGHT_DOWN);
+    K[K_MOVE_CANCEL]      = CONF_CVAL(CF_KEY_MOVE_CANCEL);
 
     // Window control
-    K[K_SCROLL_UP]        = CONF_CVAL("key_scroll_up");
-    K[K_SCROLL_DOWN]      = CONF_CVAL("key_scroll_down");
-    K[K_MENU_LARGE]       = CONF_CVAL("key_menu_large");
-    K[K_INVENTORY_LARGE]  = CONF_CVAL("key_inventory_large");
-    K[K_CHAT_LARGE]       = CONF_CVAL("key_chat_large");
-    K[K_SYSMSG_LARGE]     = CONF_CVAL("key_sysmsg_large");
+    K[K_SCROLL_UP]        = CONF_CVAL(CF_KEY_SCROLL_UP);
+    K[K_SCROLL_DOWN]      = CONF_CVAL(CF_KEY_SCROLL_DOWN);
+    K[K_MENU_LARGE]       = CONF_CVAL(CF_KEY_MENU_LARGE);
+    K[K_INVENTORY_LARGE]  = CONF_CVAL(CF_KEY_INVENTORY_LARGE);
+    K[K_CHAT_LARGE]       = CONF_CVAL(CF_KEY_CHAT_LARGE);
+    K[K_SYSMSG_LARGE]     = CONF_CVAL(CF_KEY_SYSMSG_LARGE);
 
     // Chat controls
-    K[K_CHAT_SEND]        = CONF_CVAL("key_chat_send");
+    K[K_CHAT_SEND]        = CONF_CVAL(CF_KEY_CHAT_SEND);
 
     // Others
-    K[K_ZERO]             = CONF_CVAL("key_zero");
-    K[K_ONE]              = CONF_CVAL("key_one");
-    K[K_TWO]              = CONF_CVAL("key_two");
-    K[K_THREE]            = CONF_CVAL("key_three");
-    K[K_FOUR]             = CONF_CVAL("key_four");
-    K[K_FIVE]             = CONF_CVAL("key_five");
-    K[K_SIX]              = CONF_CVAL("key_six");
-    K[K_SEVEN]            = CONF_CVAL("key_seven");
-    K[K_EIGHT]            = CONF_CVAL("key_eight");
-    K[K_NINE]             = CONF_CVAL("key_nine");
+    K[K_ZERO]             = CONF_CVAL(CF_KEY_ZERO);
+    K[K_ONE]              = CONF_CVAL(CF_KEY_ONE);
+    K[K_TWO]              = CONF_CVAL(CF_KEY_TWO);
+    K[K_THREE]            = CONF_CVAL(CF_KEY_THREE);
+    K[K_FOUR]             = CONF_CVAL(CF_KEY_FOUR);
+    K[K_FIVE]             = CONF_CVAL(CF_KEY_FIVE);
+    K[K_SIX]              = CONF_CVAL(CF_KEY_SIX);
+    K[K_SEVEN]            = CONF_CVAL(CF_KEY_SEVEN);
+    K[K_EIGHT]            = CONF_CVAL(CF_KEY_EIGHT);
+    K[K_NINE]             = CONF_CVAL(CF_KEY_NINE);
 }
@@ -8,7 +8,7 @@
  * Items of this enum are indexes of K[], which represents key map. To add a
  * key, put its name into this enum, add configuration parameter into
  * default_config.h and assign it to corresponding element of K[] in keyboard.c
- * by calling conf("key_name").value.__cval.
+ * with CONF_CVAL(CF_KEY_NAME).
  */
 enum keyboard {
     K_EXIT = 0,
@@ -25,6 +25,7 @@ enum keyboard {
     K_MOVE_RIGHT_UP,
     K_MOVE_LEFT_DOWN,
     K_MOVE_RIGHT_DOWN,
+    K_MOVE_CANCEL,
 
     // Window control
     K_SCROLL_UP,
@@ -7,117 +7,548 @@ level_t *levels;
 size_t levels_count = 0;
 
 #define LVL(id) (levels[id])
-#define HEAD (LVL(levels_count))
 
-void s_levels_init() {
-    // TODO generate levels JIT
-    // otherwise hardcode:
+// Level generation thread and its completion
+static pthread_t levels_thread;
+static pthread_mutex_t levels_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t levels_ready = 0;
 
-    if ((levels = (level_t *)malloc(sizeof(level_t) * 1)) == NULL) {
+// Saved world, mapped read-only
+static world_t world;
+
+/*
+ * Reports generation progress to the connected players.
+ */
+static void s_levels_progress(void *arg, uint8_t percent) {
+    static uint8_t last = 0xFF;
+    char msg[BUFSIZ];
+
+    (void)arg;
+    if (percent == last) {
+        return;
+    }
+    last = percent;
+
+    snprintf(msg, BUFSIZ, "Generating the world: %u%%\n", percent);
+    s_broadcast_sysmsg(NULL, SM_LEVEL_PROGRESS, msg);
+}
+
+/*
+ * Chunk generator of the level, see chunks_t.
+ */
+static void s_level_generate(void *arg, chunk_t *chunk) {
+    level_t *level = (level_t *)arg;
+    uint32_t top = chunk->cy << CHUNK_BITS, left = chunk->cx << CHUNK_BITS;
+
+    gen_chunk(&level->gen, chunk->cy, chunk->cx, chunk->cells);
+
+    // Tiles out of the level borders
+    for (uint32_t y = 0; y < CHUNK_SIZE; y++) {
+        for (uint32_t x = 0; x < CHUNK_SIZE; x++) {
+            if (top + y >= level->max_y || left + x >= level->max_x) {
+                chunk->cells[y << CHUNK_BITS | x] = TILE_CELL(S_NONE, 0);
+            }
+        }
+    }
+}
+
+/*
+ * Saved chunk of the level, see chunks_t.
+ */
+static const cell_t *s_level_map(void *arg, uint32_t cy, uint32_t cx) {
+    level_t *level = (level_t *)arg;
+
+    return world_chunk(&world, level->world, cy, cx);
+}
+
+/*
+ * Fills the level from the world file or from the config.
+ *
+ * level : level to fill
+ * saved : level of the world file or NULL
+ */
+static void s_level_init(level_t *level, const world_level_t *saved) {
+    memset(level, '\0', sizeof(level_t));
+    level->world = saved;
+
+    if (saved != NULL) {
+        level->id = saved->id;
+        memcpy(level->name, saved->name, MAX_LEVEL_NAME);
+        level->name[MAX_LEVEL_NAME - 1] = '\0';
+        level->max_y = saved->max_y;
+        level->max_x = saved->max_x;
+        level->gen.seed = saved->seed;
+        level->gen.range = saved->range;
+        level->gen.step_min = saved->step_min;
+        level->gen.step_max = saved->step_max;
+        level->gen.castles = saved->castles;
+    } else {
+        level->id = 0x13;
+        strcpy(level->name, "375");
+        level->max_y = CONF_IVAL(CF_LEVEL_HEIGHT);
+        level->max_x = CONF_IVAL(CF_LEVEL_WIDTH);
+        level->gen.seed = CONF_IVAL(CF_LEVEL_SEED);
+        level->gen.range = CONF_IVAL(CF_LEVEL_RANGE);
+        level->gen.step_min = CONF_IVAL(CF_LEVEL_STEP_MIN);
+        level->gen.step_max = CONF_IVAL(CF_LEVEL_STEP_MAX);
+        level->gen.castles = CONF_IVAL(CF_LEVEL_CASTLES);
+
+        if (level->gen.seed == 0) {
+            level->gen.seed = time(NULL);
+        }
+    }
+
+    level->gen.height = level->max_y;
+    level->gen.width = level->max_x;
+
+    chunks_init(&level->chunks, (size_t)CONF_IVAL(CF_LEVEL_MEMORY) * 1024,
+            &s_level_generate, &s_level_map, level);
+    spatial_init(&level->spatial, MAX_PLAYERS);
+
+    loggerf("[S] Level %s %u x %u, seed %llu, %llu chunks saved",
+            level->name, level->max_y, level->max_x,
+            (unsigned long long)level->gen.seed,
+            (unsigned long long)(saved != NULL ? saved->chunks : 0));
+}
+
+/*
+ * Loads the world file or prepares new levels, then generates chunks around
+ * the spawn point. Other chunks are loaded or generated when somebody comes
+ * close to them.
+ */
+static void s_levels_init() {
+    char *path = CONF_SVAL(CF_FILE_WORLD);
+    size_t count = 1;
+
+    if (*path && world_open(&world, path) == 0 && world.header->levels > 0) {
+        count = world.header->levels;
+        loggerf("[S] World loaded from %s: %zu levels", path, count);
+    }
+
+    if ((levels = (level_t *)calloc(count, sizeof(level_t))) == NULL) {
         panic("Error allocating levels!");
     }
 
-    HEAD.id = 0x13;
-    strcpy(HEAD.name, "375");
-    HEAD.max_y = conf("level_height").ival;
-    HEAD.max_x = conf("level_width").ival;
-    HEAD.size = HEAD.max_y * HEAD.max_x;
-    if ((HEAD.area = (tile_t *)malloc(sizeof(tile_t) * HEAD.size)) == NULL) {
-        panic("Error allocating level area!");
+    for (size_t i = 0; i < count; i++) {
+        s_level_init(levels + i, world.map != NULL ? world.levels + i : NULL);
     }
 
-    // TODO realloc from the script
-    FILE *gen;
-    char gen_cmd[GEN_MAX];
-    if (snprintf(gen_cmd, GEN_MAX, GEN_SH,
-                conf("level_width").ival, conf("level_height").ival) < 0) {
-        panic("Error formatting gen_cmd!");
+    // Spawn point, see player_init()
+    uint32_t radius = CONF_IVAL(CF_LEVEL_VIEW_CHUNKS);
+    uint32_t cy = PLAYER_SPAWN_Y >> CHUNK_BITS;
+    uint32_t cx = PLAYER_SPAWN_X >> CHUNK_BITS;
+    uint32_t from_y = cy > radius ? cy - radius : 0;
+    uint32_t from_x = cx > radius ? cx - radius : 0;
+    uint32_t total = (cy + radius - from_y + 1) * (cx + radius - from_x + 1);
+    uint32_t done = 0;
+
+    for (uint32_t y = from_y; y <= cy + radius; y++) {
+        for (uint32_t x = from_x; x <= cx + radius; x++) {
+            if ((y << CHUNK_BITS) < LVL(0).max_y &&
+                    (x << CHUNK_BITS) < LVL(0).max_x) {
+                chunks_load(&LVL(0).chunks, y, x);
+            }
+            s_levels_progress(NULL, 100 * ++done / total);
+        }
     }
-    if ((gen = popen(gen_cmd, "r")) == NULL) {
-        panic("Error running Gen.sh!");
+
+    loggerf("[S] Level %s is ready", LVL(0).name);
+
+    pthread_mutex_lock(&levels_mutex);
+    levels_count = count;
+    levels_ready = 1;
+    pthread_mutex_unlock(&levels_mutex);
+
+    // Everybody may be ready already
+    s_start();
+}
+
+static void* s_levels_thread(void *args) {
+    (void)args;
+    s_levels_init();
+
+    return NULL;
+}
+
+/*
+ * Starts level generation in the background, see s_levels_ready().
+ */
+void s_levels_start() {
+    if (pthread_create(&levels_thread, NULL, &s_levels_thread, NULL) != 0) {
+        panic("Error creating level generation thread!");
     }
+    pthread_detach(levels_thread);
+}
 
-    int ch, x = 0, y = 0;
-    while ((ch = getc(gen)) != EOF) {
-        // TODO parse ch
-        tile_t buftile;
-        switch ((char)ch) {
-            case '\n':
-                y++;
-                x = 0;
+/*
+ * ret : 1 if the levels are generated, 0 otherwise
+ */
+int s_levels_ready() {
+    int ready;
+
+    pthread_mutex_lock(&levels_mutex);
+    ready = levels_ready;
+    pthread_mutex_unlock(&levels_mutex);
+
+    return ready;
+}
+
+/*
+ * Unchanged tiles between two changed ones are sent as a part of the run,
+ * when it's cheaper than a new run header.
+ */
+#define AREA_DELTA_GAP (sizeof(tilerun_t) / sizeof(cell_t))
+
+// Maximum MSG_PUT_AREA_DELTA payload of one chunk
+#define AREA_DELTA_CHUNK (CHUNK_SIZE * (sizeof(tilerun_t) + \
+            sizeof(cell_t) * CHUNK_SIZE))
+
+/*
+ * Finds tiles of the chunk, which differ from the client's copy, and
+ * writes them as runs.
+ *
+ * lvl   : level of the chunk
+ * sent  : client's copy, gets updated
+ * cells : current cells of the chunk
+ * out   : buffer for at least AREA_DELTA_CHUNK bytes
+ *
+ * ret   : bytes written
+ */
+static size_t s_area_delta(level_t *lvl, chunk_sent_t *sent, cell_t *cells,
+        char *out) {
+    uint32_t top = sent->cy << CHUNK_BITS, left = sent->cx << CHUNK_BITS;
+    uint32_t height = lvl->max_y - top, width = lvl->max_x - left;
+    size_t bytes = 0;
+
+    height = height < CHUNK_SIZE ? height : CHUNK_SIZE;
+    width = width < CHUNK_SIZE ? width : CHUNK_SIZE;
+
+    for (uint32_t y = 0; y < height; y++) {
+        cell_t *old = sent->cells + (y << CHUNK_BITS);
+        cell_t *new = cells + (y << CHUNK_BITS);
+
+        for (uint32_t x = 0; x < width; ) {
+            if (old[x] == new[x]) {
+                x++;
                 continue;
-            case '^':
-                buftile.top = S_TREE;
-                buftile.color = L_GREEN;
-                break;
-            default:
-                buftile.top = S_FLOOR;
-                buftile.color = L_BLACK;
+            }
+
+            uint32_t end = x + 1;
+            for (uint32_t i = end, gap = 0; i < width && gap < AREA_DELTA_GAP;
+                    i++) {
+                if (old[i] != new[i]) {
+                    end = i + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+
+            tilerun_t run;
+            run.y = top + y;
+            run.x = left + x;
+            run.count = end - x;
+            memcpy(out + bytes, &run, sizeof(tilerun_t));
+            bytes += sizeof(tilerun_t);
+
+            memcpy(out + bytes, new + x, sizeof(cell_t) * run.count);
+            memcpy(old + x, new + x, sizeof(cell_t) * run.count);
+            bytes += sizeof(cell_t) * run.count;
+
+            x = end;
+        }
+    }
+
+    return bytes;
+}
+
+/*
+ * Finds the client's copy of the chunk or takes a free slot for it.
+ */
+static chunk_sent_t *s_area_slot(connection_t *connection, uint32_t cy,
+        uint32_t cx) {
+    chunk_sent_t *slot = NULL;
+
+    for (size_t i = 0; i < connection->area_sent_len; i++) {
+        chunk_sent_t *curr = connection->area_sent + i;
+        if (curr->used && curr->cy == cy && curr->cx == cx) {
+            return curr;
+        }
+        if (! curr->used && slot == NULL) {
+            slot = curr;
         }
-        buftile.x = x;
-        buftile.y = y;
-        buftile.underlying = NULL;
+    }
 
-        HEAD.area[lvltilepos(HEAD.max_x, y, x++)] = buftile;
+    if (slot == NULL) {
+        panic("No free area slot!");
     }
 
-    if (! feof(gen)) {
-        panic("Not EOF on Gen.sh!");
+    slot->used = 1;
+    slot->cy = cy;
+    slot->cx = cx;
+    slot->version = 0;
+    memset(slot->cells, 0xFF, sizeof(slot->cells));
+
+    return slot;
+}
+
+/*
+ * Finds part of the level the player should know about: its view with
+ * level_view_margin cells around, or level_view_chunks around the player
+ * until the view is reported. The view is trusted only as long as the
+ * player is inside it, it is reported after the client sees the move.
+ *
+ * level  : level index
+ * player : viewer
+ * area   : area inside the level, may be empty
+ */
+void s_level_view(size_t level, player_t *player, view_t *area) {
+    view_t *view = &player->connection->view;
+    uint64_t top_y, top_x, bottom_y, bottom_x, margin;
+
+    if (view->height > 0 && view->width > 0 &&
+            player->y - view->top_y < view->height &&
+            player->x - view->top_x < view->width) {
+        margin = CONF_IVAL(CF_LEVEL_VIEW_MARGIN);
+        top_y = view->top_y;
+        top_x = view->top_x;
+        bottom_y = (uint64_t)view->top_y + view->height - 1;
+        bottom_x = (uint64_t)view->top_x + view->width - 1;
+    } else {
+        margin = (uint64_t)CONF_IVAL(CF_LEVEL_VIEW_CHUNKS) << CHUNK_BITS;
+        top_y = bottom_y = player->y;
+        top_x = bottom_x = player->x;
     }
 
-    pclose(gen);
+    top_y = top_y > margin ? top_y - margin : 0;
+    top_x = top_x > margin ? top_x - margin : 0;
+    bottom_y += margin;
+    bottom_x += margin;
+    if (bottom_y >= LVL(level).max_y) bottom_y = LVL(level).max_y - 1;
+    if (bottom_x >= LVL(level).max_x) bottom_x = LVL(level).max_x - 1;
 
-    levels_count++;
+    area->top_y = top_y;
+    area->top_x = top_x;
+    area->height = bottom_y >= top_y ? bottom_y - top_y + 1 : 0;
+    area->width = bottom_x >= top_x ? bottom_x - top_x + 1 : 0;
 }
 
-void s_area_send(size_t level, player_t *player) {
-    tileblock_t *tbl;
-    size_t size = LVL(level).max_y * LVL(level).max_x;
+/*
+ * Finds entities of the level in the player's area, see s_level_view().
+ *
+ * ret : number of entities, only *max* of them are stored in *found*
+ */
+size_t s_level_look(size_t level, player_t *player, spatial_entity_t **found,
+        size_t max) {
+    view_t area;
 
-    loggerf("[S] s_area_send(%zu): %d x %d", level,
-            LVL(level).max_y, LVL(level).max_x);
+    s_level_view(level, player, &area);
+    if (area.height == 0 || area.width == 0) {
+        return 0;
+    }
 
-    /* "1" is because tileblocks are unneeded in the game:
-     * we had decided to send only visible data (.top)
-     * before we implemented tileblocks due to lack of 
-     * our memory... 
-     * Why don't we have panic() for malloc in our brains? :(
-     */
-    size_t wholesize = sizeof(tile_t) * size +
-        (sizeof(tileblock_t) - sizeof(tile_t)) * 1;
+    return spatial_rect(&LVL(level).spatial, area.top_y, area.top_x,
+            area.top_y + area.height - 1, area.top_x + area.width - 1, found,
+            max);
+}
+
+/*
+ * Sends tiles of the chunks in the player's area (see s_level_view()),
+ * changed since the previous call. Chunks which are new for the client are
+ * sent whole, as well as all the chunks after the connection queue has
+ * dropped something. Client's copies of the chunks grow with its view.
+ *
+ * level  : level index
+ * player : receiver
+ *
+ * ret    : bytes queued
+ */
+size_t s_area_sync(size_t level, player_t *player) {
+    connection_t *connection = player->connection;
+    level_t *lvl = &LVL(level);
+    size_t dropped = __atomic_load_n(&connection->mqueueptr->dropped,
+            __ATOMIC_RELAXED);
+    view_t area;
 
-    if ((tbl = (tileblock_t *)malloc(wholesize)) == NULL) {
-        panic("Error creation tileblock for send!");
+    s_level_view(level, player, &area);
+    if (area.height == 0 || area.width == 0) {
+        return 0;
+    }
+
+    uint32_t from_y = area.top_y >> CHUNK_BITS;
+    uint32_t from_x = area.top_x >> CHUNK_BITS;
+    uint32_t to_y = (area.top_y + area.height - 1) >> CHUNK_BITS;
+    uint32_t to_x = (area.top_x + area.width - 1) >> CHUNK_BITS;
+    size_t needed = (size_t)(to_y - from_y + 1) * (to_x - from_x + 1);
+
+    if (connection->area_sent == NULL) {
+        connection->area_dropped = dropped;
+    }
+    if (needed > connection->area_sent_len) {
+        if ((connection->area_sent = (chunk_sent_t *)realloc(
+                        connection->area_sent,
+                        sizeof(chunk_sent_t) * needed)) == NULL) {
+            panic("Error allocating area snapshot!");
+        }
+        memset(connection->area_sent + connection->area_sent_len, '\0',
+                sizeof(chunk_sent_t) * (needed - connection->area_sent_len));
+        connection->area_sent_len = needed;
+    }
+
+    // Forget the chunks out of sight or everything if something is lost
+    for (size_t i = 0; i < connection->area_sent_len; i++) {
+        chunk_sent_t *slot = connection->area_sent + i;
+        if (connection->area_dropped != dropped ||
+                slot->cy < from_y || slot->cy > to_y ||
+                slot->cx < from_x || slot->cx > to_x) {
+            slot->used = 0;
+        }
+    }
+    connection->area_dropped = dropped;
+
+    char *payload = NULL;
+    size_t size = 0;
+    cell_t cells[CHUNK_CELLS];
+
+    for (uint32_t y = from_y; y <= to_y; y++) {
+        for (uint32_t x = from_x; x <= to_x; x++) {
+            chunk_sent_t *slot = s_area_slot(connection, y, x);
+            if (! chunks_copy(&lvl->chunks, y, x, slot->version, cells,
+                        &slot->version)) {
+                continue;
+            }
+
+            if ((payload = (char *)realloc(payload, size +
+                            AREA_DELTA_CHUNK)) == NULL) {
+                panic("Error allocating area delta!");
+            }
+            size += s_area_delta(lvl, slot, cells, payload + size);
+        }
     }
-    tbl->count = size;
-    tbl->zcount = 1;
 
-    char *curr = (char*)&(tbl->tiles);
-    for (size_t i = 0; i < size; i++) {
-        memcpy(curr + sizeof(tile_t) * i, &(LVL(level).area[i]),
-                sizeof(tile_t));
+    if (size == 0) {
+        free(payload);
+        return 0;
     }
 
     mbuf_t s2c_mbuf;
-    s2c_mbuf.payload = (void *)tbl;
-    s2c_mbuf.msg.type = MSG_PUT_AREA;
-    s2c_mbuf.msg.size = wholesize;
+    s2c_mbuf.payload = (void *)payload;
+    s2c_mbuf.msg.type = MSG_PUT_AREA_DELTA;
+    s2c_mbuf.msg.size = size;
 
-    loggerf("[S] Sending AREA: size=%zu", wholesize);
-    mqueue_put(player->connection->mqueueptr, s2c_mbuf);
+    mqueue_put(connection->mqueueptr, s2c_mbuf);
+
+    return size;
+}
+
+/*
+ * Sends the whole area around the player.
+ */
+void s_area_send(size_t level, player_t *player) {
+    connection_t *connection = player->connection;
+
+    free(connection->area_sent);
+    connection->area_sent = NULL;
+    connection->area_sent_len = 0;
+
+    loggerf("[S] Sending AREA: %u x %u, size=%zu", LVL(level).max_y,
+            LVL(level).max_x, s_area_sync(level, player));
+}
+
+/*
+ * Changes visible part of the tile. Clients receive it on the next sync.
+ */
+void s_area_set(size_t level, uint32_t y, uint32_t x, enum stuff top,
+        enum colors color) {
+    cell_t cell = TILE_CELL(top, color);
+
+    chunks_write(&LVL(level).chunks, y, x, &cell, 1);
+}
+
+/*
+ * Puts the cell on the top of the tile, the previous top goes to the
+ * overlay. Clients receive the new top on the next sync.
+ */
+void s_area_stack(size_t level, uint32_t y, uint32_t x, enum stuff top,
+        enum colors color) {
+    cell_t cell = TILE_CELL(top, color);
+
+    pthread_mutex_lock(&levels_mutex);
+    cell_t under = chunks_cell(&LVL(level).chunks, y, x);
+    if (CELL_TOP(under) != S_NONE) {
+        overlay_push(&LVL(level).overlay, lvltilepos(LVL(level).max_x, y, x),
+                under);
+    }
+    chunks_write(&LVL(level).chunks, y, x, &cell, 1);
+    pthread_mutex_unlock(&levels_mutex);
 }
 
+/*
+ * Takes the top cell off the tile, the one under it becomes the top.
+ *
+ * ret : taken cell or CELL_UNKNOWN if there is nothing under the top
+ */
+cell_t s_area_unstack(size_t level, uint32_t y, uint32_t x) {
+    cell_t top = CELL_UNKNOWN, under;
+
+    pthread_mutex_lock(&levels_mutex);
+    if (overlay_pop(&LVL(level).overlay, lvltilepos(LVL(level).max_x, y, x),
+                &under)) {
+        top = chunks_cell(&LVL(level).chunks, y, x);
+        chunks_write(&LVL(level).chunks, y, x, &under, 1);
+    }
+    pthread_mutex_unlock(&levels_mutex);
+
+    return top;
+}
+
+/*
+ * Sends the level header (see levels.h), tiles follow with the area.
+ */
 void s_level_send(size_t level, player_t *player) {
     mbuf_t s2c_mbuf;
-    level_t *lvl;
-    if ((lvl = (level_t *)malloc(sizeof(level_t))) == NULL) {
+    char *header;
+    if ((header = (char *)calloc(1, LEVEL_HEADER_SIZE)) == NULL) {
         panic("Error allocating level mbuf!");
     }
-    memcpy(lvl, &LVL(level), sizeof(level_t));
-    s2c_mbuf.payload = (void *)lvl;
+    memcpy(header, &LVL(level).id, sizeof(uint64_t));
+    memcpy(header + 8, &LVL(level).max_y, sizeof(uint32_t));
+    memcpy(header + 12, &LVL(level).max_x, sizeof(uint32_t));
+    strncpy(header + 16, LVL(level).name, MAX_LEVEL_NAME - 1);
+    s2c_mbuf.payload = (void *)header;
     s2c_mbuf.msg.type = MSG_PUT_LEVEL;
-    s2c_mbuf.msg.size = sizeof(level_t);
+    s2c_mbuf.msg.size = LEVEL_HEADER_SIZE;
 
-    loggerf("[S] Sending LEVEL: size=%zu", sizeof(level_t));
+    loggerf("[S] Sending LEVEL: size=%zu", LEVEL_HEADER_SIZE);
     mqueue_put(player->connection->mqueueptr, s2c_mbuf);
 }
+
+/*
+ * Puts the player into the spatial index of the level at its position.
+ */
+void s_level_enter(size_t level, player_t *player) {
+    spatial_insert(&LVL(level).spatial, &player->spatial, SK_PLAYER,
+            player - players, player->y, player->x);
+}
+
+/*
+ * Writes the levels to the world file. Does nothing until they are ready.
+ */
+void s_levels_save() {
+    // Signal thread and the last leaving player may save at the same time
+    static pthread_mutex_t save_mutex = PTHREAD_MUTEX_INITIALIZER;
+    char *path = CONF_SVAL(CF_FILE_WORLD);
+    size_t count;
+
+    pthread_mutex_lock(&levels_mutex);
+    count = levels_count;
+    pthread_mutex_unlock(&levels_mutex);
+
+    if (! *path || count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&save_mutex);
+    world_save(&world, path, levels, count);
+    pthread_mutex_unlock(&save_mutex);
+}
@@ -4,21 +4,42 @@
 
 #define MAX_LEVEL_NAME 32
 
-#define GEN_SH "./scripts/Gen.sh -w%d -h%d"
-#define GEN_MAX 128
+struct world_level;
 
 typedef struct level {
     uint64_t id;
-    uint16_t max_y;
-    uint16_t max_x;
-    uint32_t size;
-    tile_t *area;
+    uint32_t max_y;
+    uint32_t max_x;
+    gen_params_t gen;           // generator parameters (server only)
+    const struct world_level *world; // saved chunks (server only)
+    chunks_t chunks;            // top cells
+    overlay_t overlay;          // stacked cells under the top (server only)
+    spatial_t spatial;          // players and other entities (server only)
     char name[MAX_LEVEL_NAME];
 } level_t;
 
-void s_levels_init();
+/*
+ * MSG_PUT_LEVEL carries the level header: u64 id, u32 max_y, u32 max_x,
+ * name padded with '\0' to MAX_LEVEL_NAME.
+ */
+#define LEVEL_HEADER_SIZE (sizeof(uint64_t) + 2 * sizeof(uint32_t) + \
+        MAX_LEVEL_NAME)
+
+void s_levels_start();
+int s_levels_ready();
+void s_levels_save();
 void s_level_send(size_t level, player_t *player);
+void s_level_enter(size_t level, player_t *player);
+void s_level_view(size_t level, player_t *player, view_t *area);
+size_t s_level_look(size_t level, player_t *player, spatial_entity_t **found,
+        size_t max);
 void s_area_send(size_t level, player_t *player);
+size_t s_area_sync(size_t level, player_t *player);
+void s_area_set(size_t level, uint32_t y, uint32_t x, enum stuff top,
+        enum colors color);
+void s_area_stack(size_t level, uint32_t y, uint32_t x, enum stuff top,
+        enum colors color);
+cell_t s_area_unstack(size_t level, uint32_t y, uint32_t x);
 
 extern size_t levels_count;
 
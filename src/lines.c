@@ -0,0 +1,106 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+
+void lines_init(lines_t *lines, size_t capacity) {
+    memset(lines, '\0', sizeof(lines_t));
+
+    if ((lines->lines = (line_t *)calloc(capacity, sizeof(line_t))) ==
+            NULL) {
+        panic("Error allocating line index!");
+    }
+    lines->capacity = capacity;
+}
+
+void lines_destroy(lines_t *lines) {
+    free(lines->lines);
+    lines->lines = NULL;
+}
+
+static void lines_push(lines_t *lines, uint64_t record, size_t start,
+        size_t len, size_t width) {
+    if (lines->count == lines->capacity) {
+        lines->first = (lines->first + 1) % lines->capacity;
+        lines->count--;
+    }
+
+    line_t *line = lines->lines +
+        (lines->first + lines->count++) % lines->capacity;
+    line->record = record;
+    line->start = start;
+    line->len = len;
+    line->width = width;
+}
+
+/*
+ * Splits the record by '\n' and by *lines->width* UTF-8 characters.
+ */
+static void lines_wrap(lines_t *lines, history_record_t *record) {
+    size_t start = 0, width = 0, i;
+
+    for (i = 0; i < record->len; i++) {
+        if (record->text[i] == '\n') {
+            lines_push(lines, record->id, start, i - start, width);
+            start = i + 1;
+            width = 0;
+        } else if ((record->text[i] & 0xC0) != 0x80) {
+            if (width == (size_t)lines->width) {
+                lines_push(lines, record->id, start, i - start, width);
+                start = i;
+                width = 0;
+            }
+            width++;
+        }
+    }
+
+    if (start < i || record->len == 0) {
+        lines_push(lines, record->id, start, i - start, width);
+    }
+}
+
+/*
+ * Brings the index up to date with the history.
+ *
+ * width : width of the window, the lines are wrapped again if it changed
+ *
+ * ret   : number of lines
+ */
+size_t lines_sync(lines_t *lines, history_t *history, int width) {
+    uint64_t first = history_first(history);
+
+    if (width < 1) {
+        width = 1;
+    }
+    if (width != lines->width) {
+        lines->width = width;
+        lines->first = lines->count = 0;
+        lines->next = first;
+    }
+
+    // Forget the lines of the dropped records
+    while (lines->count > 0 && lines->lines[lines->first].record < first) {
+        lines->first = (lines->first + 1) % lines->capacity;
+        lines->count--;
+    }
+
+    for (uint64_t id = lines->next > first ? lines->next : first;
+            id < history->next; id++) {
+        history_record_t *record = history_get(history, id);
+        if (record != NULL) {
+            lines_wrap(lines, record);
+        }
+    }
+    lines->next = history->next;
+
+    return lines->count;
+}
+
+/*
+ * ret : *n*-th line from the oldest one
+ */
+line_t *lines_get(lines_t *lines, size_t n) {
+    if (n >= lines->count) {
+        return NULL;
+    }
+
+    return lines->lines + (lines->first + n) % lines->capacity;
+}
@@ -0,0 +1,32 @@
+// vim: sw=4 ts=4 et :
+#ifndef LINES_H
+#define LINES_H
+
+/*
+ * Line index of a history: the records wrapped into screen lines. New
+ * records are wrapped once when they come, the whole history is wrapped
+ * again only when the width changes. The index is a ring too, the oldest
+ * lines are dropped with their records or when there is no room.
+ */
+typedef struct line {
+    uint64_t record;                // id of the record
+    uint16_t start;                 // offset of the line in the text
+    uint16_t len;                   // bytes of the line without '\n'
+    uint16_t width;                 // cells taken on the screen
+} line_t;
+
+typedef struct lines {
+    line_t *lines;
+    size_t capacity;
+    size_t first;                   // position of the oldest line
+    size_t count;
+    int width;                      // width the lines are wrapped for
+    uint64_t next;                  // id of the next record to wrap
+} lines_t;
+
+void lines_init(lines_t *lines, size_t capacity);
+void lines_destroy(lines_t *lines);
+size_t lines_sync(lines_t *lines, history_t *history, int width);
+line_t *lines_get(lines_t *lines, size_t n);
+
+#endif /* LINES_H */
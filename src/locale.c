@@ -3,14 +3,50 @@
 #include "client.h"
 #include "config.h"
 
-int size = 0;
-trie_t *t_locale = NULL;
-
-char** config_divisor(const char *str);
-
 // Maximum size of locale file
 #define LOCALE_SIZE_MAX (16 * 1048576)
 
+/*
+ * Locale catalog: strings of the locale file with a minimal perfect hash
+ * over the keys. It is one block, the same in memory and in the cache file
+ * (file_locale_cache):
+ *
+ *   header | int32_t seeds[buckets] | entries[count] | strings
+ *
+ * A key falls into seeds[hash(0, key) % buckets]. A negative seed is -1 -
+ * the entry of the only key of the bucket, a seed d of a bigger bucket puts
+ * its keys at hash(d, key) % count.
+ */
+#define LOCALE_MAGIC 0x314d434c     // "LCM1", also tells the byte order
+#define LOCALE_SEEDS_MAX (1 << 24)  // tries to place a bucket
+
+typedef struct locale_header {
+    uint32_t magic;
+    uint32_t buckets;               // size of seeds[]
+    uint32_t count;                 // size of entries[]
+    uint32_t strings;               // size of the strings
+    uint64_t source_size;           // locale file the catalog is built of
+    int64_t source_mtime;
+} locale_header_t;
+
+typedef struct locale_entry {
+    uint32_t hash;                  // hash(0, key)
+    uint32_t key;                   // offsets in the strings
+    uint32_t value;
+    uint32_t len;                   // anystrlen() of the value
+} locale_entry_t;
+
+#define LOCALE_SEEDS(h) ((int32_t *)((locale_header_t *)(h) + 1))
+#define LOCALE_ENTRIES(h) ((locale_entry_t *)(LOCALE_SEEDS(h) + (h)->buckets))
+#define LOCALE_STRINGS(h) ((char *)(LOCALE_ENTRIES(h) + (h)->count))
+#define LOCALE_SIZE(h) (sizeof(locale_header_t) + \
+        sizeof(int32_t) * (h)->buckets + \
+        sizeof(locale_entry_t) * (h)->count + (h)->strings)
+
+// Current catalog, NULL if there is no locale
+static locale_header_t *t_locale = NULL;
+static int locale_started = 0;
+
 /* 
  * Obtains key and value from buf and stores them into corresponding args
  *
@@ -59,6 +95,9 @@ enum config_parser_retval locale_parse(char *buf, size_t len, size_t *offset,
                     off++;
                     continue;
                 } else if (buf[off] == '\0') {
+                    // Nothing but spaces till the end
+                    key[0] = '\0';
+                    *offset = len;
                     return CP_SUCCESS;
                 } else {
                     return CP_NO_KEY;
@@ -164,94 +203,490 @@ enum config_parser_retval locale_parse(char *buf, size_t len, size_t *offset,
     return CP_UNDEF;
 }
 
-/* 
- * Initialize locale from file
+/*
+ * Errors in the locale file are fatal at start, on reload the old strings
+ * are kept.
  */
-void locale_init(char *file) {
-    struct stat sb;
-    int fd, rc;
-    char *buf;
+static void locale_error(char *msg) {
+    if (! locale_started) {
+        panic(msg);
+    }
+    logger(msg);
+}
+#define locale_errorf(fmt, ...)                     \
+    do {                                            \
+        char ___buf[BUFSIZ];                        \
+        snprintf(___buf, BUFSIZ, fmt, __VA_ARGS__); \
+        locale_error(___buf);                       \
+    } while(0)
 
-    char *key = (char*)malloc(MAX_OPT_LEN);
-    char *value = (char*)malloc(MAX_OPT_LEN);
+/*
+ * FNV-1a with a final mix, FNV alone spreads short keys badly.
+ *
+ * seed : which of the hash functions to use
+ */
+static uint32_t locale_hash(uint32_t seed, const char *str) {
+    uint32_t hash = 2166136261u ^ seed;
 
-    if (t_locale != NULL) {
-        trie_destroy(t_locale);
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
     }
 
-    if ((t_locale = trie_init(config_divisor)) == NULL) {
-        panic("Unable to create trie for locale!");
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/*
+ * ret : entry of *str* in the catalog or NULL
+ */
+static locale_entry_t *locale_find(locale_header_t *locale, char *str) {
+    if (locale == NULL || locale->count == 0) {
+        return NULL;
     }
 
-    if (file == NULL || ! *file) {
-        return; // No such file or directory! 
+    uint32_t hash = locale_hash(0, str);
+    int32_t seed = LOCALE_SEEDS(locale)[hash % locale->buckets];
+    uint32_t slot = seed < 0 ? (uint32_t)(-seed - 1) :
+        locale_hash(seed, str) % locale->count;
+    locale_entry_t *entry = LOCALE_ENTRIES(locale) + slot;
+
+    if (entry->hash != hash ||
+            strcmp(LOCALE_STRINGS(locale) + entry->key, str) != 0) {
+        return NULL;
     }
 
-    if (NULL == key || NULL == value) {
-        panic("Cannot allocate memory for config key/value buffers");
+    return entry;
+}
+
+typedef struct locale_bucket {
+    uint32_t size;
+    uint32_t bucket;
+} locale_bucket_t;
+
+static int locale_bucket_cmp(const void *a, const void *b) {
+    const locale_bucket_t *x = a, *y = b;
+
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
     }
+    return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
 
-    if (stat(file, &sb) < 0) {
-        panicf("Unable to stat file: %s!", file);
+/*
+ * Builds the catalog, the biggest buckets are placed first while there are
+ * many free entries. Later pairs with the same key replace earlier ones.
+ *
+ * strings : keys and values, each '\0' terminated
+ * size    : size of *strings*
+ * pairs   : offsets of the key and the value of every pair
+ * count   : number of *pairs*
+ *
+ * ret     : the catalog or NULL if some bucket can't be placed
+ */
+static locale_header_t *locale_compile(char *strings, size_t size,
+        uint32_t (*pairs)[2], size_t count) {
+    uint32_t buckets = count > 0 ? count : 1;
+    uint32_t *hashes = malloc(sizeof(uint32_t) * (count + 1));
+    size_t *first = malloc(sizeof(size_t) * buckets);
+    size_t *next = malloc(sizeof(size_t) * (count + 1));
+    locale_bucket_t *order = calloc(buckets, sizeof(locale_bucket_t));
+    uint32_t *slots = malloc(sizeof(uint32_t) * (count + 1));
+    uint32_t unique = 0;
+
+    if (hashes == NULL || first == NULL || next == NULL || order == NULL ||
+            slots == NULL) {
+        panic("Error allocating locale buckets!");
     }
 
-    if (sb.st_size <= 0 || sb.st_size > LOCALE_SIZE_MAX) {
-        panicf("Specified locale file has invalid size: %ld!", sb.st_size);
+    for (uint32_t b = 0; b < buckets; b++) {
+        first[b] = SIZE_MAX;
+        order[b].bucket = b;
     }
 
-    if ((buf = malloc(sb.st_size + 1)) == NULL) {
+    for (size_t i = 0; i < count; i++) {
+        char *key = strings + pairs[i][0];
+        size_t j;
+
+        hashes[i] = locale_hash(0, key);
+        uint32_t b = hashes[i] % buckets;
+
+        for (j = first[b]; j != SIZE_MAX; j = next[j]) {
+            if (hashes[j] == hashes[i] &&
+                    strcmp(strings + pairs[j][0], key) == 0) {
+                pairs[j][1] = pairs[i][1];
+                break;
+            }
+        }
+
+        if (j == SIZE_MAX) {
+            next[i] = first[b];
+            first[b] = i;
+            order[b].size++;
+            unique++;
+        }
+    }
+
+    qsort(order, buckets, sizeof(locale_bucket_t), &locale_bucket_cmp);
+
+    locale_header_t header = {
+        LOCALE_MAGIC, buckets, unique, size, 0, 0
+    };
+    locale_header_t *locale = calloc(1, LOCALE_SIZE(&header));
+    if (locale == NULL) {
+        panic("Error allocating locale catalog!");
+    }
+    *locale = header;
+
+    int32_t *seeds = LOCALE_SEEDS(locale);
+    locale_entry_t *entries = LOCALE_ENTRIES(locale);
+    char *used = calloc(unique + 1, 1);
+    uint32_t free_slot = 0;
+
+    if (used == NULL) {
+        panic("Error allocating locale catalog!");
+    }
+
+    for (uint32_t o = 0; o < buckets && locale != NULL; o++) {
+        uint32_t b = order[o].bucket;
+        size_t i;
+
+        if (order[o].size == 0) {
+            break;
+        } else if (order[o].size == 1) {
+            while (used[free_slot]) {
+                free_slot++;
+            }
+            slots[0] = free_slot;
+            seeds[b] = -(int32_t)free_slot - 1;
+        } else {
+            int32_t seed;
+
+            for (seed = 1; seed < LOCALE_SEEDS_MAX; seed++) {
+                uint32_t placed = 0;
+
+                for (i = first[b]; i != SIZE_MAX; i = next[i]) {
+                    uint32_t slot = locale_hash(seed, strings + pairs[i][0]) %
+                        unique;
+
+                    if (used[slot]) {
+                        break;
+                    }
+                    used[slot] = 2;
+                    slots[placed++] = slot;
+                }
+
+                for (uint32_t k = 0; k < placed; k++) {
+                    used[slots[k]] = 0;
+                }
+                if (i == SIZE_MAX) {
+                    break;
+                }
+            }
+
+            if (seed == LOCALE_SEEDS_MAX) {
+                free(locale);
+                locale = NULL;
+                break;
+            }
+            seeds[b] = seed;
+        }
+
+        uint32_t k = 0;
+        for (i = first[b]; i != SIZE_MAX; i = next[i], k++) {
+            locale_entry_t *entry = entries + slots[k];
+
+            used[slots[k]] = 1;
+            entry->hash = hashes[i];
+            entry->key = pairs[i][0];
+            entry->value = pairs[i][1];
+            entry->len = anystrlen(strings + pairs[i][1]);
+        }
+    }
+
+    if (locale != NULL) {
+        memcpy(LOCALE_STRINGS(locale), strings, size);
+    }
+
+    free(used);
+    free(slots);
+    free(order);
+    free(next);
+    free(first);
+    free(hashes);
+
+    return locale;
+}
+
+/*
+ * Reads the locale file and compiles it.
+ *
+ * file : locale file
+ * size : size of *file*
+ *
+ * ret  : the catalog or NULL on error
+ */
+static locale_header_t *locale_build(char *file, size_t size) {
+    int fd, rc;
+    char *buf;
+    size_t got = 0;
+
+    if ((buf = malloc(size + 1)) == NULL) {
         panic("Unable to allocate memory for l10n file!");
     }
 
     if ((fd = open(file, O_RDONLY, 0)) < 0) {
-        panic("Unable to open l10n file!");
+        free(buf);
+        locale_error("Unable to open l10n file!");
+        return NULL;
     }
 
-    while (sb.st_size > 0) {
-        if ((rc = read(fd, buf + size, sb.st_size)) < 0) {
-            panic("Error reading l10n file!");
+    while (got < size) {
+        if ((rc = read(fd, buf + got, size - got)) <= 0) {
+            close(fd);
+            free(buf);
+            locale_error("Error reading l10n file!");
+            return NULL;
         }
-        size += rc;
-        sb.st_size -= rc;
+        got += rc;
     }
+    close(fd);
 
     buf[size] = '\0';
 
+    // Every pair takes "{}{}" at least, so the strings fit into the file
+    char *strings = malloc(size + 1);
+    uint32_t (*pairs)[2] = malloc(sizeof(*pairs) * (size / 4 + 1));
+    char *key = (char*)malloc(MAX_OPT_LEN);
+    char *value = (char*)malloc(MAX_OPT_LEN);
+
+    if (NULL == strings || NULL == pairs || NULL == key || NULL == value) {
+        panic("Cannot allocate memory for config key/value buffers");
+    }
+
     size_t buflen = size + 1;
     char *bufptr = buf;
-    size_t offset;
+    size_t offset, len = 0, count = 0;
+    int failed = 0;
 
     while (buflen > 0 && buflen < LOCALE_SIZE_MAX) {
         if (locale_parse(bufptr, buflen, &offset, key, value) != CP_SUCCESS) {
-            panic("Error parsing localefile!");
+            failed = 1;
+            break;
         }
 
-        if (trie_put(t_locale, key, (void *)value, strlen(value) + 1, NULL)
-                != 0) {
-            panic("Failed to fill t_locale!");
+        if (*key) {
+            size_t key_len = strlen(key) + 1;
+            size_t value_len = strlen(value) + 1;
+
+            pairs[count][0] = len;
+            memcpy(strings + len, key, key_len);
+            len += key_len;
+            pairs[count++][1] = len;
+            memcpy(strings + len, value, value_len);
+            len += value_len;
         }
 
         bufptr += offset;
         buflen -= offset;
     }
 
+    locale_header_t *locale = NULL;
+    if (failed) {
+        locale_error("Error parsing localefile!");
+    } else if ((locale = locale_compile(strings, len, pairs, count)) ==
+            NULL) {
+        locale_error("Unable to compile localefile!");
+    }
+
     free(value);
     free(key);
+    free(pairs);
+    free(strings);
+    free(buf);
+
+    return locale;
+}
+
+/*
+ * Loads the catalog compiled from the locale file of *sb*.
+ *
+ * ret : the catalog or NULL if the cache is missing, stale or broken
+ */
+static locale_header_t *locale_cache_read(char *cache, struct stat *sb) {
+    struct stat cache_sb;
+    locale_header_t *locale;
+    int fd;
+
+    if ((fd = open(cache, O_RDONLY, 0)) < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &cache_sb) < 0 ||
+            (size_t)cache_sb.st_size < sizeof(locale_header_t) ||
+            cache_sb.st_size > 4 * LOCALE_SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    if ((locale = malloc(cache_sb.st_size)) == NULL) {
+        panic("Error allocating locale catalog!");
+    }
+
+    int rc = readall(fd, locale, cache_sb.st_size);
+    close(fd);
+
+    if (rc < 0 || locale->magic != LOCALE_MAGIC ||
+            locale->source_size != (uint64_t)sb->st_size ||
+            locale->source_mtime != (int64_t)sb->st_mtime ||
+            locale->buckets == 0 || locale->buckets > LOCALE_SIZE_MAX ||
+            locale->count > locale->buckets ||
+            LOCALE_SIZE(locale) != (size_t)cache_sb.st_size ||
+            (locale->strings > 0 &&
+             LOCALE_STRINGS(locale)[locale->strings - 1] != '\0')) {
+        free(locale);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < locale->buckets; i++) {
+        if (LOCALE_SEEDS(locale)[i] < -(int64_t)locale->count) {
+            free(locale);
+            return NULL;
+        }
+    }
+    for (uint32_t i = 0; i < locale->count; i++) {
+        locale_entry_t *entry = LOCALE_ENTRIES(locale) + i;
+
+        if (entry->key >= locale->strings || entry->value >= locale->strings) {
+            free(locale);
+            return NULL;
+        }
+    }
+
+    return locale;
+}
+
+/*
+ * Saves the catalog for the next start, the cache is replaced atomically.
+ */
+static void locale_cache_write(char *cache, locale_header_t *locale) {
+    char tmp[PATH_MAX];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cache);
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        loggerf("Unable to write locale cache %s", tmp);
+        return;
+    }
+
+    size_t size = LOCALE_SIZE(locale);
+    ssize_t rc = write(fd, locale, size);
+    close(fd);
+
+    if (rc != (ssize_t)size || rename(tmp, cache) < 0) {
+        unlink(tmp);
+        loggerf("Unable to write locale cache %s", cache);
+    }
+}
+
+/*
+ * Replaces the catalog for _(). Callers keep the strings _() gave them
+ * (window titles, menus, messages being drawn), so the old catalogs are
+ * kept until exit, the same way as config snapshots.
+ */
+static void locale_publish(locale_header_t *locale) {
+    static locale_header_t **retired = NULL;
+    static size_t retired_len = 0;
+
+    locale_header_t *old = __atomic_exchange_n(&t_locale, locale,
+            __ATOMIC_ACQ_REL);
+    if (old != NULL) {
+        if ((retired = realloc(retired, (retired_len + 1) *
+                        sizeof(locale_header_t *))) == NULL) {
+            panic("Error allocating retired locale!");
+        }
+        retired[retired_len++] = old;
+    }
+    locale_started = 1;
+}
+
+/*
+ * Loads the locale strings from *file* and publishes them for _(), which
+ * takes no locks. Called again on config reload.
+ */
+void locale_init(char *file) {
+    struct stat sb;
+    locale_header_t *locale = NULL;
+    char *cache = CONF_SVAL(CF_FILE_LOCALE_CACHE);
+
+    if (file == NULL || ! *file) {
+        // No such file or directory!
+        locale_publish(NULL);
+        return;
+    }
+
+    config_watch_file(file);
+
+    if (stat(file, &sb) < 0) {
+        locale_errorf("Unable to stat file: %s!", file);
+        return;
+    }
+
+    if (sb.st_size <= 0 || sb.st_size > LOCALE_SIZE_MAX) {
+        locale_errorf("Specified locale file has invalid size: %ld!",
+                sb.st_size);
+        return;
+    }
+
+    if (*cache) {
+        locale = locale_cache_read(cache, &sb);
+    }
+
+    if (locale == NULL) {
+        if ((locale = locale_build(file, sb.st_size)) == NULL) {
+            return;
+        }
+        locale->source_size = sb.st_size;
+        locale->source_mtime = sb.st_mtime;
+
+        if (*cache) {
+            locale_cache_write(cache, locale);
+        }
+    }
+
+    locale_publish(locale);
 }
 
 /* 
  * The only accessor to locale strings from other modules
  */
 char *_(char *str) {
-    if (t_locale == NULL)  {
-        return str;
+    locale_header_t *locale = __atomic_load_n(&t_locale, __ATOMIC_ACQUIRE);
+    locale_entry_t *entry = locale_find(locale, str);
+
+    if (entry != NULL) {
+        return LOCALE_STRINGS(locale) + entry->value;
     }
 
-    char *curr = NULL;
+    return str;
+}
+
+/*
+ * ret : length of _(*str*) in symbols, see anystrlen()
+ */
+size_t locale_len(char *str) {
+    locale_header_t *locale = __atomic_load_n(&t_locale, __ATOMIC_ACQUIRE);
+    locale_entry_t *entry = locale_find(locale, str);
 
-    if ((curr = (char *)trie_get(t_locale, str)) != NULL) {
-        return curr;
+    if (entry != NULL) {
+        return entry->len;
     }
 
-    return str;
+    return anystrlen(str);
 }
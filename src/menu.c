@@ -43,7 +43,7 @@ void m_newgame(int id, WINDOW *win) {
     size_t items_len = sizeof(items) / sizeof(int);
 
     char *caption = _(menus[id].caption);
-    size_t caption_len = anystrlen(caption);
+    size_t caption_len = locale_len(menus[id].caption);
 
     wclear(win);
 
@@ -64,7 +64,7 @@ void m_newgame(int id, WINDOW *win) {
         char *item = _(menus[items[i]].caption);
         mvwprintw(win,
                 max_y / 2 - items_len + i,
-                max_x / 2 - anystrlen(item) / 2 - 2,
+                max_x / 2 - locale_len(menus[items[i]].caption) / 2 - 2,
                 "%d. %s",
                 i + 1,
                 item);
@@ -106,7 +106,7 @@ void m_connect(int id, WINDOW *win) {
     size_t items_len = sizeof(items) / sizeof(int);
 
     char *caption = _(menus[id].caption);
-    size_t caption_len = anystrlen(caption);
+    size_t caption_len = locale_len(menus[id].caption);
 
     wclear(win);
 
@@ -127,7 +127,7 @@ void m_connect(int id, WINDOW *win) {
         char *item = _(menus[items[i]].caption);
         mvwprintw(win,
                 max_y / 2 - items_len + i,
-                max_x / 2 - anystrlen(item) / 2 - 2,
+                max_x / 2 - locale_len(menus[items[i]].caption) / 2 - 2,
                 "%d. %s",
                 i + 1,
                 item);
@@ -166,7 +166,7 @@ void m_options(int id, WINDOW *win) {
     size_t items_len = sizeof(items) / sizeof(int);
 
     char *caption = _(menus[id].caption);
-    size_t caption_len = anystrlen(caption);
+    size_t caption_len = locale_len(menus[id].caption);
 
     wclear(win);
 
@@ -187,7 +187,7 @@ void m_options(int id, WINDOW *win) {
         char *item = _(menus[items[i]].caption);
         mvwprintw(win,
                 max_y / 2 - items_len / 2 + i,
-                max_x / 2 - anystrlen(item) / 2 - 2,
+                max_x / 2 - locale_len(menus[items[i]].caption) / 2 - 2,
                 "%d. %s",
                 i + 1,
                 item);
@@ -216,7 +216,7 @@ void m_main(int id, WINDOW *win) {
     size_t items_len = sizeof(items) / sizeof(int);
 
     char *caption = _(menus[id].caption);
-    size_t caption_len = anystrlen(caption);
+    size_t caption_len = locale_len(menus[id].caption);
 
     wclear(win);
 
@@ -241,7 +241,7 @@ void m_main(int id, WINDOW *win) {
         char *item = _(menus[items[i]].caption);
         mvwprintw(win,
                 max_y / 2 - items_len / 2 + i,
-                max_x / 2 - anystrlen(item) / 2 - 2,
+                max_x / 2 - locale_len(menus[items[i]].caption) / 2 - 2,
                 "%d. %s",
                 i + 1,
                 item);
@@ -2,12 +2,80 @@
 #include "itmmorgue.h"
 #include "server.h"
 #include "stuff.h"
+#include "area.h"
+#include "windows.h"
 
 player_t players[MAX_PLAYERS];
 size_t players_len = 0;
 size_t player_self = 0;
+// Connected players in the game, the event loop reads it without the lock
 size_t players_total = 0;
 
+/*
+ * Player registry (server). Slots below players_len are either taken or in
+ * the free list. Taking and freeing slots and nickname changes happen under
+ * players_mutex, so do the broadcasts.
+ */
+static pthread_mutex_t players_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t players_free = 0;             // first free slot + 1
+static size_t players_nicks[MAX_PLAYERS];   // nickname chains, id + 1
+
+// Size of connection_t.sight
+#define SIGHT_WORDS ((MAX_PLAYERS + 63) / 64)
+size_t players_count = 0;                   // taken slots
+
+static size_t player_nick_hash(const char *nickname) {
+    uint32_t hash = 2166136261u;
+
+    for (; *nickname != '\0'; nickname++) {
+        hash = (hash ^ (unsigned char)*nickname) * 16777619u;
+    }
+
+    return hash % MAX_PLAYERS;
+}
+
+static void player_nick_link(size_t id) {
+    size_t *head = players_nicks + player_nick_hash(players[id].nickname);
+
+    players[id].nick_prev = 0;
+    players[id].nick_next = *head;
+    if (*head != 0) {
+        players[*head - 1].nick_prev = id + 1;
+    }
+    *head = id + 1;
+}
+
+static void player_nick_unlink(size_t id) {
+    if (players[id].nick_prev != 0) {
+        players[players[id].nick_prev - 1].nick_next = players[id].nick_next;
+    } else {
+        players_nicks[player_nick_hash(players[id].nickname)] =
+            players[id].nick_next;
+    }
+    if (players[id].nick_next != 0) {
+        players[players[id].nick_next - 1].nick_prev = players[id].nick_prev;
+    }
+}
+
+/*
+ * ret : id of the player with the nickname or MAX_PLAYERS, only
+ *       disconnected players are looked for if *offline* is set
+ */
+static size_t player_nick_find(const char *nickname, int offline) {
+    size_t next = players_nicks[player_nick_hash(nickname)];
+
+    for (; next != 0; next = players[next - 1].nick_next) {
+        player_t *player = players + next - 1;
+
+        if ((! offline || ! player->connected) &&
+                strcmp(player->nickname, nickname) == 0) {
+            return next - 1;
+        }
+    }
+
+    return MAX_PLAYERS;
+}
+
 /*
  * TODO implement speed, area_check, npc_check and handle other stuff.
  */
@@ -46,112 +114,727 @@ void player_move(player_move_t *move) {
         default:
             panic("[S] invalid move direction!");
     }
+
+    spatial_move(&players[id].spatial, players[id].y, players[id].x);
 }
 
+/*
+ * Takes a free slot for the new player. Ids are stable while the player
+ * exists, freed slots are reused first.
+ *
+ * color      : player color
+ * nickname   : player nickname
+ * connection : player connection, may be set later
+ *
+ * ret        : player id or MAX_PLAYERS if there are no free slots
+ */
 size_t player_init(enum colors color, char *nickname,
         connection_t *connection) {
-    players[players_len].connection = connection;
-    players[players_len].color = color;
-    strncpy(players[players_len].nickname, nickname, CHAT_NICK_MAXLEN);
-    players[players_len].ready = 0;
-    players[players_len].start = 0;
-    if (0 != pthread_mutex_init(&players[players_len].ev_queue.event_mutex,
-                NULL)) {
-        panic("Cannot initialize event queue mutex!");
+    size_t id;
+
+    pthread_mutex_lock(&players_mutex);
+
+    if (players_free != 0) {
+        id = players_free - 1;
+        players_free = players[id].free_next;
+    } else if (players_len < MAX_PLAYERS) {
+        id = players_len;
+        if (0 != pthread_mutex_init(&players[id].ev_queue.event_mutex,
+                    NULL)) {
+            panic("Cannot initialize event queue mutex!");
+        }
+    } else {
+        pthread_mutex_unlock(&players_mutex);
+        return MAX_PLAYERS;
     }
 
-    if (start != 3) {
-        /* 
-         * We don't need to set y & x on dead players.
-         * They'll be restored during NICKNAME reception.
-         */
-        players[players_len].y = 8;
-        players[players_len].x = 48;
+    players[id].connection = connection;
+    players[id].color = color;
+    strncpy(players[id].nickname, nickname, PLAYER_NAME_MAXLEN - 1);
+    players[id].nickname[PLAYER_NAME_MAXLEN - 1] = '\0';
+    players[id].ready = 0;
+    players[id].start = 0;
+    players[id].connected = 0;
+    players[id].used = 1;
+    players[id].ev_queue.head = 0;
+    players[id].ev_queue.len = 0;
+
+    // Dead players keep their slots and positions, see player_reconnect()
+    players[id].y = players[id].sent_y = PLAYER_SPAWN_Y;
+    players[id].x = players[id].sent_x = PLAYER_SPAWN_X;
+
+    player_nick_link(id);
+    players_count++;
+    if (id == players_len) {
+        // Readers go through players_len without the lock
+        __atomic_store_n(&players_len, id + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&players_mutex);
+
+    return id;
+}
+
+/*
+ * Returns the slot to the free list, handles of the player become stale.
+ */
+void player_free(size_t id) {
+    pthread_mutex_lock(&players_mutex);
+
+    if (id >= players_len || ! players[id].used) {
+        pthread_mutex_unlock(&players_mutex);
+        return;
     }
 
-    return players_len++;
+    // Nobody will take actions of the previous owner
+    event_player_cancel(id);
+    spatial_remove(&players[id].spatial);
+
+    player_nick_unlink(id);
+    players[id].used = 0;
+    players[id].connected = 0;
+    players[id].ready = 0;
+    players[id].connection = NULL;
+    players[id].generation++;
+    players[id].free_next = players_free;
+    players_free = id + 1;
+    players_count--;
+
+    pthread_mutex_unlock(&players_mutex);
+}
+
+void player_rename(size_t id, const char *nickname) {
+    pthread_mutex_lock(&players_mutex);
+
+    player_nick_unlink(id);
+    strncpy(players[id].nickname, nickname, PLAYER_NAME_MAXLEN - 1);
+    players[id].nickname[PLAYER_NAME_MAXLEN - 1] = '\0';
+    player_nick_link(id);
+
+    pthread_mutex_unlock(&players_mutex);
+}
+
+void player_recolor(size_t id, enum colors color) {
+    pthread_mutex_lock(&players_mutex);
+    players[id].color = color;
+    pthread_mutex_unlock(&players_mutex);
+}
+
+/*
+ * Marks the player in the lobby as ready to start.
+ */
+void player_ready(size_t id) {
+    pthread_mutex_lock(&players_mutex);
+    players[id].ready = 1;
+    pthread_mutex_unlock(&players_mutex);
+}
+
+/*
+ * Copies the nickname, which may be changed by another thread.
+ *
+ * nickname : buffer of PLAYER_NAME_MAXLEN bytes
+ *
+ * ret      : *nickname*
+ */
+char *player_nickname(size_t id, char *nickname) {
+    pthread_mutex_lock(&players_mutex);
+    memcpy(nickname, players[id].nickname, PLAYER_NAME_MAXLEN);
+    pthread_mutex_unlock(&players_mutex);
+
+    return nickname;
+}
+
+/*
+ * ret : id of a player with the nickname or MAX_PLAYERS
+ */
+size_t player_by_nickname(const char *nickname) {
+    size_t id;
+
+    pthread_mutex_lock(&players_mutex);
+    id = player_nick_find(nickname, 0);
+    pthread_mutex_unlock(&players_mutex);
+
+    return id;
 }
 
-void c_receive_players_full(players_full_mbuf_t *mbuf) {
-    if (!mbuf || mbuf->players_len >= MAX_PLAYERS) return;
+/*
+ * Gives the disconnected player with the nickname back to its owner, who
+ * takes over the connection.
+ *
+ * nickname   : nickname of the player
+ * connection : new connection of the player
+ *
+ * ret        : player id or MAX_PLAYERS if there is no such player
+ */
+size_t player_reconnect(const char *nickname, connection_t *connection) {
+    size_t id;
 
-    player_self = mbuf->self;
+    pthread_mutex_lock(&players_mutex);
 
-    /* Maybe we shouldn't send connection, etc. */
-    for (players_len = 0; players_len < mbuf->players_len; players_len++) {
-        players[players_len] = mbuf->players[players_len];
+    if ((id = player_nick_find(nickname, 1)) != MAX_PLAYERS) {
+        players[id].connection = connection;
+        players[id].connected = 1;
+        players[id].color ^= L_BLACK;
+        // The world is sent again by s_sync_players()
+        players[id].start = 1;
+        connection->player_id = id;
+        connection->player_generation = players[id].generation;
+        __atomic_store_n(&players_total, players_total + 1,
+                __ATOMIC_RELEASE);
     }
+
+    pthread_mutex_unlock(&players_mutex);
+
+    return id;
 }
 
-void c_receive_players(players_mbuf_t *mbuf) {
-    if (!mbuf || mbuf->players_len >= MAX_PLAYERS) return;
+/*
+ * Attaches the connection to the player.
+ */
+void player_connect(size_t id, connection_t *connection) {
+    pthread_mutex_lock(&players_mutex);
+    players[id].connection = connection;
+    players[id].connected = 1;
+    pthread_mutex_unlock(&players_mutex);
+}
 
-    player_self = mbuf->self;
+/*
+ * Detaches the connection from the player, who stays in the world. Once it
+ * returns broadcasts don't see the connection and it may be freed.
+ *
+ * ret : number of the connected players left in the game
+ */
+size_t player_disconnect(size_t id) {
+    size_t total;
 
-    for (players_len = 0; players_len < mbuf->players_len; players_len++) {
-        players[players_len].color = mbuf->players[players_len].color ;
-        players[players_len].y     = mbuf->players[players_len].y     ;
-        players[players_len].x     = mbuf->players[players_len].x     ;
+    pthread_mutex_lock(&players_mutex);
+    if (players[id].connected && players_total > 0) {
+        __atomic_store_n(&players_total, players_total - 1,
+                __ATOMIC_RELEASE);
     }
+    total = players_total;
+    players[id].connected = 0;
+    players[id].connection = NULL;
+    players[id].color ^= L_BLACK;
+    pthread_mutex_unlock(&players_mutex);
+
+    return total;
 }
 
-void s_send_players_full(player_t *player) {
-    players_full_mbuf_t* players_mbuf;
+/*
+ * ret : number of the players who have slots, but are not in the game:
+ *       fallen out of the world or just connected
+ */
+size_t players_away() {
+    size_t away;
 
-    if (! player->connected) {
-        return;
+    pthread_mutex_lock(&players_mutex);
+    away = players_count - players_total;
+    pthread_mutex_unlock(&players_mutex);
+
+    return away;
+}
+
+/*
+ * Lets everybody in the lobby into the game, if they are all ready.
+ *
+ * ret : 1 if the game has started, 0 if somebody is not ready
+ */
+int players_start() {
+    size_t total = 0;
+
+    pthread_mutex_lock(&players_mutex);
+
+    for (size_t i = 0; i < players_len; i++) {
+        if (players[i].used && ! players[i].ready) {
+            pthread_mutex_unlock(&players_mutex);
+            return 0;
+        }
+        total += players[i].used;
+    }
+    if (total == 0) {
+        pthread_mutex_unlock(&players_mutex);
+        return 0;
+    }
+
+    total = 0;
+
+    for (size_t i = 0; i < players_len; i++) {
+        players[i].start = players[i].used;
+        total += players[i].used && players[i].connected;
     }
+    __atomic_store_n(&players_total, total, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&players_mutex);
+
+    return 1;
+}
+
+player_handle_t player_handle(size_t id) {
+    player_handle_t handle;
+
+    pthread_mutex_lock(&players_mutex);
+    handle.id = id;
+    handle.generation = players[id].generation;
+    pthread_mutex_unlock(&players_mutex);
+
+    return handle;
+}
+
+/*
+ * ret : the player or NULL if the handle is stale
+ */
+player_t *player_get(player_handle_t handle) {
+    player_t *player = NULL;
 
-    if ((players_mbuf = (players_full_mbuf_t *)malloc(
-                    sizeof(players_full_mbuf_t)
-                    )) == NULL) {
-        panic("Error creating players_full_mbuf for send!");
+    pthread_mutex_lock(&players_mutex);
+    if (handle.id < players_len && players[handle.id].used &&
+            players[handle.id].generation == handle.generation) {
+        player = players + handle.id;
     }
+    pthread_mutex_unlock(&players_mutex);
+
+    return player;
+}
+
+/*
+ * ret : player of the connection or NULL if it has been freed
+ */
+player_t *player_by_connection(connection_t *connection) {
+    player_handle_t handle;
+
+    handle.id = connection->player_id;
+    handle.generation = connection->player_generation;
+
+    return player_get(handle);
+}
+
+/*
+ * Applies MSG_PUT_PLAYERS_FULL roster (see player.h).
+ */
+void c_receive_players_full(char *payload, size_t size) {
+    size_t pos = 0, len = 0;
+
+    // Players missing in the roster have left
     for (size_t i = 0; i < players_len; i++) {
-        if (player->connection == players[i].connection) {
-            players_mbuf->self = i;
+        players[i].used = 0;
+    }
+
+    while (pos + PLAYER_RECORD_SIZE <= size) {
+        uint32_t id, y, x;
+        uint8_t color, flags, nick_len;
+
+        memcpy(&id, payload + pos, sizeof(uint32_t));
+        memcpy(&y, payload + pos + 4, sizeof(uint32_t));
+        memcpy(&x, payload + pos + 8, sizeof(uint32_t));
+        color = payload[pos + 12];
+        flags = payload[pos + 13];
+        nick_len = payload[pos + 14];
+        pos += PLAYER_RECORD_SIZE;
+
+        if (id >= MAX_PLAYERS || nick_len >= PLAYER_NAME_MAXLEN ||
+                nick_len > size - pos) {
+            logger("[C] Broken players roster!");
+            return;
+        }
+
+        players[id].color = (enum colors)color;
+        players[id].y = y;
+        players[id].x = x;
+        players[id].ready = (flags & PF_READY) != 0;
+        players[id].connected = (flags & PF_CONNECTED) != 0;
+        players[id].used = 1;
+        memcpy(players[id].nickname, payload + pos, nick_len);
+        players[id].nickname[nick_len] = '\0';
+        pos += nick_len;
+
+        if (id >= len) {
+            len = id + 1;
         }
-        players_mbuf->players[i] = players[i];
     }
-    players_mbuf->players_len = players_len;
 
+    players_len = len;
+    windows_damage(W_AREA, DAMAGE_ALL);
+}
+
+/*
+ * Applies MSG_PUT_PLAYER_SELF (see player.h).
+ */
+void c_receive_player_self(char *payload, size_t size) {
+    uint32_t self;
+
+    if (size != PLAYER_SELF_SIZE) {
+        logger("[C] Broken player self!");
+        return;
+    }
+    memcpy(&self, payload, sizeof(uint32_t));
+    if (self >= MAX_PLAYERS) return;
+
+    player_self = self;
+}
+
+/*
+ * Applies MSG_PUT_PLAYERS positions (see player.h).
+ */
+void c_receive_players(char *payload, size_t size) {
+    for (size_t pos = 0; pos + PLAYER_POSITION_SIZE <= size;
+            pos += PLAYER_POSITION_SIZE) {
+        uint32_t id;
+
+        memcpy(&id, payload + pos, sizeof(uint32_t));
+        if (id >= players_len) {
+            logger("[C] Broken players positions!");
+            return;
+        }
+
+        // Tiles under the old and the new positions are drawn again
+        c_area_damage(players[id].y, players[id].x, 1, 1);
+        memcpy(&players[id].y, payload + pos + 4, sizeof(uint32_t));
+        memcpy(&players[id].x, payload + pos + 8, sizeof(uint32_t));
+        c_area_damage(players[id].y, players[id].x, 1, 1);
+    }
+}
+
+/*
+ * Tells the client its index in players[], if it has changed.
+ */
+static void s_send_player_self(player_t *player) {
+    connection_t *connection = player->connection;
+    uint32_t *self;
+
+    if (connection->player_sent == connection->player_id + 1) {
+        return;
+    }
+
+    if ((self = (uint32_t *)malloc(PLAYER_SELF_SIZE)) == NULL) {
+        panic("Error allocating player self mbuf!");
+    }
+    *self = connection->player_id;
+    connection->player_sent = connection->player_id + 1;
+
+    mbuf_t s2c_mbuf;
+    s2c_mbuf.payload = (void *)self;
+    s2c_mbuf.msg.type = MSG_PUT_PLAYER_SELF;
+    s2c_mbuf.msg.size = PLAYER_SELF_SIZE;
+
+    mqueue_put(connection->mqueueptr, s2c_mbuf);
+}
+
+/*
+ * Serializes the roster once into a shared payload for all the receivers.
+ * Caller holds players_mutex.
+ *
+ * size : payload size
+ *
+ * ret  : payload referenced by the caller
+ */
+static char *s_players_roster(size_t *size) {
+    size_t pos = 0;
+    char *roster;
+
+    *size = 0;
+    for (size_t i = 0; i < players_len; i++) {
+        if (! players[i].used) continue;
+
+        *size += PLAYER_RECORD_SIZE + strnlen(players[i].nickname,
+                PLAYER_NAME_MAXLEN - 1);
+    }
+
+    roster = (char *)mshared_alloc(*size);
+    for (size_t i = 0; i < players_len; i++) {
+        if (! players[i].used) continue;
+
+        uint32_t id = i;
+        uint8_t nick_len = strnlen(players[i].nickname,
+                PLAYER_NAME_MAXLEN - 1);
+
+        memcpy(roster + pos, &id, sizeof(uint32_t));
+        memcpy(roster + pos + 4, &players[i].y, sizeof(uint32_t));
+        memcpy(roster + pos + 8, &players[i].x, sizeof(uint32_t));
+        roster[pos + 12] = players[i].color;
+        roster[pos + 13] = (players[i].ready ? PF_READY : 0) |
+            (players[i].connected ? PF_CONNECTED : 0);
+        roster[pos + 14] = nick_len;
+        pos += PLAYER_RECORD_SIZE;
+
+        memcpy(roster + pos, players[i].nickname, nick_len);
+        pos += nick_len;
+    }
+
+    return roster;
+}
+
+/*
+ * Queues a shared payload for the player.
+ */
+static void s_put_players(player_t *player, enum msg_type type,
+        char *payload, size_t size) {
     mbuf_t s2c_mbuf;
-    s2c_mbuf.payload = (void *)players_mbuf;
-    s2c_mbuf.msg.type = MSG_PUT_PLAYERS_FULL;
-    s2c_mbuf.msg.size = sizeof(players_full_mbuf_t);
+    s2c_mbuf.payload = (void *)payload;
+    s2c_mbuf.msg.type = type;
+    s2c_mbuf.msg.size = size;
 
-    logger("[S] Sending players full");
-    mqueue_put(player->connection->mqueueptr, s2c_mbuf);
+    mqueue_put_shared(player->connection->mqueueptr, s2c_mbuf);
 }
 
-void s_send_players(player_t *player) {
-    players_mbuf_t* players_mbuf;
+/*
+ * Sends the roster to the player only. Caller holds players_mutex.
+ */
+static void s_put_players_full(player_t *player) {
+    size_t size;
 
     if (! player->connected) {
         return;
     }
 
-    if ((players_mbuf = (players_mbuf_t *)malloc(sizeof(players_mbuf_t))) ==
-            NULL) {
-        panic("Error creating players_mbuf for send!");
+    char *roster = s_players_roster(&size);
+    s_send_player_self(player);
+    s_put_players(player, MSG_PUT_PLAYERS_FULL, roster, size);
+    player->connection->players_dropped = __atomic_load_n(
+            &player->connection->mqueueptr->dropped, __ATOMIC_RELAXED);
+    mshared_release(roster);
+
+    // Roster has everybody's position, nobody is left behind
+    if (player->connection->sight != NULL) {
+        memset(player->connection->sight, '\0',
+                SIGHT_WORDS * sizeof(uint64_t));
     }
+
+    loggerf("[S] Sending players full: %zu bytes", size);
+}
+
+/*
+ * Sends the roster to everybody connected. Should be called whenever
+ * somebody joins, leaves or changes anything but position.
+ */
+void s_broadcast_players_full() {
+    size_t size, receivers = 0;
+
+    pthread_mutex_lock(&players_mutex);
+
+    char *roster = s_players_roster(&size);
     for (size_t i = 0; i < players_len; i++) {
-        if (player->connection == players[i].connection) {
-            players_mbuf->self = i;
+        players[i].sent_y = players[i].y;
+        players[i].sent_x = players[i].x;
+
+        if (players[i].connected) {
+            connection_t *connection = players[i].connection;
+
+            s_send_player_self(players + i);
+            s_put_players(players + i, MSG_PUT_PLAYERS_FULL, roster, size);
+            connection->players_dropped = __atomic_load_n(
+                    &connection->mqueueptr->dropped, __ATOMIC_RELAXED);
+            receivers++;
         }
-        players_mbuf->players[i].color = players[i].color;
-        players_mbuf->players[i].y     = players[i].y;
-        players_mbuf->players[i].x     = players[i].x;
     }
-    players_mbuf->players_len = players_len;
+    mshared_release(roster);
+
+    pthread_mutex_unlock(&players_mutex);
+
+    loggerf("[S] Broadcasting players full: %zu bytes to %zu receivers",
+            size, receivers);
+}
+
+/*
+ * Queues positions of the players in the viewer's area (see
+ * s_level_view()), which have moved, come into sight or left it. Caller
+ * holds players_mutex.
+ *
+ * viewer : receiver
+ * moved  : players moved since the previous broadcast, NULL for all
+ *
+ * ret    : payload size
+ */
+static size_t s_put_players_view(player_t *viewer, const uint8_t *moved) {
+    // Callers are serialized by players_mutex
+    static spatial_entity_t *found[MAX_PLAYERS];
+    static uint32_t ids[MAX_PLAYERS];
+    connection_t *connection = viewer->connection;
+    uint64_t sight[SIGHT_WORDS] = { 0 };
+    size_t count, len = 0;
+
+    if (viewer->spatial.spatial == NULL) {
+        return 0;
+    }
+    if (connection->sight == NULL && (connection->sight = (uint64_t *)calloc(
+                    SIGHT_WORDS, sizeof(uint64_t))) == NULL) {
+        panic("Error allocating players sight!");
+    }
+
+    count = s_level_look(0, viewer, found, MAX_PLAYERS);
+    for (size_t i = 0; i < count && i < MAX_PLAYERS; i++) {
+        size_t id = found[i]->id;
+        uint64_t bit = 1ULL << (id % 64);
+
+        if (found[i]->kind != SK_PLAYER) continue;
+
+        sight[id / 64] |= bit;
+        if (moved == NULL || moved[id] ||
+                ! (connection->sight[id / 64] & bit)) {
+            ids[len++] = id;
+        }
+    }
+
+    // The ones gone out of sight are left where they were seen last
+    for (size_t i = 0; i < SIGHT_WORDS; i++) {
+        for (uint64_t left = connection->sight[i] & ~sight[i]; left != 0;
+                left &= left - 1) {
+            size_t id = i * 64 + __builtin_ctzll(left);
+
+            if (players[id].used) {
+                ids[len++] = id;
+            }
+        }
+    }
+    memcpy(connection->sight, sight, sizeof(sight));
+
+    if (len == 0) {
+        return 0;
+    }
 
     mbuf_t s2c_mbuf;
-    s2c_mbuf.payload = (void *)players_mbuf;
+    if ((s2c_mbuf.payload = malloc(PLAYER_POSITION_SIZE * len)) == NULL) {
+        panic("Error allocating players positions!");
+    }
     s2c_mbuf.msg.type = MSG_PUT_PLAYERS;
-    s2c_mbuf.msg.size = sizeof(players_mbuf_t);
+    s2c_mbuf.msg.size = PLAYER_POSITION_SIZE * len;
+
+    char *pos = (char *)s2c_mbuf.payload;
+    for (size_t i = 0; i < len; i++, pos += PLAYER_POSITION_SIZE) {
+        memcpy(pos, ids + i, sizeof(uint32_t));
+        memcpy(pos + 4, &players[ids[i]].y, sizeof(uint32_t));
+        memcpy(pos + 8, &players[ids[i]].x, sizeof(uint32_t));
+    }
+
+    mqueue_put(connection->mqueueptr, s2c_mbuf);
+
+    return s2c_mbuf.msg.size;
+}
 
-    logger("[S] Sending players");
-    mqueue_put(player->connection->mqueueptr, s2c_mbuf);
+/*
+ * Sets the view reported by the player and sends positions of everybody in
+ * it. The view is read by the event loop under players_mutex too.
+ *
+ * player : viewer
+ * view   : new view of the player
+ */
+void s_send_players_view(player_t *player, const view_t *view) {
+    pthread_mutex_lock(&players_mutex);
+    if (player->connected) {
+        memcpy(&player->connection->view, view, sizeof(view_t));
+        s_put_players_view(player, NULL);
+    }
+    pthread_mutex_unlock(&players_mutex);
+}
+
+/*
+ * Sends every client positions of the players moved since the previous
+ * broadcast, which it can see. Clients, which queue has dropped something,
+ * get the whole roster.
+ *
+ * ret : bytes queued
+ */
+size_t s_broadcast_players() {
+    static uint8_t moved[MAX_PLAYERS];
+    size_t size = 0, count = 0, receivers = 0;
+
+    pthread_mutex_lock(&players_mutex);
+
+    for (size_t i = 0; i < players_len; i++) {
+        moved[i] = players[i].used && (players[i].y != players[i].sent_y ||
+                players[i].x != players[i].sent_x);
+        if (moved[i]) {
+            players[i].sent_y = players[i].y;
+            players[i].sent_x = players[i].x;
+            count++;
+        }
+    }
+    if (count == 0) {
+        pthread_mutex_unlock(&players_mutex);
+        return 0;
+    }
+
+    for (size_t i = 0; i < players_len; i++) {
+        if (! players[i].used || ! players[i].connected) {
+            continue;
+        }
+
+        connection_t *connection = players[i].connection;
+        if (connection->players_dropped != __atomic_load_n(
+                    &connection->mqueueptr->dropped, __ATOMIC_RELAXED)) {
+            s_put_players_full(players + i);
+        } else {
+            size += s_put_players_view(players + i, moved);
+        }
+        receivers++;
+    }
+
+    pthread_mutex_unlock(&players_mutex);
+
+    loggerf("[S] Broadcasting players: %zu moved, %zu bytes to %zu receivers",
+            count, size, receivers);
+
+    return size;
+}
+
+/*
+ * Handles start state (see server.h): sends the world to the players, who
+ * need data renewal, and area changes to the others. Runs once a tick.
+ *
+ * ret : area bytes queued
+ */
+size_t s_sync_players() {
+    size_t area_bytes = 0;
+
+    if (! start) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&players_mutex);
+
+    for (size_t id = 0; id < players_len; id++) {
+        if (! players[id].connected) {
+            continue;
+        }
+
+        connection_t *connection = players[id].connection;
+        size_t dropped = __atomic_load_n(&connection->mqueueptr->dropped,
+                __ATOMIC_RELAXED);
+
+        if (players[id].start != 1) {
+            if (connection->area_sent == NULL) {
+                continue;
+            }
+
+            // Dropped messages may have had the level or the own id,
+            // nothing else sends them again
+            if (connection->level_dropped != dropped) {
+                connection->level_dropped = dropped;
+                connection->player_sent = 0;
+                s_level_send(0, players + id);
+                s_put_players_full(players + id);
+            }
+            area_bytes += s_area_sync(0, players + id);
+            continue;
+        }
+
+        connection->level_dropped = dropped;
+        s_level_send(0, players + id);
+        s_level_enter(0, players + id);
+        s_area_send(0, players + id);
+        s_put_players_full(players + id);
+
+        players[id].start = 0;
+        start = 2;
+    }
+
+    pthread_mutex_unlock(&players_mutex);
+
+    if (area_bytes > 0) {
+        loggerf("[S] Area delta: %zu bytes", area_bytes);
+    }
+
+    return area_bytes;
 }
 
 void c_send_move(enum keyboard last_key) {
@@ -165,3 +848,12 @@ void c_send_move(enum keyboard last_key) {
 
     mqueue_put(&c2s_queue, mbuf);
 }
+
+void c_send_cancel() {
+    mbuf_t mbuf;
+    mbuf.msg.type = MSG_CANCEL_ACTIONS;
+    mbuf.msg.size = 0;
+    mbuf.payload = NULL;
+
+    mqueue_put(&c2s_queue, mbuf);
+}
@@ -4,19 +4,33 @@
 
 #include "itmmorgue.h"
 
-#define MAX_PLAYERS 5
+// Where new players appear
+#define PLAYER_SPAWN_Y 8
+#define PLAYER_SPAWN_X 48
+
+#ifndef MAX_PLAYERS
+#define MAX_PLAYERS 4096
+#endif /* MAX_PLAYERS */
 
 typedef struct player {
     enum colors color;          // server-specified attributes
-    uint16_t y;                 // absolute Y
-    uint16_t x;                 // absolute X
+    uint32_t y;                 // absolute Y
+    uint32_t x;                 // absolute X
     char nickname[PLAYER_NAME_MAXLEN];
     uint8_t ready;              // ready for the game
     uint8_t connected;          // connected to the server
+    uint8_t used;               // slot is taken, see player_init()
+    uint32_t generation;        // times the slot was freed (server)
+    size_t free_next;           // next free slot + 1 (server)
+    size_t nick_prev;           // nickname index chain, id + 1 (server)
+    size_t nick_next;
+    uint32_t sent_y;            // position broadcasted last time (server)
+    uint32_t sent_x;
     // I hate that global variable, but I don't have time to fix it
     uint8_t start;              // needs data renewal
     connection_t *connection;
     event_queue_t ev_queue;
+    spatial_entity_t spatial;   // place in the level index (server)
     /* inventory_t */
     /* common creatures stats_t */
     /* player specific stats ?? */
@@ -24,21 +38,35 @@ typedef struct player {
     /* skills_t */
 } player_t;
 
-typedef struct players_full_mbuf {
-    player_t players[MAX_PLAYERS];
-    uint8_t self;
-    size_t players_len;
-} players_full_mbuf_t;
-
-typedef struct players_mbuf {
-    struct c_player {
-        enum colors color;
-        uint16_t y;
-        uint16_t x;
-    } players[MAX_PLAYERS];
-    uint8_t self;
-    size_t players_len;
-} players_mbuf_t;
+/*
+ * Players on the wire, numbers in host byte order like area runs.
+ *
+ * MSG_PUT_PLAYERS_FULL is a roster of all the players, sent when somebody
+ * joins, leaves or changes: u32 id, u32 y, u32 x, u8 color, u8 flags
+ * (enum player_flags), u8 nickname length, nickname without '\0'.
+ *
+ * MSG_PUT_PLAYERS carries the players moved since the previous broadcast:
+ * u32 id, u32 y, u32 x.
+ *
+ * MSG_PUT_PLAYER_SELF is u32 id of the receiver's player.
+ */
+#define PLAYER_RECORD_SIZE (3 * sizeof(uint32_t) + 3)
+#define PLAYER_POSITION_SIZE (3 * sizeof(uint32_t))
+#define PLAYER_SELF_SIZE sizeof(uint32_t)
+
+enum player_flags {
+    PF_READY     = 0x01,
+    PF_CONNECTED = 0x02,
+};
+
+/*
+ * Reference to the player, which may outlive it: slots are reused, so
+ * player_get() checks the generation.
+ */
+typedef struct player_handle {
+    uint32_t id;
+    uint32_t generation;
+} player_handle_t;
 
 typedef struct player_move {
     enum keyboard direction;
@@ -47,14 +75,33 @@ typedef struct player_move {
 
 size_t player_init(enum colors color, char *nickname,
         connection_t *connection);
-void c_receive_players(players_mbuf_t *mbuf);
-void c_receive_players_full(players_full_mbuf_t *mbuf);
-void s_send_players_full(player_t *player);
-void s_send_players(player_t *player);
+void player_free(size_t id);
+void player_rename(size_t id, const char *nickname);
+void player_recolor(size_t id, enum colors color);
+void player_ready(size_t id);
+char *player_nickname(size_t id, char *nickname);
+size_t player_by_nickname(const char *nickname);
+size_t player_reconnect(const char *nickname, connection_t *connection);
+void player_connect(size_t id, connection_t *connection);
+size_t player_disconnect(size_t id);
+size_t players_away();
+int players_start();
+player_handle_t player_handle(size_t id);
+player_t *player_get(player_handle_t handle);
+player_t *player_by_connection(connection_t *connection);
+void c_receive_players(char *payload, size_t size);
+void c_receive_players_full(char *payload, size_t size);
+void c_receive_player_self(char *payload, size_t size);
+size_t s_sync_players();
+void s_broadcast_players_full();
+size_t s_broadcast_players();
+void s_send_players_view(player_t *player, const view_t *view);
 void c_send_move(enum keyboard last_key);
+void c_send_cancel();
 
 extern player_t players[];
 extern size_t players_len;
+extern size_t players_count;
 extern size_t player_self;
 extern size_t players_total;
 
@@ -1,101 +1,301 @@
 // vim: sw=4 ts=4 et :
 #include "itmmorgue.h"
 
+#define MQ_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define MQ_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define MQ_CAS(ptr, exp, val) __atomic_compare_exchange_n(ptr, exp, val, 0, \
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/*
+ * Header of a shared payload, padded to keep the payload aligned.
+ */
+typedef union mshared_head {
+    size_t refs;                    // Queues and owners holding the payload
+    long double align;
+    void *align_ptr;
+} mshared_head_t;
+
 void mqueue_init(mqueue_t *queue) {
+    mqueue_init_ext(queue, MQUEUE_SIZE, MQ_BLOCK);
+}
+
+/*
+ * queue    : queue to initialize
+ * capacity : maximum number of pending messages, power of two
+ * policy   : what to do on overflow
+ */
+void mqueue_init_ext(mqueue_t *queue, size_t capacity,
+        enum mqueue_policy policy) {
     if (queue == NULL) {
         panic("Trying to initialize NULL mqueue!");
     }
 
-    queue->size = 0;
-    queue->start_position = 0;
-    if (0 != pthread_mutex_init(&queue->mutex, NULL)) {
-        panic("Cannot initialize message queue mutex!");
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        panicf("Mqueue capacity %zu is not a power of two!", capacity);
     }
-}
 
-void mqueue_put(mqueue_t *queue, mbuf_t mbuf) {
-    if (queue == NULL) {
-        panic("Trying to put in NULL mqueue!");
+    if (policy >= MQ_POLICY_SIZE) {
+        panicf("Invalid mqueue policy: %d!", policy);
     }
 
-    int rc;
-    if (0 != (rc = pthread_mutex_lock(&queue->mutex))) {
-        if (EDEADLK == rc) {
-            panic("Message queue: deadlock!");
-        }
-        panic("[put] Message queue: failure during mutex locking");
+    if ((queue->slots = (mslot_t *)malloc(sizeof(mslot_t) * capacity)) ==
+            NULL) {
+        panic("Cannot allocate message queue!");
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        queue->slots[i].seq = i;
     }
 
-    size_t pos = queue->start_position;
-    size_t size = queue->size;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->mask = capacity - 1;
+    queue->policy = policy;
+    queue->dropped = 0;
+    queue->notify = NULL;
+    queue->notify_arg = NULL;
+}
 
-    if (pos >= MQUEUE_SIZE) {
-        panicf("Invalid position %zu int mqueue_put", pos);
+/*
+ * Takes the oldest message from the queue.
+ *
+ * queue : queue to get from
+ * mbuf  : place to save the message
+ * type  : take the message only if it has such type, -1 for any
+ *
+ * ret   : 1 on success, 0 if queue is empty or type doesn't match
+ */
+static int mqueue_dequeue(mqueue_t *queue, mbuf_t *mbuf, int type) {
+    size_t pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    mslot_t *slot;
+
+    for (;;) {
+        slot = queue->slots + (pos & queue->mask);
+        size_t seq = MQ_LOAD(&slot->seq);
+        ssize_t dif = (ssize_t)seq - (ssize_t)(pos + 1);
+
+        if (dif == 0) {
+            // Stale read is harmless here: CAS below fails in such a case
+            if (type >= 0 && (int)slot->mbuf.msg.type != type) {
+                return 0;
+            }
+            if (MQ_CAS(&queue->head, &pos, pos + 1)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
     }
 
-    if (size == MQUEUE_SIZE - 1) {
-        panic("Mqueue overflow!");
+    *mbuf = slot->mbuf;
+    MQ_STORE(&slot->seq, pos + queue->mask + 1);
+
+    return 1;
+}
+
+/*
+ * Tries to put the message into the queue.
+ *
+ * ret : 1 on success, 0 if queue is full
+ */
+static int mqueue_enqueue(mqueue_t *queue, mbuf_t *mbuf) {
+    size_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    mslot_t *slot;
+
+    for (;;) {
+        slot = queue->slots + (pos & queue->mask);
+        size_t seq = MQ_LOAD(&slot->seq);
+        ssize_t dif = (ssize_t)seq - (ssize_t)pos;
+
+        if (dif == 0) {
+            if (MQ_CAS(&queue->tail, &pos, pos + 1)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
     }
 
-    pos = (pos + size) % MQUEUE_SIZE;
+    slot->mbuf = *mbuf;
+    MQ_STORE(&slot->seq, pos + 1);
 
-    mbuf.msg.version = PROTOCOL_VERSION;
-    queue->buf[pos] = mbuf;
-    queue->size++;
+    return 1;
+}
+
+/*
+ * Drops the oldest message according to the queue policy.
+ *
+ * ret : 1 if something was dropped
+ */
+static int mqueue_drop(mqueue_t *queue, int type) {
+    mbuf_t old;
+
+    if (mqueue_dequeue(queue, &old, type) == 0) {
+        return 0;
+    }
+
+    mbuf_free(&old);
+    __atomic_add_fetch(&queue->dropped, 1, __ATOMIC_RELAXED);
 
-    pthread_mutex_unlock(&queue->mutex);
+    return 1;
 }
 
-int mqueue_get(mqueue_t *queue, mbuf_t *mbuf) {
+static void mqueue_push(mqueue_t *queue, mbuf_t mbuf) {
     if (queue == NULL) {
-        panic("Trying to get from NULL mqueue!");
+        panic("Trying to put in NULL mqueue!");
     }
 
-    int rc;
-    if (0 != (rc = pthread_mutex_lock(&queue->mutex))) {
-        if (EDEADLK == rc) {
-            panic("Message queue: deadlock!");
+    mbuf.msg.version = PROTOCOL_VERSION;
+
+    for (unsigned spins = 0; mqueue_enqueue(queue, &mbuf) == 0; spins++) {
+        switch (queue->policy) {
+            case MQ_DROP_OLDEST:
+                if (mqueue_drop(queue, -1)) continue;
+                break;
+            case MQ_COALESCE:
+                if (mqueue_drop(queue, mbuf.msg.type)) continue;
+                break;
+            default:
+                break;
+        }
+
+        // Back-pressure: let the consumer do its job
+        if (spins < 64) {
+            sched_yield();
+        } else {
+            usleep(1000);
         }
-        panic("[get] Message queue: failure during mutex locking");
     }
 
-    if (queue->size == 0) {
-        pthread_mutex_unlock(&queue->mutex);
-        return 0;
+    if (queue->notify != NULL) {
+        queue->notify(queue->notify_arg);
     }
+}
+
+/*
+ * Puts the message, which payload is owned by the queue from now on.
+ */
+void mqueue_put(mqueue_t *queue, mbuf_t mbuf) {
+    mbuf.shared = 0;
+    mqueue_push(queue, mbuf);
+}
+
+/*
+ * Puts the message with a shared payload (see mshared_alloc()). The queue
+ * takes its own reference, the caller keeps its one.
+ */
+void mqueue_put_shared(mqueue_t *queue, mbuf_t mbuf) {
+    mshared_head_t *head = (mshared_head_t *)mbuf.payload - 1;
 
-    *mbuf = queue->buf[queue->size--, queue->start_position++];
-    if (queue->start_position >= MQUEUE_SIZE) {
-        queue->start_position = 0;
+    __atomic_add_fetch(&head->refs, 1, __ATOMIC_RELAXED);
+    mbuf.shared = 1;
+    mqueue_push(queue, mbuf);
+}
+
+int mqueue_get(mqueue_t *queue, mbuf_t *mbuf) {
+    if (queue == NULL) {
+        panic("Trying to get from NULL mqueue!");
     }
 
-    pthread_mutex_unlock(&queue->mutex);
-    return 1;
+    return mqueue_dequeue(queue, mbuf, -1);
 }
 
+/*
+ * Frees the queue and all the pending payloads.
+ */
 void mqueue_destroy(mqueue_t *queue) {
-    pthread_mutex_destroy(&queue->mutex);
+    mbuf_t mbuf;
+
+    while (mqueue_dequeue(queue, &mbuf, -1)) {
+        mbuf_free(&mbuf);
+    }
+
+    free(queue->slots);
+    queue->slots = NULL;
 }
 
 /*
- * Writes mbuf with non-zero payload size into socket.
+ * Allocates a payload, which can be put into several queues at once with
+ * mqueue_put_shared(). It is freed when the last reference is released.
  *
- * mbuf   : buffer to send
- * socket : receiver
+ * size : payload size
  *
- * ret    : -1 on failure
-*/
-static int send_fat_mbuf( int socket, mbuf_t *mbuf) {
-    struct iovec parts[2];
-    parts[0].iov_base = (caddr_t)&mbuf->msg;
-    parts[0].iov_len = sizeof(mbuf->msg);
-    parts[1].iov_base = mbuf->payload;
-    parts[1].iov_len = mbuf->msg.size;
-    int rc = writev(socket, parts, 2);
+ * ret  : payload, referenced once by the caller
+ */
+void *mshared_alloc(size_t size) {
+    mshared_head_t *head;
 
-    free(mbuf->payload);
+    if ((head = (mshared_head_t *)malloc(sizeof(mshared_head_t) + size)) ==
+            NULL) {
+        panic("Error allocating shared payload!");
+    }
+    head->refs = 1;
 
-    return rc;
+    return head + 1;
+}
+
+void mshared_release(void *payload) {
+    mshared_head_t *head = (mshared_head_t *)payload - 1;
+
+    if (__atomic_sub_fetch(&head->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(head);
+    }
+}
+
+/*
+ * Frees the payload or releases it, if it is shared.
+ */
+void mbuf_free(mbuf_t *mbuf) {
+    if (mbuf->shared) {
+        mshared_release(mbuf->payload);
+    } else {
+        free(mbuf->payload);
+    }
+    mbuf->payload = NULL;
+}
+
+/*
+ * Serializes message header into its wire format.
+ *
+ * msg : header to encode
+ * buf : at least MSG_HEADER_SIZE bytes
+ */
+void msg_encode(const msg_t *msg, uint8_t *buf) {
+    uint32_t type = msg->type;
+    uint32_t version = (uint32_t)msg->version & 0xFFFF;
+
+    if (type > 0xFFFF || msg->size > UINT32_MAX) {
+        panicf("Message can't be encoded: type=%u size=%zu", type,
+                msg->size);
+    }
+
+    uint32_t size = msg->size;
+
+    buf[0] = type & 0xFF;
+    buf[1] = type >> 8;
+    buf[2] = version & 0xFF;
+    buf[3] = version >> 8;
+    buf[4] = size & 0xFF;
+    buf[5] = (size >> 8) & 0xFF;
+    buf[6] = (size >> 16) & 0xFF;
+    buf[7] = size >> 24;
+}
+
+/*
+ * Parses message header from its wire format.
+ *
+ * buf : MSG_HEADER_SIZE bytes
+ * msg : place to save the header
+ */
+void msg_decode(const uint8_t *buf, msg_t *msg) {
+    msg->type = (enum msg_type)(buf[0] | buf[1] << 8);
+    msg->version = buf[2] | buf[3] << 8;
+    msg->size = (uint32_t)buf[4] | (uint32_t)buf[5] << 8 |
+        (uint32_t)buf[6] << 16 | (uint32_t)buf[7] << 24;
 }
 
 /*
@@ -107,8 +307,17 @@ static int send_fat_mbuf( int socket, mbuf_t *mbuf) {
  * ret    : -1 on failure
 */
 int send_mbuf(int socket, mbuf_t *mbuf) {
-    if (mbuf->msg.size == 0) {
-        return write(socket, &mbuf->msg, sizeof(msg_t));
-    }
-    return send_fat_mbuf(socket, mbuf);
+    uint8_t header[MSG_HEADER_SIZE];
+    struct iovec parts[2];
+
+    msg_encode(&mbuf->msg, header);
+    parts[0].iov_base = (caddr_t)header;
+    parts[0].iov_len = MSG_HEADER_SIZE;
+    parts[1].iov_base = mbuf->payload;
+    parts[1].iov_len = mbuf->msg.size;
+    int rc = writev(socket, parts, mbuf->msg.size > 0 ? 2 : 1);
+
+    mbuf_free(mbuf);
+
+    return rc;
 }
@@ -2,17 +2,32 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stdint.h>
+
 #ifndef PROTOCOL_VERSION
 #define PROTOCOL_VERSION 0x2
 #endif /* PROTOCOL_VERSION */
 
+// Default capacity of message queue, must be power of two
 #define MQUEUE_SIZE 128
+#define MQUEUE_CACHE_LINE 64
+
+// Protocol version as it is sent on the wire
+#define PROTOCOL_VERSION_WIRE ((uint16_t)(PROTOCOL_VERSION & 0xFFFF))
+
+/*
+ * Size of encoded message header. On the wire every message starts with
+ * little-endian u16 type, u16 version and u32 payload size, no padding.
+ */
+#define MSG_HEADER_SIZE 8
 
 /*
  * Describes message, sent to client. Message has its *type* (s2c and c2s
  * stands as "server to client" and "client to server" message type). *version*
- * is protocol version (TODO: check it on message receive), and *size* is
- * payload size, used to point, how many bytes receiver shall read from socket.
+ * is protocol version, checked on message receive, and *size* is payload
+ * size, used to point, how many bytes receiver shall read from socket.
+ *
+ * This structure is never sent as is: see msg_encode() and msg_decode().
  */
 typedef struct msg {
     enum msg_type {
@@ -23,7 +38,8 @@ typedef struct msg {
         MSG_ERROR_NICKNAME,   // s2c incorrect nickname provided
 
         MSG_PUT_LEVEL,        // s2c level transmission
-        MSG_PUT_AREA,         // s2c area transmission
+        MSG_PUT_AREA,         // unused, area goes as MSG_PUT_AREA_DELTA
+        MSG_PUT_AREA_DELTA,   // s2c changed tiles of the area
 
         MSG_GET_CHAT,         // c2s chat history request
         MSG_NEW_CHAT,         // c2s chat new message
@@ -32,19 +48,17 @@ typedef struct msg {
         MSG_PUT_SYSMSG,       // s2c sysmsg history update
         MSG_SUBSCRIBE_SYSMSG, // c2s sysmsg subscription mask
 
-        MSG_PUT_PLAYERS,      // s2c players[color, y, x] transmission
-        MSG_PUT_PLAYERS_FULL, // s2c players[...] transmission
+        MSG_PUT_PLAYERS,      // s2c moved players positions
+        MSG_PUT_PLAYERS_FULL, // s2c players roster
+        MSG_PUT_PLAYER_SELF,  // s2c index of the receiver in players[]
         MSG_MOVE_PLAYER,      // c2s send player's move
+        MSG_CANCEL_ACTIONS,   // c2s drop player's pending moves
+        MSG_REPORT_VIEW,      // c2s part of the level shown, view_t
 
         MSG_PUT_STATUS,       // s2c player status update
     } type;
     int version;              // Protocol version, generated during compilation
     size_t size;              // Size of payload or zero if there is no payload
-
-    // TODO: *int* and *size_t* are types with architecture-dependent sizes.
-    // Shall we use them? I guess no. Message, sent from 64-bit machine can be
-    // incorrectly interpreted on 32-bit machine because of half-sized
-    // *size_t*.
 } msg_t;
 
 /*
@@ -60,25 +74,66 @@ enum msg_sysmsg_type {
     SM_CHAT_NEW_MESSAGE = 0x01,    // New message in chat
     SM_PLAYER_JOINED    = 0x02,    // New player joined to the ITMMORGUE
     SM_PLAYER_LEFT      = 0x03,    // Some player left the ITMMORGUE
+    SM_LEVEL_PROGRESS   = 0x04,    // Level generation progress
 };
 
 typedef struct mbuf {
     msg_t msg;
     void *payload;
+    uint8_t shared;           // *payload* is from mshared_alloc()
 } mbuf_t;
 
+/*
+ * What mqueue_put() does, when the queue is full.
+ */
+enum mqueue_policy {
+    MQ_BLOCK,           // Wait until consumer frees a slot
+    MQ_DROP_OLDEST,     // Drop the oldest pending message
+    MQ_COALESCE,        // Drop the oldest one if it has the same type as the
+                        // new one (it is superseded), wait otherwise
+    MQ_POLICY_SIZE
+};
+
+typedef struct mslot {
+    size_t seq;                     // Sequence number of the slot
+    mbuf_t mbuf;
+} mslot_t;
+
+/*
+ * Bounded lock-free multi-producer queue (D. Vyukov's algorithm). Any thread
+ * may put messages, the only consumer gets them. Producers dequeue too, but
+ * only to drop messages according to the policy.
+ *
+ * *head* and *tail* live in different cache lines to avoid false sharing
+ * between producers and consumer.
+ */
 typedef struct mqueue {
-    mbuf_t buf[MQUEUE_SIZE];
-    size_t start_position;
-    size_t size;
-    pthread_mutex_t mutex;
+    size_t head;                    // Next position to get
+    char head_pad[MQUEUE_CACHE_LINE - sizeof(size_t)];
+    size_t tail;                    // Next position to put
+    char tail_pad[MQUEUE_CACHE_LINE - sizeof(size_t)];
+    mslot_t *slots;                 // Ring itself
+    size_t mask;                    // Capacity - 1, capacity is power of two
+    enum mqueue_policy policy;      // Overflow policy
+    size_t dropped;                 // Number of messages dropped by policy
+    void (*notify)(void *arg);      // Called after every put, if not NULL
+    void *notify_arg;               // Argument for *notify*
 } mqueue_t;
 
 void mqueue_init(mqueue_t *queue);
+void mqueue_init_ext(mqueue_t *queue, size_t capacity,
+        enum mqueue_policy policy);
 int mqueue_get(mqueue_t *queue, mbuf_t *mbuf);
 void mqueue_put(mqueue_t *queue, mbuf_t mbuf);
+void mqueue_put_shared(mqueue_t *queue, mbuf_t mbuf);
 void mqueue_destroy(mqueue_t *queue);
 
+void *mshared_alloc(size_t size);
+void mshared_release(void *payload);
+void mbuf_free(mbuf_t *mbuf);
+
+void msg_encode(const msg_t *msg, uint8_t *buf);
+void msg_decode(const uint8_t *buf, msg_t *msg);
 int send_mbuf(int socket, mbuf_t *mbuf);
 
 #endif /* PROTOCOL_H */
@@ -0,0 +1,558 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+#include "server.h"
+#include "reactor.h"
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define REACTOR_EPOLL
+#else
+#include <poll.h>
+#endif /* __linux__ */
+
+static reactor_t *reactors;
+static size_t reactors_len;
+static size_t reactors_next;        // round-robin counter for new clients
+static int listen_fd = -1;
+
+// Special epoll(7) cookies for non-client descriptors
+#define R_WAKE   ((void *)&reactors_len)
+#define R_LISTEN ((void *)&listen_fd)
+
+static void reactor_wake(reactor_t *reactor) {
+    char c = 0;
+
+    // The pipe is non-blocking: if it is full, reactor is already woken up
+    if (write(reactor->wake[1], &c, 1) < 0 && errno != EAGAIN) {
+        panic("[S] Unable to wake up reactor!");
+    }
+}
+
+/*
+ * Puts connection into pending list of its reactor. Used both for freshly
+ * accepted connections and as mqueue_t notifier for the outgoing messages.
+ *
+ * connection : connection_t with something to do
+ */
+void reactor_notify(void *connection) {
+    connection_t *conn = (connection_t *)connection;
+    reactor_t *reactor = conn->reactor;
+
+    if (__sync_lock_test_and_set(&conn->pending, 1)) {
+        return; // Already in the list
+    }
+
+    pthread_mutex_lock(&reactor->pending_mutex);
+    int was_empty = reactor->pending == NULL;
+    conn->pending_next = reactor->pending;
+    reactor->pending = conn;
+    pthread_mutex_unlock(&reactor->pending_mutex);
+
+    if (was_empty) {
+        reactor_wake(reactor);
+    }
+}
+
+/*
+ * Updates the set of events the reactor is waiting for on the connection.
+ */
+static void reactor_want_write(connection_t *conn, uint8_t want) {
+    if (conn->want_write == want) {
+        return;
+    }
+    conn->want_write = want;
+
+#ifdef REACTOR_EPOLL
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    if (epoll_ctl(conn->reactor->pollfd, EPOLL_CTL_MOD, conn->socket,
+                &ev) < 0) {
+        panic("[S] Unable to modify epoll events!");
+    }
+#endif /* REACTOR_EPOLL */
+}
+
+static void reactor_register(reactor_t *reactor, connection_t *conn) {
+    int flags = fcntl(conn->socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(conn->socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+        panic("[S] Unable to make client socket non-blocking!");
+    }
+
+    // Small messages must not wait for delayed ACKs
+    int one = 1;
+    if (setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &one,
+                sizeof(one)) < 0) {
+        logger("[S] Unable to set TCP_NODELAY!");
+    }
+
+#ifdef REACTOR_EPOLL
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(reactor->pollfd, EPOLL_CTL_ADD, conn->socket, &ev) < 0) {
+        panic("[S] Unable to add client socket to epoll!");
+    }
+#endif /* REACTOR_EPOLL */
+
+    conn->registered = 1;
+    conn->r_prev = NULL;
+    conn->r_next = reactor->first;
+    if (reactor->first != NULL) {
+        reactor->first->r_prev = conn;
+    }
+    reactor->first = conn;
+    reactor->count++;
+}
+
+/*
+ * Forgets the connection and lets the server part clean it up.
+ */
+static void reactor_close(connection_t *conn) {
+    reactor_t *reactor = conn->reactor;
+
+    // Nobody will put this connection into pending list anymore
+    __sync_lock_test_and_set(&conn->pending, 1);
+
+    pthread_mutex_lock(&reactor->pending_mutex);
+    for (connection_t **curr = &reactor->pending; *curr;
+            curr = &(*curr)->pending_next) {
+        if (*curr == conn) {
+            *curr = conn->pending_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reactor->pending_mutex);
+
+#ifdef REACTOR_EPOLL
+    epoll_ctl(reactor->pollfd, EPOLL_CTL_DEL, conn->socket, NULL);
+#endif /* REACTOR_EPOLL */
+
+    if (conn->r_prev == NULL) {
+        reactor->first = conn->r_next;
+    } else {
+        conn->r_prev->r_next = conn->r_next;
+    }
+    if (conn->r_next != NULL) {
+        conn->r_next->r_prev = conn->r_prev;
+    }
+    reactor->count--;
+
+    if (conn->out_busy) {
+        mbuf_free(&conn->out_mbuf);
+    }
+    free(conn->in_payload);
+
+    s_connection_lost(conn);
+}
+
+/*
+ * Writes as much of the outgoing queue as the socket accepts.
+ *
+ * ret : -1 if connection is broken
+ */
+static int reactor_flush(connection_t *conn) {
+    for (;;) {
+        if (! conn->out_busy) {
+            if (mqueue_get(conn->mqueueptr, &conn->out_mbuf) <= 0) {
+                break;
+            }
+            conn->out_busy = 1;
+            conn->out_sent = 0;
+            msg_encode(&conn->out_mbuf.msg, conn->out_header);
+        }
+
+        mbuf_t *mbuf = &conn->out_mbuf;
+        size_t header = MSG_HEADER_SIZE;
+        size_t total = header + mbuf->msg.size;
+        struct iovec parts[2];
+        int count = 0;
+
+        if (conn->out_sent < header) {
+            parts[count].iov_base = conn->out_header + conn->out_sent;
+            parts[count++].iov_len = header - conn->out_sent;
+        }
+        if (mbuf->msg.size > 0) {
+            size_t off = conn->out_sent > header ? conn->out_sent - header : 0;
+            parts[count].iov_base = (char *)mbuf->payload + off;
+            parts[count++].iov_len = mbuf->msg.size - off;
+        }
+
+        ssize_t rc = writev(conn->socket, parts, count);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                reactor_want_write(conn, 1);
+                return 0;
+            }
+            loggerf("[S] Error writing to socket [%s]!", strerror(errno));
+            return -1;
+        }
+
+        conn->out_sent += rc;
+        if (conn->out_sent == total) {
+            mbuf_free(mbuf);
+            conn->out_busy = 0;
+        }
+    }
+
+    reactor_want_write(conn, 0);
+
+    return 0;
+}
+
+/*
+ * Reads everything available on the socket, dispatching complete messages.
+ *
+ * ret : -1 if connection is closed or broken
+ */
+static int reactor_read(connection_t *conn) {
+    for (;;) {
+        size_t header = MSG_HEADER_SIZE;
+        void *dst;
+        size_t want;
+
+        if (conn->in_got < header) {
+            dst = conn->in_header + conn->in_got;
+            want = header - conn->in_got;
+        } else {
+            dst = conn->in_payload + (conn->in_got - header);
+            want = conn->in_msg.size - (conn->in_got - header);
+        }
+
+        ssize_t rc = read(conn->socket, dst, want);
+        if (rc == 0) {
+            logger("[S] Client closed connection!");
+            return -1;
+        } else if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            loggerf("[S] Error reading from socket [%s]!", strerror(errno));
+            return -1;
+        }
+
+        conn->in_got += rc;
+
+        if (conn->in_got == header) {
+            msg_decode(conn->in_header, &conn->in_msg);
+
+            if (conn->in_msg.version != PROTOCOL_VERSION_WIRE) {
+                loggerf("[S] Protocol version mismatch: %d, expected %d!",
+                        conn->in_msg.version, PROTOCOL_VERSION_WIRE);
+                return -1;
+            }
+
+            // Size comes from the client, it is not trusted
+            if (conn->in_msg.size > (size_t)CONF_IVAL(
+                        CF_SERVER_MSG_MAXSIZE)) {
+                loggerf("[S] Message of %zu bytes is too big!",
+                        conn->in_msg.size);
+                return -1;
+            }
+
+            if (conn->in_msg.size > 0 && (conn->in_payload =
+                        malloc(conn->in_msg.size)) == NULL) {
+                panic("Unable to allocate buffer for payload!");
+            }
+        }
+
+        if (conn->in_got < header ||
+                conn->in_got < header + conn->in_msg.size) {
+            continue;
+        }
+
+        // The whole message is here
+        mbuf_t mbuf;
+        mbuf.msg = conn->in_msg;
+        mbuf.payload = conn->in_payload;
+        conn->in_payload = NULL;
+        conn->in_got = 0;
+
+        rc = s_process_mbuf(conn, &mbuf);
+        free(mbuf.payload);
+
+        if (rc < 0) {
+            return -1;
+        }
+    }
+}
+
+static void reactor_accept(reactor_t *self) {
+    struct sockaddr_in client;
+    socklen_t client_len;
+    int cs;
+
+    for (;;) {
+        client_len = sizeof(client); // for Solaris
+        if ((cs = accept(listen_fd, (struct sockaddr *)&client,
+                        &client_len)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            panic("[S] Unable to accept new connection!");
+        }
+
+        reactor_t *reactor = reactors + reactors_next++ % reactors_len;
+
+        connection_t *conn;
+        if ((conn = s_connection_open(cs, &client, client_len,
+                        reactor)) == NULL) {
+            continue;
+        }
+
+        if (reactor == self) {
+            reactor_register(self, conn);
+        } else {
+            reactor_notify(conn);
+        }
+    }
+}
+
+/*
+ * Handles new connections and queued output of the connections.
+ */
+static void reactor_pending(reactor_t *reactor) {
+    char drain[64];
+    while (read(reactor->wake[0], drain, sizeof(drain)) > 0);
+
+    pthread_mutex_lock(&reactor->pending_mutex);
+    connection_t *list = reactor->pending;
+    reactor->pending = NULL;
+    pthread_mutex_unlock(&reactor->pending_mutex);
+
+    while (list != NULL) {
+        connection_t *conn = list;
+        list = list->pending_next;
+
+        // Notifications after this point will bring it back to the list
+        __sync_lock_release(&conn->pending);
+
+        if (! conn->registered) {
+            reactor_register(reactor, conn);
+        }
+
+        if (reactor_flush(conn) < 0) {
+            reactor_close(conn);
+        }
+    }
+}
+
+/*
+ * Handles readiness of the client socket.
+ */
+static void reactor_client(connection_t *conn, int readable, int writable,
+        int broken) {
+    if (writable && reactor_flush(conn) < 0) {
+        reactor_close(conn);
+        return;
+    }
+
+    if ((readable || broken) && reactor_read(conn) < 0) {
+        reactor_close(conn);
+    }
+}
+
+#ifdef REACTOR_EPOLL
+static void reactor_poll(reactor_t *reactor) {
+    struct epoll_event events[REACTOR_EVENTS_MAX];
+    int rc;
+
+    do {
+        rc = epoll_wait(reactor->pollfd, events, REACTOR_EVENTS_MAX, -1);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        panic("[S] epoll_wait() failed!");
+    }
+
+    // Pending list may close any connection, so it is handled the last
+    int wake = 0;
+    for (int i = 0; i < rc; i++) {
+        void *ptr = events[i].data.ptr;
+
+        if (ptr == R_WAKE) {
+            wake = 1;
+        } else if (ptr == R_LISTEN) {
+            reactor_accept(reactor);
+        } else {
+            // Client handlers close nothing but the current connection
+            reactor_client((connection_t *)ptr,
+                    events[i].events & EPOLLIN,
+                    events[i].events & EPOLLOUT,
+                    events[i].events & (EPOLLERR | EPOLLHUP));
+        }
+    }
+
+    if (wake) {
+        reactor_pending(reactor);
+    }
+}
+#else
+/*
+ * Portable poll(2) fallback: pollfd set is rebuilt on every iteration.
+ */
+static void reactor_poll(reactor_t *reactor) {
+    size_t len = reactor->count + 2;
+    struct pollfd *fds;
+    connection_t **conns;
+    int rc;
+
+    if ((fds = (struct pollfd *)malloc(sizeof(struct pollfd) * len)) ==
+            NULL || (conns = (connection_t **)malloc(
+                    sizeof(connection_t *) * len)) == NULL) {
+        panic("[S] Unable to allocate pollfd set!");
+    }
+
+    size_t n = 0;
+    fds[n].fd = reactor->wake[0];
+    fds[n].events = POLLIN;
+    conns[n++] = NULL;
+    if (reactor->id == 0) {
+        fds[n].fd = listen_fd;
+        fds[n].events = POLLIN;
+        conns[n++] = NULL;
+    }
+    for (connection_t *curr = reactor->first; curr; curr = curr->r_next) {
+        fds[n].fd = curr->socket;
+        fds[n].events = POLLIN | (curr->want_write ? POLLOUT : 0);
+        conns[n++] = curr;
+    }
+
+    do {
+        rc = poll(fds, n, -1);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        panic("[S] poll() failed!");
+    }
+
+    // Clients first: closing them never touches the rest of the set
+    for (size_t i = reactor->id == 0 ? 2 : 1; i < n; i++) {
+        if (fds[i].revents == 0) continue;
+        reactor_client(conns[i],
+                fds[i].revents & POLLIN,
+                fds[i].revents & POLLOUT,
+                fds[i].revents & (POLLERR | POLLHUP));
+    }
+    if (reactor->id == 0 && fds[1].revents) {
+        reactor_accept(reactor);
+    }
+    if (fds[0].revents) {
+        reactor_pending(reactor);
+    }
+
+    free(conns);
+    free(fds);
+}
+#endif /* REACTOR_EPOLL */
+
+static void* reactor_loop(void *args) {
+    reactor_t *reactor = (reactor_t *)args;
+
+    for (;;) {
+        reactor_poll(reactor);
+    }
+
+    return NULL;
+}
+
+static void reactor_init(reactor_t *reactor, int id) {
+    reactor->id = id;
+    reactor->pending = NULL;
+    reactor->first = NULL;
+    reactor->count = 0;
+
+    if (pthread_mutex_init(&reactor->pending_mutex, NULL) != 0) {
+        panic("[S] Unable to initialize reactor mutex!");
+    }
+
+    if (pipe(reactor->wake) < 0) {
+        panic("[S] Unable to create reactor wake pipe!");
+    }
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(reactor->wake[i], F_GETFL, 0);
+        if (flags < 0 || fcntl(reactor->wake[i], F_SETFL,
+                    flags | O_NONBLOCK) < 0) {
+            panic("[S] Unable to make reactor pipe non-blocking!");
+        }
+    }
+
+#ifdef REACTOR_EPOLL
+    struct epoll_event ev;
+
+    if ((reactor->pollfd = epoll_create(REACTOR_EVENTS_MAX)) < 0) {
+        panic("[S] Unable to create epoll instance!");
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = R_WAKE;
+    if (epoll_ctl(reactor->pollfd, EPOLL_CTL_ADD, reactor->wake[0],
+                &ev) < 0) {
+        panic("[S] Unable to add wake pipe to epoll!");
+    }
+
+    if (id == 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = R_LISTEN;
+        if (epoll_ctl(reactor->pollfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+            panic("[S] Unable to add server socket to epoll!");
+        }
+    }
+#else
+    reactor->pollfd = -1;
+#endif /* REACTOR_EPOLL */
+}
+
+/*
+ * Creates "server_workers" reactors and turns the calling thread into the
+ * first one. Never returns.
+ *
+ * listen_socket : bound and listening server socket
+ */
+void reactor_start(int listen_socket) {
+    int workers = CONF_IVAL(CF_SERVER_WORKERS);
+
+    if (workers < 1 || workers > REACTOR_WORKERS_MAX) {
+        panicf("Invalid server_workers: %d!", workers);
+    }
+
+    // Writes into closed sockets should fail with EPIPE instead
+    struct sigaction sa_pipe;
+    memset(&sa_pipe, 0, sizeof(sa_pipe));
+    sa_pipe.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa_pipe, NULL);
+
+    listen_fd = listen_socket;
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        panic("[S] Unable to make server socket non-blocking!");
+    }
+
+    if ((reactors = (reactor_t *)malloc(sizeof(reactor_t) * workers)) ==
+            NULL) {
+        panic("[S] Unable to allocate reactors!");
+    }
+    reactors_len = workers;
+
+    for (int i = 0; i < workers; i++) {
+        reactor_init(reactors + i, i);
+    }
+
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&reactors[i].thread, NULL, &reactor_loop,
+                    reactors + i) != 0) {
+            panic("[S] Error creating reactor thread!");
+        }
+    }
+
+    loggerf("[S] Started %d reactor(s)", workers);
+
+    reactor_loop(reactors);
+}
@@ -0,0 +1,31 @@
+// vim: sw=4 ts=4 et :
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "itmmorgue.h"
+
+// Maximum number of reactor threads (see "server_workers" option)
+#define REACTOR_WORKERS_MAX 64
+// Maximum number of events handled by a single poll iteration
+#define REACTOR_EVENTS_MAX 256
+
+/*
+ * Event-driven owner of client sockets. Every reactor runs in its own thread
+ * and multiplexes all the connections assigned to it. The first reactor also
+ * owns the listening socket and spreads new connections over the others.
+ */
+typedef struct reactor {
+    pthread_t thread;               // Worker thread (unused for reactor 0)
+    int id;                         // Number of reactor
+    int pollfd;                     // epoll(7) descriptor, Linux only
+    int wake[2];                    // Self-pipe to interrupt polling
+    pthread_mutex_t pending_mutex;  // Protects *pending*
+    connection_t *pending;          // New connections or ones with output
+    connection_t *first;            // Connections owned by the reactor
+    size_t count;                   // Number of owned connections
+} reactor_t;
+
+void reactor_start(int listen_socket);
+void reactor_notify(void *connection);
+
+#endif /* REACTOR_H */
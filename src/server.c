@@ -3,49 +3,91 @@
 
 connection_t *first_connection;
 connection_t *last_connection;
+// Connection list is read by broadcasts from any thread
+static pthread_rwlock_t connections_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 // TODO get rid of this shit
 char start = 0;
 
-void player_connected_off(size_t id) {
-    if (start) {
-        players[id].connected = 0;
-        players[id].color ^= L_BLACK;
-        if (players_total > 0) players_total--;
-    } else {
-        // TODO remove player[id]
-    }
+// Serializes the start, see s_start()
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Chat history is shared by the reactors
+static pthread_mutex_t schat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void player_connected_off(connection_t *connection) {
+    size_t id = connection->player_id;
+    char nickname[PLAYER_NAME_MAXLEN], join_msg[PLAYER_NAME_MAXLEN * 4];
+    sprintf(join_msg,
+            "Player %s has fallen out of the world!\n",
+            player_nickname(id, nickname));
 
-    if (players_total == 0 && start) {
+    if (! start) {
+        // Nobody waits for the player in the lobby
+        player_free(id);
+    } else if (player_disconnect(id) == 0) {
         // TODO make smth else (?)
         logger("[S] No players left in. Server terminated successfully!");
+        s_levels_save();
         exit(EXIT_SUCCESS);
+    } else {
+        // The turn may wait only for this player
+        event_sync();
     }
 
-    char join_msg[PLAYER_NAME_MAXLEN * 4];
-    sprintf(join_msg,
-            "Player %s has fallen out of the world!\n",
-            players[id].nickname);
-    for (size_t i = 0; i < players_len; i++) {
-        if (! players[i].connected) continue;
+    s_broadcast_sysmsg(connection, SM_PLAYER_LEFT, join_msg);
+    s_broadcast_players_full();
+}
 
-        send_sysmsg(players[i].connection, SM_PLAYER_LEFT, join_msg);
-        s_send_players_full(players + i);
-    }
+/*
+ * Saves the world and exits on SIGTERM or SIGINT, reloads the config on
+ * SIGHUP. Other threads have these signals blocked.
+ */
+static void* s_signals(void *arg) {
+    sigset_t *sigset = (sigset_t *)arg;
+    int signum;
+
+    do {
+        if (sigwait(sigset, &signum) != 0) {
+            panic("Error waiting for signals!");
+        }
+        if (signum == SIGHUP) {
+            logger("[S] Received SIGHUP, reloading the config");
+            config_reload();
+        }
+    } while (signum == SIGHUP);
+
+    loggerf("[S] Received signal %d, saving the world", signum);
+    s_levels_save();
+    exit(EXIT_SUCCESS);
+
+    return NULL;
 }
 
 void server() {
-    int s, rc, cs, one = 1;
+    int s, rc, one = 1;
     struct sockaddr_in addr;
-    struct sockaddr_in client;
-    socklen_t client_len = sizeof(client);
+    static sigset_t sigset;
+    pthread_t signals;
 
     if (server_started != 0) {
         panic("Server is already running!");
     }
 
-    // TODO do this asynchronously
-    s_levels_init();
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL) != 0 ||
+            pthread_create(&signals, NULL, &s_signals, &sigset) != 0) {
+        panic("Unable to start signal handling thread!");
+    }
+    pthread_detach(signals);
+
+    config_watch();
+
+    // Levels are generated while the lobby is running
+    s_levels_start();
     // Start event loop thread
     event_init();
 
@@ -76,363 +118,329 @@ void server() {
      * Here we define some stuff for common client-size submodules like chat.
      */
 
-    if ((schat = malloc(2)) == NULL) {
+    if ((schat = (history_t *)malloc(sizeof(history_t))) == NULL) {
         panic("Unable to allocate server chat buffer!");
     }
-    schat[0] = '\0';
+    history_init(schat, CHAT_MSG_BACKLOG);
 
-    // TODO implement workers
-    while (usleep(1000) == 0) {
-        /* Waiting for new players */
-        if ((cs = accept(s, (struct sockaddr *)&client, &client_len)) < 0) {
-            break;
-        }
-        if (start) { /* Handle connections after !start */
-            if (players_len == players_total) { /* Nobody left */
-                // TODO Send graceful disconnect to client
-                write(cs, ".", 1);
-                usleep(100000);
-                close(cs);
-                continue;
-            } else {
-                start = 3;
-            }
-        }
-        connection_t *connection;
-        if (NULL == (connection =
-                    (connection_t*)malloc(sizeof(connection_t)))) {
-            panic("Cannot allocate memory for client connection!");
-        }
-        connection->curr_client = client;
-        connection->curr_client_len = client_len;
-        connection->socket = cs;
-        pthread_mutex_init(&connection->socket_mutex, NULL);
-        connection->sysmsg_mask = ~0;
-        if (NULL == (connection->mqueueptr =
-                    (mqueue_t*)malloc(sizeof(mqueue_t)))) {
-            panic("Cannot allocate memory for client message queue!");
-        }
-        connection->next = NULL;
-
-        if (NULL == first_connection) {
-            first_connection = last_connection = connection;
-            connection->prev = NULL;
-        } else {
-            connection->prev = last_connection;
-            last_connection->next = connection;
-            last_connection = connection;
-        }
-
-        client_len = sizeof(client); // for Solaris
-
-        if (pthread_create(&connection->thread, NULL,
-                    (void*(*)(void*))&process_client,
-                    connection) != 0) {
-            panic("Error creating processor thread!");
-        }
-    }
+    // Serve all the clients from the event-driven reactor(s)
+    reactor_start(s);
 
     panic("Server exited abnormally");
 }
 
-void* process_client(connection_t *connection) {
-    int cs = connection->socket;
-    int rc;
-
-    if (pthread_detach(pthread_self()) != 0) {
-        panic("Error detaching processor pthread!");
+/*
+ * Creates connection for the accepted socket and its player.
+ *
+ * cs         : accepted client socket
+ * client     : client address
+ * client_len : size of *client*
+ * reactor    : reactor which will own the connection
+ *
+ * ret        : new connection or NULL if the client was rejected
+ */
+connection_t *s_connection_open(int cs, struct sockaddr_in *client,
+        socklen_t client_len, reactor_t *reactor) {
+    if (start) { /* Handle connections after !start */
+        if (players_away() == 0) { /* Nobody left */
+            // TODO Send graceful disconnect to client
+            write(cs, ".", 1);
+            close(cs);
+            return NULL;
+        } else {
+            start = 3;
+        }
     }
 
     /*
      * TODO move this section under obtaining color + nickname (really?)
-     * s_send_players() requires this id.
+     * s_send_player_self() requires this id.
      * The best solution is to fill this values here and change them
      * after reception of the actual ones.
      */
-    size_t id = player_init(L_YELLOW, "bsi", connection);
-    players[id].connected = 1;
-
-    mqueue_t *s2c_queue = connection->mqueueptr;
-    mqueue_init(s2c_queue);
-
-    struct timeval timeout;
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 50000;
-
-    int client_connected = 1;
-
-    do {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(cs, &fds);
-        mbuf_t mbuf;
-
-        /* Handle start state (see server.h) */
-        if (start == 1 || (start > 0 && players[id].start == 1)) {
-            // TODO make some of this periodically (at the end of every tick)
-            s_level_send(0, players + id);
-            s_area_send(0, players + id);
-            s_send_players_full(players + id);
-
-            players[id].start = 0;
-            start = 2;
-        }
-
-        // send messages to the client if any
-        while (mqueue_get(s2c_queue, &mbuf) > 0) {
-            if (1 == send_mbuf(cs, &mbuf)) {
-                panic("Error sending message in server thread!");
-            }
-        }
-
-        do {
-            rc = select(cs + 1, &fds, NULL, NULL, &timeout);
-        } while (rc < 0 && errno == EINTR);
-
-        if (rc < 0) {
-            client_connected = 0;
-            /* TODO make something graceful, wait for they */
-            panic("client disconnected!");
-            break;
-        } else if (rc == 0) {
-            continue;
-        }
+    size_t id = player_init(L_YELLOW, "bsi", NULL);
+    if (id == MAX_PLAYERS) {
+        logger("[S] No free player slots, connection rejected");
+        write(cs, ".", 1);
+        close(cs);
+        return NULL;
+    }
 
-        logger("[S] waiting mbuf");
-
-        if ((rc = synchronized_readall(&connection->socket_mutex, cs,
-                        &mbuf.msg, sizeof(mbuf.msg))) == 0) {
-            logger("[S] Client closed connection!");
-            player_connected_off(id);
-            close_connection(connection);
-            pthread_exit(NULL);
-        } else if (rc < 0) {
-            loggerf("[S] Error reading from socket [%d][%s]!",
-                    rc, strerror(errno));
-            player_connected_off(id);
-            close_connection(connection);
-            pthread_exit(NULL);
-        }
+    connection_t *connection;
+    if (NULL == (connection =
+                (connection_t*)calloc(1, sizeof(connection_t)))) {
+        panic("Cannot allocate memory for client connection!");
+    }
+    connection->curr_client = *client;
+    connection->curr_client_len = client_len;
+    connection->socket = cs;
+    connection->sysmsg_mask = ~0;
+    connection->reactor = reactor;
+    if (NULL == (connection->mqueueptr =
+                (mqueue_t*)malloc(sizeof(mqueue_t)))) {
+        panic("Cannot allocate memory for client message queue!");
+    }
+    // Queues are filled by the reactor, which drains them itself, and by
+    // broadcasts under players_mutex, which the reactor takes too: a put
+    // that waits for a free slot may deadlock the server
+    mqueue_init_ext(connection->mqueueptr, CONF_IVAL(CF_SERVER_MQUEUE_SIZE),
+            MQ_DROP_OLDEST);
+    connection->mqueueptr->notify = reactor_notify;
+    connection->mqueueptr->notify_arg = connection;
+
+    connection->player_id = id;
+    connection->player_generation = player_handle(id).generation;
+    player_connect(id, connection);
+
+    pthread_rwlock_wrlock(&connections_lock);
+    connection->next = NULL;
+    if (NULL == first_connection) {
+        first_connection = last_connection = connection;
+        connection->prev = NULL;
+    } else {
+        connection->prev = last_connection;
+        last_connection->next = connection;
+        last_connection = connection;
+    }
+    pthread_rwlock_unlock(&connections_lock);
 
-        // rc > 0
-        switch (mbuf.msg.type) {
-            case MSG_NEW_CHAT:
-                logger("[S] [NEW_CHAT]");
-                break;
-            case MSG_GET_CHAT:
-                logger("[S] [GET_CHAT]");
-                break;
-            case MSG_REPORT_NICKNAME:
-                logger("[S] [REPORT_NICKNAME]");
-                break;
-            case MSG_MOVE_PLAYER:
-                logger("[S] [MOVE_PLAYER]");
-                break;
-            default:
-                warnf("Unknown type: %d", mbuf.msg.type);
-                logger("[S] [UNKNOWN]");
-                continue;
-        }
+    return connection;
+}
 
-        char *payload;
-        mbuf_t s2c_mbuf;
-        size_t size;
+/*
+ * Called by reactor when the connection is closed or broken.
+ */
+void s_connection_lost(connection_t *connection) {
+    if (player_by_connection(connection) != NULL) {
+        player_connected_off(connection);
+    }
+    close_connection(connection);
+}
 
-        if (mbuf.msg.size > 0) {
-            payload = malloc(mbuf.msg.size);
+/*
+ * Starts the game when everybody is ready and the levels are generated.
+ * Reactors call it on messages before the start and the level generation
+ * thread when it is done, so the last of them starts the game.
+ */
+void s_start() {
+    pthread_mutex_lock(&start_mutex);
 
-            if (payload == NULL) {
-                panic("Unable to allocate buffer for payload!");
-            }
+    if (! start && s_levels_ready() && players_start()) {
+        start = 1;
+        // The world is sent by the event loop
+        event_sync();
+    }
 
-            if (synchronized_readall(&connection->socket_mutex, cs, payload,
-                        mbuf.msg.size) != (ssize_t)mbuf.msg.size) {
-                logger("[S] Error reading payload");
-            }
+    pthread_mutex_unlock(&start_mutex);
+}
 
-            loggerf("[S] Received buf: [%s]", payload);
-        }
+/*
+ * Handles single message received from the client.
+ *
+ * connection : message source
+ * mbuf       : message with payload (owned by caller)
+ *
+ * ret        : -1 if the connection should be closed
+ */
+int s_process_mbuf(connection_t *connection, mbuf_t *mbuf_in) {
+    size_t id = connection->player_id;
+    if (player_by_connection(connection) == NULL) {
+        logger("[S] Message from a freed player");
+        return -1;
+    }
+    mqueue_t *s2c_queue = connection->mqueueptr;
+    mbuf_t mbuf = *mbuf_in;
 
-        // Even not started messages routine
-        switch (mbuf.msg.type) {
-            // TODO MSG_REPORT_COLOR
-            case MSG_REPORT_NICKNAME:
-                if (mbuf.msg.size >= PLAYER_NAME_MAXLEN + 1) {
-                    logger("[S] Long nickname received");
-                    s2c_mbuf.msg.type = MSG_ERROR_NICKNAME;
-                    s2c_mbuf.msg.size = strlen("Nickname is too long") + 1;
-                    if (NULL == (s2c_mbuf.payload =
-                                (char*)malloc(s2c_mbuf.msg.size))) {
-                        panic("[S] Cannot allocate ERRROR_NICKNAME payload!");
-                    }
-                    strcpy(s2c_mbuf.payload, "Nickname is too long");
-                    mqueue_put(s2c_queue, s2c_mbuf);
+    switch (mbuf.msg.type) {
+        case MSG_NEW_CHAT:
+            logger("[S] [NEW_CHAT]");
+            break;
+        case MSG_GET_CHAT:
+            logger("[S] [GET_CHAT]");
+            break;
+        case MSG_REPORT_NICKNAME:
+            logger("[S] [REPORT_NICKNAME]");
+            break;
+        case MSG_MOVE_PLAYER:
+            logger("[S] [MOVE_PLAYER]");
+            break;
+        case MSG_CANCEL_ACTIONS:
+            logger("[S] [CANCEL_ACTIONS]");
+            break;
+        case MSG_REPORT_VIEW:
+            logger("[S] [REPORT_VIEW]");
+            break;
+        default:
+            warnf("Unknown type: %d", mbuf.msg.type);
+            logger("[S] [UNKNOWN]");
+            return 0;
+    }
 
-                    player_connected_off(id);
-                    close_connection(connection);
-                    pthread_exit(NULL);
-                }
-                /* Get the color */
-                unsigned char color = ((char *)payload++)[0];
-                players[id].color = color - '0';
-                /* Handle reconnects */
-                for (size_t i = 0; start == 3 && i < players_len; i++) {
-                    if (players[i].connected) continue;
-                    if (strcmp(players[i].nickname, payload) != 0) continue;
-
-                    // Resurrect necessary fields of old player
-                    players[i].connection = players[id].connection;
-                    players[i].connected = 1;
-                    players[i].color ^= L_BLACK;
-
-                    // TODO eliminate races (safely remove players[id])
-                    memset(players[id].nickname, 0, PLAYER_NAME_MAXLEN);
-                    players_len--;
-                    players_total = players_len;
-
-                    // Finally replace the id's
-                    id = i;
-                    players[id].start = 1;
-                }
-                strncpy(players[id].nickname, payload, mbuf.msg.size);
-
-                char join_msg[PLAYER_NAME_MAXLEN * 4];
-                sprintf(join_msg,
-                        "Player %s has found his place in the world!\n",
-                        players[id].nickname);
-                for (connection_t *curr = first_connection; curr;
-                        curr = curr->next) {
-                    send_sysmsg(curr, SM_PLAYER_JOINED, join_msg);
-                }
+    char *payload = (char *)mbuf.payload;
+    char nickname[PLAYER_NAME_MAXLEN];
+    mbuf_t s2c_mbuf;
+    size_t size;
 
-                for (size_t i = 0; i < players_len; i++) {
-                    s_send_players_full(players + i);
-                }
-                break;
-            case MSG_GET_CHAT:
-                size = strlen(schat) + 1;
+    if (mbuf.msg.size > 0) {
+        loggerf("[S] Received buf: [%.*s]", (int)mbuf.msg.size, payload);
+    }
 
-                if ((s2c_mbuf.payload = malloc(size)) == NULL) {
-                    panic("Error allocating payload buffer!");
+    // Even not started messages routine
+    switch (mbuf.msg.type) {
+        // TODO MSG_REPORT_COLOR
+        case MSG_REPORT_NICKNAME:
+            if (mbuf.msg.size >= PLAYER_NAME_MAXLEN + 1) {
+                logger("[S] Long nickname received");
+                s2c_mbuf.msg.type = MSG_ERROR_NICKNAME;
+                s2c_mbuf.msg.size = strlen("Nickname is too long") + 1;
+                if (NULL == (s2c_mbuf.payload =
+                            (char*)malloc(s2c_mbuf.msg.size))) {
+                    panic("[S] Cannot allocate ERRROR_NICKNAME payload!");
                 }
-                s2c_mbuf.msg.type = MSG_PUT_CHAT;
-                s2c_mbuf.msg.size = size;
-                memcpy(s2c_mbuf.payload, schat, size);
-
-                loggerf("[S] Sending PUT: [%s] size=%zu", schat, size);
+                strcpy(s2c_mbuf.payload, "Nickname is too long");
                 mqueue_put(s2c_queue, s2c_mbuf);
 
-                break;
-            case MSG_NEW_CHAT:
-                if (!start && (
-                            strstr(payload, "!start\n") != NULL ||
-                            strstr(payload, "!s\n") != NULL
-                            )) {
-                    players[id].ready = 1;
-
-                    for (size_t i = 0; i < players_len; i++) {
-                        s_send_players_full(players + i);
-                    }
-                    break;
-                }
-                s_chat_add(&schat, payload);
-                size = strlen(payload) + 1;
+                return -1;
+            }
+            /* Get the color */
+            unsigned char color = (payload++)[0];
+            player_recolor(id, color - '0');
+            /* Handle reconnects */
+            size_t old = start == 3 ? player_reconnect(payload, connection) :
+                MAX_PLAYERS;
+            if (old != MAX_PLAYERS) {
+                // The old player has taken over the connection
+                player_free(id);
+
+                id = old;
+                event_sync();
+            } else {
+                player_rename(id, payload);
+            }
 
-                s2c_mbuf.msg.type = MSG_PUT_CHAT;
-                s2c_mbuf.msg.size = size;
+            char join_msg[PLAYER_NAME_MAXLEN * 4];
+            sprintf(join_msg,
+                    "Player %s has found his place in the world!\n",
+                    player_nickname(id, nickname));
+            s_broadcast_sysmsg(NULL, SM_PLAYER_JOINED, join_msg);
 
-                for (connection_t *curr = first_connection; curr;
-                        curr = curr->next) {
-                    // will be freed during mqueue_get()
-                    if ((s2c_mbuf.payload = malloc(size)) == NULL) {
-                        panic("Error allocating payload buffer!");
-                    }
-                    memcpy(s2c_mbuf.payload, payload, size);
+            s_broadcast_players_full();
+            break;
+        case MSG_REPORT_VIEW:
+            if (mbuf.msg.size != sizeof(view_t)) {
+                logger("[S] Broken view received");
+                return -1;
+            }
+            // Area follows on the next sync
+            s_send_players_view(players + id, (view_t *)payload);
+            event_sync();
+            break;
+        case MSG_GET_CHAT: {
+            uint64_t offset = 0;
+            uint32_t limit = CHAT_MSG_BACKLOG;
 
-                    mqueue_put(curr->mqueueptr, s2c_mbuf);
+            if (mbuf.msg.size >= CHAT_GET_SIZE) {
+                memcpy(&offset, payload, sizeof(uint64_t));
+                memcpy(&limit, payload + sizeof(uint64_t), sizeof(uint32_t));
+            }
 
-                    send_sysmsg(curr, SM_CHAT_NEW_MESSAGE,
-                            "New message in your chat!\n");
-                }
+            char *records;
+            pthread_mutex_lock(&schat_mutex);
+            size = history_encode(schat, offset, limit, &records);
+            pthread_mutex_unlock(&schat_mutex);
+            s2c_mbuf.payload = records;
+            s2c_mbuf.msg.type = MSG_PUT_CHAT;
+            s2c_mbuf.msg.size = size;
 
-                free(payload);
+            loggerf("[S] Sending PUT_CHAT: offset=%llu limit=%u size=%zu",
+                    (unsigned long long)offset, limit, size);
+            mqueue_put(s2c_queue, s2c_mbuf);
 
-                break;
-            default: // Will be parsed later, if (start)
-                break;
+            break;
         }
-
-        if (! start) {
-            size_t wait = players_len;
-
-            for (size_t i = 0; i < players_len; i++) {
-                if (players[i].ready) {
-                    wait--;
-                }
+        case MSG_NEW_CHAT:
+            if (!start && (
+                        strstr(payload, "!start\n") != NULL ||
+                        strstr(payload, "!s\n") != NULL
+                        )) {
+                player_ready(id);
+
+                s_broadcast_players_full();
+                break;
             }
+            // The new message is encoded once for all the clients
+            pthread_mutex_lock(&schat_mutex);
+            history_record_t *record = s_chat_add(schat, id, payload,
+                    mbuf.msg.size);
+            size = history_record_encode(record, NULL);
+            s2c_mbuf.payload = (char *)mshared_alloc(size);
+            history_record_encode(record, s2c_mbuf.payload);
+            pthread_mutex_unlock(&schat_mutex);
+
+            s2c_mbuf.msg.type = MSG_PUT_CHAT;
+            s2c_mbuf.msg.size = size;
+            s_broadcast_shared(NULL, s2c_mbuf);
+            mshared_release(s2c_mbuf.payload);
+
+            s_broadcast_sysmsg(NULL, SM_CHAT_NEW_MESSAGE,
+                    "New message in your chat!\n");
 
-            if (! wait) {
-                start = 1;
-                for (size_t i = 0; i < players_len; i++) {
-                    players[i].start = 1;
-                }
-                players_total = players_len;
-            }
+            break;
+        default: // Will be parsed later, if (start)
+            break;
+    }
 
-            continue;
-        }
+    if (! start) {
+        s_start();
+        return 0;
+    }
 
-        if (players_len != players_total) { /* Skip any in-game actions */
-            continue;
-        }
+    if (players_away() != 0) { /* Skip any in-game actions */
+        return 0;
+    }
 
-        // Normal messages routine
-        // TODO do smth with message
-
-        // If MSG_MOVE_PLAYER
-        player_move_t *move;
-
-        switch (mbuf.msg.type) {
-            case MSG_MOVE_PLAYER:
-                switch ((enum keyboard) *payload) {
-                    case K_MOVE_LEFT:
-                    case K_MOVE_RIGHT:
-                    case K_MOVE_UP:
-                    case K_MOVE_DOWN:
-                    case K_MOVE_LEFT_UP:
-                    case K_MOVE_RIGHT_UP:
-                    case K_MOVE_LEFT_DOWN:
-                    case K_MOVE_RIGHT_DOWN:
-                        // Will be freed during event handle
-                        if ((move = (player_move_t *)malloc(
-                                        sizeof(player_move_t))) == NULL) {
-                            panic("[S] Error allocating player_move_t!");
-                        }
-                        move->player_id = id;
-                        move->direction = (enum keyboard) *payload;
-                        event_player_add(id, EV_MOVE, move);
-                        break;
-                    default:
-                        panic("[S] invalid move received!");
-                }
-                break;
-            case MSG_GET_CHAT: /* Already handled */
-                break;
-            case MSG_NEW_CHAT:
-                break;
-            case MSG_REPORT_NICKNAME:
-                break;
-            default:
-                warnf("Unknown type: %d", mbuf.msg.type);
-                logger("[S] [UNKNOWN]");
-                continue;
-        }
-    } while (client_connected == 1);
+    // Normal messages routine
+    // TODO do smth with message
+
+    switch (mbuf.msg.type) {
+        case MSG_MOVE_PLAYER:
+            switch ((enum keyboard) *payload) {
+                case K_MOVE_LEFT:
+                case K_MOVE_RIGHT:
+                case K_MOVE_UP:
+                case K_MOVE_DOWN:
+                case K_MOVE_LEFT_UP:
+                case K_MOVE_RIGHT_UP:
+                case K_MOVE_LEFT_DOWN:
+                case K_MOVE_RIGHT_DOWN:
+                    if (event_player_add(id, EV_MOVE,
+                                (enum keyboard) *payload) < 0) {
+                        loggerf("[S] Actions queue of %s is full",
+                                player_nickname(id, nickname));
+                    }
+                    break;
+                default:
+                    panic("[S] invalid move received!");
+            }
+            break;
+        case MSG_CANCEL_ACTIONS:
+            loggerf("[S] %s cancelled %zu actions",
+                    player_nickname(id, nickname), event_player_cancel(id));
+            break;
+        case MSG_GET_CHAT: /* Already handled */
+            break;
+        case MSG_NEW_CHAT:
+            break;
+        case MSG_REPORT_NICKNAME:
+        case MSG_REPORT_VIEW:
+            break;
+        default:
+            warnf("Unknown type: %d", mbuf.msg.type);
+            logger("[S] [UNKNOWN]");
+            return 0;
+    }
 
-    player_connected_off(id);
-    close_connection(connection);
-    // TODO is it reachable point?
-    return NULL;
+    return 0;
 }
 
 /*
@@ -499,6 +507,7 @@ void send_sysmsg(connection_t *connection, enum msg_sysmsg_type type,
     if (NULL == connection) return;
     if ((type & connection->sysmsg_mask) == 0) {
         loggerf("[S] Dropping SYSMSG: [%s], type=%d", msg, type);
+        return;
     }
 
     mbuf_t s2c_mbuf;
@@ -514,6 +523,52 @@ void send_sysmsg(connection_t *connection, enum msg_sysmsg_type type,
     mqueue_put(connection->mqueueptr, s2c_mbuf);
 }
 
+/*
+ * Puts the message with a shared payload (see mshared_alloc()) into the
+ * queues of all the connections. The caller keeps its reference.
+ *
+ * except : connection to skip, may be NULL
+ * mbuf   : message to put
+ */
+void s_broadcast_shared(connection_t *except, mbuf_t mbuf) {
+    pthread_rwlock_rdlock(&connections_lock);
+    for (connection_t *curr = first_connection; curr; curr = curr->next) {
+        if (curr != except) {
+            mqueue_put_shared(curr->mqueueptr, mbuf);
+        }
+    }
+    pthread_rwlock_unlock(&connections_lock);
+}
+
+/*
+ * Sends the system message to all the connections, see send_sysmsg(). The
+ * payload is allocated once and shared by the queues.
+ *
+ * except : connection to skip, may be NULL
+ * type   : type of message
+ * msg    : message payload
+ */
+void s_broadcast_sysmsg(connection_t *except, enum msg_sysmsg_type type,
+        const char *msg) {
+    mbuf_t s2c_mbuf;
+    size_t msg_len = strlen(msg) + 1;
+
+    s2c_mbuf.payload = (char *)mshared_alloc(msg_len);
+    s2c_mbuf.msg.type = MSG_PUT_SYSMSG;
+    s2c_mbuf.msg.size = msg_len;
+    memcpy(s2c_mbuf.payload, msg, msg_len);
+
+    loggerf("[S] Broadcasting SYSMSG: [%s] size=%zu", msg, msg_len);
+    pthread_rwlock_rdlock(&connections_lock);
+    for (connection_t *curr = first_connection; curr; curr = curr->next) {
+        if (curr != except && (type & curr->sysmsg_mask) != 0) {
+            mqueue_put_shared(curr->mqueueptr, s2c_mbuf);
+        }
+    }
+    pthread_rwlock_unlock(&connections_lock);
+    mshared_release(s2c_mbuf.payload);
+}
+
 /*
  * Deletes connection from list, closes socket, destroys mqueue, etc.
  *
@@ -522,12 +577,8 @@ void send_sysmsg(connection_t *connection, enum msg_sysmsg_type type,
 void close_connection(connection_t *connection) {
     if (NULL == connection) return;
 
-    // TODO: lock it!
-    // TODO: lock it!
-    // TODO: lock it!
-    close(connection->socket);
-    mqueue_destroy(connection->mqueueptr);
-    free(connection->mqueueptr);
+    // Broadcasts must not see the connection while it is destroyed
+    pthread_rwlock_wrlock(&connections_lock);
     if (NULL == connection->prev) {
         first_connection = connection->next;
     } else {
@@ -538,6 +589,12 @@ void close_connection(connection_t *connection) {
     } else {
         connection->next->prev = connection->prev;
     }
+    pthread_rwlock_unlock(&connections_lock);
 
+    close(connection->socket);
+    mqueue_destroy(connection->mqueueptr);
+    free(connection->mqueueptr);
+    free(connection->area_sent);
+    free(connection->sight);
     free(connection);
 }
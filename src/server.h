@@ -6,6 +6,7 @@
 #include "config.h"
 #include "protocol.h"
 #include "connection.h"
+#include "reactor.h"
 
 #define SERVER_PORT 2607
 #define SERVER_BACKLOG 8
@@ -15,7 +16,11 @@ int server_started;
 void server();
 void server_fork_start();
 
-void* process_client(connection_t *connection);
+connection_t *s_connection_open(int cs, struct sockaddr_in *client,
+        socklen_t client_len, reactor_t *reactor);
+void s_connection_lost(connection_t *connection);
+int s_process_mbuf(connection_t *connection, mbuf_t *mbuf);
+void s_start();
 
 /*
  * Global game state. 
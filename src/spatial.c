@@ -0,0 +1,260 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+
+#define SPATIAL_LOCK pthread_mutex_lock(&spatial->mutex)
+#define SPATIAL_UNLOCK pthread_mutex_unlock(&spatial->mutex)
+
+static size_t spatial_hash(spatial_t *spatial, uint32_t y, uint32_t x) {
+    uint64_t key = ((uint64_t)(y >> SPATIAL_BITS) << 32 |
+            (x >> SPATIAL_BITS)) * 0x9E3779B97F4A7C15ULL;
+
+    return (key >> 32) & spatial->mask;
+}
+
+/*
+ * spatial : index to initialize
+ * slots   : expected number of occupied cells, rounded up to power of two
+ */
+void spatial_init(spatial_t *spatial, size_t slots) {
+    memset(spatial, '\0', sizeof(spatial_t));
+
+    for (spatial->mask = 1; spatial->mask < slots; spatial->mask <<= 1);
+    if ((spatial->slots = (spatial_entity_t **)calloc(spatial->mask,
+                    sizeof(spatial_entity_t *))) == NULL) {
+        panic("Error allocating spatial index!");
+    }
+    spatial->mask--;
+
+    if (pthread_mutex_init(&spatial->mutex, NULL) != 0) {
+        panic("Error initializing spatial index mutex!");
+    }
+}
+
+/*
+ * Entities are owned by their owners, they are only unlinked.
+ */
+void spatial_destroy(spatial_t *spatial) {
+    for (size_t i = 0; i <= spatial->mask; i++) {
+        for (spatial_entity_t *curr = spatial->slots[i]; curr != NULL;
+                curr = curr->next) {
+            curr->spatial = NULL;
+        }
+    }
+
+    free(spatial->slots);
+    pthread_mutex_destroy(&spatial->mutex);
+    spatial->slots = NULL;
+}
+
+static void spatial_link(spatial_t *spatial, spatial_entity_t *entity) {
+    spatial_entity_t **slot = spatial->slots +
+        spatial_hash(spatial, entity->y, entity->x);
+
+    entity->prev = NULL;
+    entity->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = entity;
+    }
+    *slot = entity;
+}
+
+static void spatial_unlink(spatial_t *spatial, spatial_entity_t *entity) {
+    if (entity->prev == NULL) {
+        spatial->slots[spatial_hash(spatial, entity->y, entity->x)] =
+            entity->next;
+    } else {
+        entity->prev->next = entity->next;
+    }
+    if (entity->next != NULL) {
+        entity->next->prev = entity->prev;
+    }
+}
+
+/*
+ * Puts the entity into the index, or moves it there from another one.
+ */
+void spatial_insert(spatial_t *spatial, spatial_entity_t *entity,
+        enum spatial_kind kind, size_t id, uint32_t y, uint32_t x) {
+    spatial_remove(entity);
+
+    SPATIAL_LOCK;
+
+    entity->kind = kind;
+    entity->id = id;
+    entity->y = y;
+    entity->x = x;
+    entity->spatial = spatial;
+    spatial_link(spatial, entity);
+    spatial->count++;
+
+    SPATIAL_UNLOCK;
+}
+
+/*
+ * Does nothing if the entity isn't indexed.
+ */
+void spatial_remove(spatial_entity_t *entity) {
+    spatial_t *spatial = entity->spatial;
+
+    if (spatial == NULL) {
+        return;
+    }
+
+    SPATIAL_LOCK;
+
+    spatial_unlink(spatial, entity);
+    entity->spatial = NULL;
+    spatial->count--;
+
+    SPATIAL_UNLOCK;
+}
+
+/*
+ * Relinks the entity only if it has left its cell. Does nothing if the
+ * entity isn't indexed.
+ */
+void spatial_move(spatial_entity_t *entity, uint32_t y, uint32_t x) {
+    spatial_t *spatial = entity->spatial;
+
+    if (spatial == NULL) {
+        return;
+    }
+
+    SPATIAL_LOCK;
+
+    if (((entity->y ^ y) | (entity->x ^ x)) >> SPATIAL_BITS) {
+        spatial_unlink(spatial, entity);
+        entity->y = y;
+        entity->x = x;
+        spatial_link(spatial, entity);
+    } else {
+        entity->y = y;
+        entity->x = x;
+    }
+
+    SPATIAL_UNLOCK;
+}
+
+// Query area, see spatial_query()
+typedef struct spatial_area {
+    uint32_t top_y;
+    uint32_t top_x;
+    uint32_t bottom_y;
+    uint32_t bottom_x;
+    uint32_t y;                     // centre for radius queries
+    uint32_t x;
+    uint64_t radius2;               // squared radius or UINT64_MAX
+} spatial_area_t;
+
+/*
+ * Collects matching entities of the list, which cell is (cy, cx) or any
+ * if *all* is set.
+ */
+static size_t spatial_collect(spatial_entity_t *curr, spatial_area_t *area,
+        uint32_t cy, uint32_t cx, int all, spatial_entity_t **found,
+        size_t count, size_t max) {
+    for (; curr != NULL; curr = curr->next) {
+        if ((! all && (curr->y >> SPATIAL_BITS != cy ||
+                        curr->x >> SPATIAL_BITS != cx)) ||
+                curr->y < area->top_y || curr->y > area->bottom_y ||
+                curr->x < area->top_x || curr->x > area->bottom_x) {
+            continue;
+        }
+
+        // Both distances are within the radius, so nothing overflows
+        if (area->radius2 != UINT64_MAX) {
+            uint64_t dy = curr->y > area->y ? curr->y - area->y :
+                area->y - curr->y;
+            uint64_t dx = curr->x > area->x ? curr->x - area->x :
+                area->x - curr->x;
+            if (dy * dy > area->radius2 - dx * dx) {
+                continue;
+            }
+        }
+
+        if (count < max) {
+            found[count] = curr;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Walks the cells of the area. Entities are taken only from the cell being
+ * walked, so the ones sharing a slot with it are found once. Areas larger
+ * than the table are scanned slot by slot instead.
+ */
+static size_t spatial_query(spatial_t *spatial, spatial_area_t *area,
+        spatial_entity_t **found, size_t max) {
+    uint32_t top_cy = area->top_y >> SPATIAL_BITS;
+    uint32_t top_cx = area->top_x >> SPATIAL_BITS;
+    uint32_t bottom_cy = area->bottom_y >> SPATIAL_BITS;
+    uint32_t bottom_cx = area->bottom_x >> SPATIAL_BITS;
+    size_t count = 0;
+
+    SPATIAL_LOCK;
+
+    if ((uint64_t)(bottom_cy - top_cy + 1) * (bottom_cx - top_cx + 1) >
+            spatial->mask + 1) {
+        for (size_t i = 0; i <= spatial->mask; i++) {
+            count = spatial_collect(spatial->slots[i], area, 0, 0, 1, found,
+                    count, max);
+        }
+
+        SPATIAL_UNLOCK;
+        return count;
+    }
+
+    for (uint64_t cy = top_cy; cy <= bottom_cy; cy++) {
+        for (uint64_t cx = top_cx; cx <= bottom_cx; cx++) {
+            count = spatial_collect(spatial->slots[spatial_hash(spatial,
+                        cy << SPATIAL_BITS, cx << SPATIAL_BITS)], area, cy,
+                    cx, 0, found, count, max);
+        }
+    }
+
+    SPATIAL_UNLOCK;
+
+    return count;
+}
+
+/*
+ * Finds entities inside the rectangle, borders included.
+ *
+ * found : array for the entities
+ * max   : size of *found*
+ *
+ * ret   : number of entities, only *max* of them are stored
+ */
+size_t spatial_rect(spatial_t *spatial, uint32_t top_y, uint32_t top_x,
+        uint32_t bottom_y, uint32_t bottom_x, spatial_entity_t **found,
+        size_t max) {
+    if (top_y > bottom_y || top_x > bottom_x) {
+        return 0;
+    }
+
+    spatial_area_t area = { top_y, top_x, bottom_y, bottom_x, 0, 0,
+        UINT64_MAX };
+
+    return spatial_query(spatial, &area, found, max);
+}
+
+/*
+ * Finds entities not farther than *radius* from (y, x), see spatial_rect().
+ */
+size_t spatial_radius(spatial_t *spatial, uint32_t y, uint32_t x,
+        uint32_t radius, spatial_entity_t **found, size_t max) {
+    spatial_area_t area;
+
+    area.top_y = y > radius ? y - radius : 0;
+    area.top_x = x > radius ? x - radius : 0;
+    area.bottom_y = UINT32_MAX - y > radius ? y + radius : UINT32_MAX;
+    area.bottom_x = UINT32_MAX - x > radius ? x + radius : UINT32_MAX;
+    area.y = y;
+    area.x = x;
+    area.radius2 = (uint64_t)radius * radius;
+
+    return spatial_query(spatial, &area, found, max);
+}
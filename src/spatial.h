@@ -0,0 +1,51 @@
+// vim: sw=4 ts=4 et :
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+/*
+ * Spatial index of a level: players and, later, NPCs and items are linked
+ * into square cells, which are hashed into a fixed table of slots. Cells
+ * with the same slot share its list, queries skip foreign entities.
+ */
+#define SPATIAL_BITS 4
+#define SPATIAL_SIZE (1 << SPATIAL_BITS)
+
+enum spatial_kind {
+    SK_PLAYER,
+    SK_NPC,
+    SK_ITEM,
+};
+
+/*
+ * Entity embedded into its owner, which is found by *kind* and *id*.
+ */
+typedef struct spatial_entity {
+    uint32_t y;
+    uint32_t x;
+    enum spatial_kind kind;
+    size_t id;                      // index of the owner, e.g. in players[]
+    struct spatial *spatial;        // index the entity is in or NULL
+    struct spatial_entity *prev;    // slot list
+    struct spatial_entity *next;
+} spatial_entity_t;
+
+typedef struct spatial {
+    spatial_entity_t **slots;
+    size_t mask;                    // slots number - 1
+    size_t count;                   // entities in the index
+    pthread_mutex_t mutex;
+} spatial_t;
+
+void spatial_init(spatial_t *spatial, size_t slots);
+void spatial_destroy(spatial_t *spatial);
+void spatial_insert(spatial_t *spatial, spatial_entity_t *entity,
+        enum spatial_kind kind, size_t id, uint32_t y, uint32_t x);
+void spatial_remove(spatial_entity_t *entity);
+void spatial_move(spatial_entity_t *entity, uint32_t y, uint32_t x);
+size_t spatial_rect(spatial_t *spatial, uint32_t top_y, uint32_t top_x,
+        uint32_t bottom_y, uint32_t bottom_x, spatial_entity_t **found,
+        size_t max);
+size_t spatial_radius(spatial_t *spatial, uint32_t y, uint32_t x,
+        uint32_t radius, spatial_entity_t **found, size_t max);
+
+#endif /* SPATIAL_H */
@@ -6,23 +6,23 @@
 chtype S[S_SIZE];
 
 void stuff_init() {
-    S[S_NONE        ] = conf("stuff_none").cval                           ;
-    S[S_FLOOR       ] = conf("stuff_floor").cval                          ;
-    S[S_WALL        ] = conf("stuff_wall").cval                           ;
-    S[S_DOOR        ] = conf("stuff_door").cval                           ;
-    S[S_TREE        ] = conf("stuff_tree").cval                           ;
-    S[S_GRASS       ] = conf("stuff_grass").cval                          ;
-    S[S_PLAYER      ] = conf("stuff_player").cval                         ;
-    S[S_DOWNSTAIRS  ] = conf("stuff_downstairs").cval                     ;
-    S[S_UPSTAIRS    ] = conf("stuff_upstairs").cval                       ;
+    S[S_NONE        ] = CONF_CVAL(CF_STUFF_NONE)                          ;
+    S[S_FLOOR       ] = CONF_CVAL(CF_STUFF_FLOOR)                         ;
+    S[S_WALL        ] = CONF_CVAL(CF_STUFF_WALL)                          ;
+    S[S_DOOR        ] = CONF_CVAL(CF_STUFF_DOOR)                          ;
+    S[S_TREE        ] = CONF_CVAL(CF_STUFF_TREE)                          ;
+    S[S_GRASS       ] = CONF_CVAL(CF_STUFF_GRASS)                         ;
+    S[S_PLAYER      ] = CONF_CVAL(CF_STUFF_PLAYER)                        ;
+    S[S_DOWNSTAIRS  ] = CONF_CVAL(CF_STUFF_DOWNSTAIRS)                    ;
+    S[S_UPSTAIRS    ] = CONF_CVAL(CF_STUFF_UPSTAIRS)                      ;
 
-    S[S_TRAP        ] = conf("stuff_trap").cval                           ;
-    S[S_FOOD        ] = conf("stuff_food").cval                           ;
+    S[S_TRAP        ] = CONF_CVAL(CF_STUFF_TRAP)                          ;
+    S[S_FOOD        ] = CONF_CVAL(CF_STUFF_FOOD)                          ;
 
-    S[S_GOLD        ] = conf("stuff_gold").cval                           ;
-    S[S_SCROLL      ] = conf("stuff_scroll").cval                         ;
-    S[S_BOOK        ] = conf("stuff_book").cval                           ;
+    S[S_GOLD        ] = CONF_CVAL(CF_STUFF_GOLD)                          ;
+    S[S_SCROLL      ] = CONF_CVAL(CF_STUFF_SCROLL)                        ;
+    S[S_BOOK        ] = CONF_CVAL(CF_STUFF_BOOK)                          ;
 
-    S[S_RING        ] = conf("stuff_ring").cval                           ;
-    S[S_WAND        ] = conf("stuff_wand").cval                           ;
+    S[S_RING        ] = CONF_CVAL(CF_STUFF_RING)                          ;
+    S[S_WAND        ] = CONF_CVAL(CF_STUFF_WAND)                          ;
 }
@@ -6,12 +6,15 @@
 #include "keyboard.h"
 #include "windows.h"
 
+// System messages wrapped for the window
+static lines_t sysmsg_lines;
+
 void c_sysmsg_init() {
-    if ((sysmsg = malloc(SYSMSG_MAXLEN + 1)) == NULL) {
+    if ((sysmsg = (history_t *)malloc(sizeof(history_t))) == NULL) {
         panic("Unable to allocate sysmsg memory!");
     }
-    
-    sysmsg[0] = '\0';
+    history_init(sysmsg, SYSMSG_BACKLOG);
+    lines_init(&sysmsg_lines, SYSMSG_BACKLOG);
 }
 
 void draw_sysmsg() {
@@ -19,49 +22,22 @@ void draw_sysmsg() {
         return;
     }
 
-    int square = WIN(SYSMSG, max_x) * WIN(SYSMSG, max_y);
-    size_t len = strlen(sysmsg);
-    char *sysmsgptr = sysmsg + len - 2;
-
-    if (len < 2) {
-        return;
-    }
-
-    int curr = 0;
-    while (sysmsgptr > sysmsg && curr < square) {
-        switch (*sysmsg) {
-            case '\n':
-                curr += WIN(SYSMSG, max_x)
-                    - curr % WIN(SYSMSG, max_x);
-                break;
-            default:
-                if ((*sysmsgptr & 0xC0) != 0x80) {
-                    curr++;
-                }
-        }
-        sysmsgptr--;
-    }
-
-    if (sysmsgptr != sysmsg && *(sysmsgptr - 1) != '\n') {
-        while (*sysmsgptr++ != '\n');
-    }
+    // The newest lines which fit
+    size_t last = lines_sync(&sysmsg_lines, sysmsg, WIN(SYSMSG, max_x));
+    size_t rows = WIN(SYSMSG, max_y) > 0 ? WIN(SYSMSG, max_y) : 0;
+    size_t first = last > rows ? last - rows : 0;
 
-    MVW(W_SYSMSG, 0, 0, "%s", sysmsgptr);
+    draw_lines(W_SYSMSG, &sysmsg_lines, sysmsg, first, last);
 }
 
+/*
+ * Adds the message to the history, the oldest one is forgotten if there is
+ * no room.
+ */
 void c_sysmsg_add(char *str) {
-    int oldsize = strlen(sysmsg) + 1;
-    int newsize = oldsize + strlen(str) + 1;
-
-    // TODO: actualize this todos
-    // TODO take care of CHAT_MSG_BACKLOG
-    // TODO do not forget that this routine is used by both client and server
-
-    if ((sysmsg = realloc(sysmsg, newsize)) == NULL) {
-        panic("Error reallocating sysmsg buffer!");
-    }
-
-    strcat(sysmsg, str);
+    history_add(sysmsg, sysmsg->next, sysutime(), HISTORY_SERVER, str,
+            strnlen(str, SYSMSG_MAXLEN));
+    windows_damage(W_SYSMSG, DAMAGE_ALL);
 }
 
 void c_sysmsg_open() {
@@ -79,6 +55,9 @@ void c_sysmsg_open() {
 
         wtimeout(W(W_SYSMSG), 10);
         last_key = mvwgetch(W(W_SYSMSG), 0, 0);
+        if (last_key != ERR) {
+            windows_damage(W_SYSMSG, DAMAGE_ALL);
+        }
 
         if (last_key == K[K_WINDOW_EXIT]) {
             break;
@@ -3,8 +3,9 @@
 #define SYSMSG_H
 
 #define SYSMSG_MAXLEN 256
+#define SYSMSG_BACKLOG 256
 
-char *sysmsg;
+history_t *sysmsg;
 
 void c_sysmsg_init();
 void c_sysmsg_open();
@@ -12,6 +13,9 @@ void draw_sysmsg();
 void c_sysmsg_add(char *str);
 void send_sysmsg(connection_t *connection, enum msg_sysmsg_type type,
         const char *msg);
+void s_broadcast_shared(connection_t *except, mbuf_t mbuf);
+void s_broadcast_sysmsg(connection_t *except, enum msg_sysmsg_type type,
+        const char *msg);
 void close_connection(connection_t *connection);
 
 #endif /* SYSMSG_H */
@@ -1,8 +1,102 @@
 // vim: sw=4 ts=4 et :
-// #include "itmmorgue.h"
-// #include "server.h"
-// #include "stuff.h"
+#include "itmmorgue.h"
 
 void tiles_init() {
     return;
 }
+
+/*
+ * overlay : stacked tiles
+ * index   : tile to look for
+ *
+ * ret     : position of the first item with *index* or, if there is no such
+ *           item, position where it should be inserted
+ */
+size_t overlay_find(overlay_t *overlay, uint64_t index) {
+    size_t low = 0, high = overlay->len;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (overlay->items[mid].index < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/*
+ * Puts cell under the top of the tile, above the rest of the stack.
+ *
+ * overlay : stacked tiles
+ * index   : tile
+ * cell    : cell to put, usually the previous top
+ */
+void overlay_push(overlay_t *overlay, uint64_t index, cell_t cell) {
+    if (overlay->len == overlay->cap) {
+        overlay->cap = overlay->cap ? overlay->cap * 2 : 16;
+        if ((overlay->items = (overlay_item_t *)realloc(overlay->items,
+                        sizeof(overlay_item_t) * overlay->cap)) == NULL) {
+            panic("Error allocating overlay!");
+        }
+    }
+
+    size_t pos = overlay_find(overlay, index);
+    memmove(overlay->items + pos + 1, overlay->items + pos,
+            sizeof(overlay_item_t) * (overlay->len - pos));
+    overlay->items[pos].index = index;
+    overlay->items[pos].cell = cell;
+    overlay->len++;
+}
+
+/*
+ * Takes the upper cell of the stack.
+ *
+ * overlay : stacked tiles
+ * index   : lvltilepos() of the tile
+ * cell    : taken cell
+ *
+ * ret     : 1 if the cell is taken, 0 if there is nothing under the top
+ */
+int overlay_pop(overlay_t *overlay, uint64_t index, cell_t *cell) {
+    size_t pos = overlay_find(overlay, index);
+
+    if (pos == overlay->len || overlay->items[pos].index != index) {
+        return 0;
+    }
+
+    *cell = overlay->items[pos].cell;
+    memmove(overlay->items + pos, overlay->items + pos + 1,
+            sizeof(overlay_item_t) * (overlay->len - pos - 1));
+    overlay->len--;
+
+    return 1;
+}
+
+/*
+ * Removes the whole stack of the tile.
+ */
+void overlay_clear(overlay_t *overlay, uint64_t index) {
+    size_t pos = overlay_find(overlay, index);
+    size_t end = pos;
+
+    while (end < overlay->len && overlay->items[end].index == index) {
+        end++;
+    }
+
+    if (end == pos) {
+        return;
+    }
+
+    memmove(overlay->items + pos, overlay->items + end,
+            sizeof(overlay_item_t) * (overlay->len - end));
+    overlay->len -= end - pos;
+}
+
+void overlay_destroy(overlay_t *overlay) {
+    free(overlay->items);
+    overlay->items = NULL;
+    overlay->len = overlay->cap = 0;
+}
@@ -2,18 +2,50 @@
 #ifndef TILES_H
 #define TILES_H
 
-typedef struct tile {
-    enum stuff top;             // type of the tile
-    enum colors color;          // server-specified attributes
-    uint16_t y;                 // absolute Y
-    uint16_t x;                 // absolute X
-    struct tile *underlying;    // pointer to underlying tile
-} tile_t;
+/*
+ * Visible part of the tile packed into 16 bits: low byte is *top*, high byte
+ * is *color*. Levels store their area as chunks of cells (see chunk.h).
+ */
+typedef uint16_t cell_t;
 
-typedef struct tileblock {
-    uint32_t count;
-    uint32_t zcount;
-    tile_t tiles[1];
-} tileblock_t;
+#define TILE_CELL(top, color) ((cell_t)((top) | (color) << 8))
+#define CELL_TOP(cell)        ((enum stuff)((cell) & 0xFF))
+#define CELL_COLOR(cell)      ((enum colors)((cell) >> 8))
+#define CELL_UNKNOWN          0xFFFF
+
+/*
+ * Stacked tiles live outside of the area: sorted by cell index vector of
+ * cells, which are under the top one. Items of the same index go from the
+ * top to the bottom. Most of tiles have nothing underlying, so the vector
+ * is short and lookups are binary searches. Only the server keeps it,
+ * clients are sent the top cells.
+ */
+typedef struct overlay_item {
+    uint64_t index;             // lvltilepos() of the tile
+    cell_t cell;                // underlying cell
+} overlay_item_t;
+
+typedef struct overlay {
+    overlay_item_t *items;
+    size_t len;
+    size_t cap;
+} overlay_t;
+
+/*
+ * Payload of MSG_PUT_AREA_DELTA is a sequence of runs. Every run is followed
+ * by *count* cells (see TILE_CELL) of a row, starting from *y* x *x*. Runs
+ * are not aligned inside the payload.
+ */
+typedef struct tilerun {
+    uint32_t y;                 // row of the run
+    uint32_t x;                 // column of the first cell
+    uint32_t count;             // number of cells in the run
+} tilerun_t;
+
+size_t overlay_find(overlay_t *overlay, uint64_t index);
+void overlay_push(overlay_t *overlay, uint64_t index, cell_t cell);
+int overlay_pop(overlay_t *overlay, uint64_t index, cell_t *cell);
+void overlay_clear(overlay_t *overlay, uint64_t index);
+void overlay_destroy(overlay_t *overlay);
 
 #endif /* TILES_H */
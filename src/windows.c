@@ -29,11 +29,31 @@ int windows_order[W_SIZE] = {
     W_SYSMSG
 };
 
+// Windows have been moved or resized since the last redraw
+static int windows_moved = 1;
+
 void windows_check() {
     // Dynamic assertions to check compile-time error ;-)
     if (W_SIZE != sizeof(windows_names) / sizeof(char *) - 1) {
         panic("SOURCE CODE ERROR: windows inconsistency!");
     }
+
+    // windows_fill() finds options of a window by their handles
+    for (int win = 0; win < W_SIZE; win++) {
+        int shift = win * (CF_WIN_AREA_SMALL_Y - CF_WIN_STDSCR_SMALL_Y);
+        char key[64];
+
+        snprintf(key, sizeof(key), "win_%s_state", windows_names[win]);
+        if (strcmp(conf_key(CF_WIN_STDSCR_STATE + shift), key) != 0) {
+            panic("SOURCE CODE ERROR: windows options inconsistency!");
+        }
+        snprintf(key, sizeof(key), "win_%s_large_max_x_ispercent",
+                windows_names[win]);
+        if (strcmp(conf_key(CF_WIN_STDSCR_LARGE_MAX_X_ISPERCENT + shift),
+                    key) != 0) {
+            panic("SOURCE CODE ERROR: windows options inconsistency!");
+        }
+    }
 }
 
 void windows_colors() {
@@ -52,58 +72,73 @@ static void windows_clearall() {
     }
 }
 
+/*
+ * Value of the window geometry option, see windows_fill().
+ *
+ * handle : option, its "_ispercent" option follows it
+ * size   : screen size the value is relative to
+ */
+static int windows_conf(enum conf_handle handle, int size) {
+    int val = CONF_IVAL(handle);
+
+    if (CONF_IVAL(handle + 1)) {
+        val = (int)(size * val / 100);
+    }
+
+    return val;
+}
+
 void windows_fill(int win, int keep_state) {
-    char buf[BUFSIZ]; // for config parameter prefix
-    strncpy(buf, "win_", 5);                      // buf  = "win_"
-    strncat(buf, windows_names[win], BUFSIZ - 5); // buf  = "win_area"
-
-#define FILL_WIN_PARAMETER(prefix, parameter)                                \
-    /* Such small macro definitions inspired by FreeBSD brilliant code */    \
-    do { char buf2[BUFSIZ]; /* for full config parameter */                  \
-        strcpy(buf2, prefix);                                                \
-        strncat(buf2, "_"#parameter, BUFSIZ - strlen(buf));                  \
-        char buf3[BUFSIZ];                                                   \
-        strcpy(buf3, buf2);                                                  \
-        strncat(buf3, "_ispercent", BUFSIZ - strlen(buf2));                  \
-        int val = CONF_IVAL(buf2);                                           \
-        if ((char*)#parameter == (char*)"max_y") {                           \
-            int ispercent = CONF_IVAL(buf3);                                 \
-            if (ispercent) val = (int)(max_y * val / 100);                   \
-            windows[win].parameter =                                         \
-            val < 0 ? max_y + val - windows[win].y : val;                    \
-        } else if ((char*)#parameter == (char*)"max_x") {                    \
-            int ispercent = CONF_IVAL(buf3);                                 \
-            if (ispercent) val = (int)(max_x * val / 100);                   \
-            windows[win].parameter =                                         \
-            val < 0 ? max_x + val - windows[win].x : val;                    \
-        } else if ((char*)#parameter == (char*)"y") {                        \
-            int ispercent = CONF_IVAL(buf3);                                 \
-            if (ispercent) val = (int)(max_y * val / 100);                   \
-            windows[win].parameter = val < 0 ? max_y + val : val;            \
-        } else if ((char*)#parameter == (char*)"x") {                        \
-            int ispercent = CONF_IVAL(buf3);                                 \
-            if (ispercent) val = (int)(max_x * val / 100);                   \
-            windows[win].parameter = val < 0 ? max_x + val : val;            \
-        } else {                                                             \
-            windows[win].parameter = val;                                    \
-        }                                                                    \
-    } while(0)
+    // Options of every window go in the same order as the stdscr ones
+    int shift = win * (CF_WIN_AREA_SMALL_Y - CF_WIN_STDSCR_SMALL_Y);
+    enum conf_handle geometry;
 
     if (keep_state == 0) {
-        FILL_WIN_PARAMETER(buf, state);
+        windows[win].state = CONF_IVAL(CF_WIN_STDSCR_STATE + shift);
     }
 
     if (windows[win].state == LARGE) {
-        strncat(buf, "_large", BUFSIZ - 12);
+        geometry = CF_WIN_STDSCR_LARGE_Y + shift;
     } else {
-        strncat(buf, "_small", BUFSIZ - 12);
+        geometry = CF_WIN_STDSCR_SMALL_Y + shift;
     }
 
-    FILL_WIN_PARAMETER(buf, y);
-    FILL_WIN_PARAMETER(buf, x);
-    FILL_WIN_PARAMETER(buf, max_y);
-    FILL_WIN_PARAMETER(buf, max_x);
-#undef FILL_WIN_PARAMETER
+    int y = windows_conf(geometry, max_y);
+    windows[win].y = y < 0 ? max_y + y : y;
+    int x = windows_conf(geometry + 2, max_x);
+    windows[win].x = x < 0 ? max_x + x : x;
+    int height = windows_conf(geometry + 4, max_y);
+    windows[win].max_y = height < 0 ? max_y + height - windows[win].y :
+        height;
+    int width = windows_conf(geometry + 6, max_x);
+    windows[win].max_x = width < 0 ? max_x + width - windows[win].x : width;
+
+    windows_moved = 1;
+}
+
+/*
+ * Marks the window to be drawn on the next windows_redraw(). Damage is
+ * raised by the network thread too, so it only grows here and is taken by
+ * the redraw.
+ *
+ * win    : window
+ * damage : DAMAGE_PART or DAMAGE_ALL
+ */
+void windows_damage(int win, int damage) {
+    int old = __atomic_load_n(&windows[win].damage, __ATOMIC_RELAXED);
+
+    while (old < damage && ! __atomic_compare_exchange_n(
+                &windows[win].damage, &old, damage, 0, __ATOMIC_RELEASE,
+                __ATOMIC_RELAXED));
+}
+
+/*
+ * Marks the whole screen to be drawn again, e.g. after a menu.
+ */
+void windows_touch() {
+    for (int i = 0; i < W_SIZE; i++) {
+        windows_damage(i, DAMAGE_ALL);
+    }
 }
 
 void windows_init(int keep_state) {
@@ -173,6 +208,11 @@ void init_screen() {
 }
 
 static void draw_any_before() {
+    if (! windows_moved) {
+        return;
+    }
+    windows_moved = 0;
+
     // Draw all windows
     for (size_t i = 0; i < W_SIZE; i++) {
         // Restore window size and position
@@ -184,15 +224,11 @@ static void draw_any_before() {
             mvderwin(W(i), windows[i].y, windows[i].x);
         }
     }
+    windows_touch();
 }
 
 static void draw_stdscr() {
-    mvwprintw(stdscr, 1, 1,
-            "%d x %d %s %d       ",
-            max_y,
-            max_x,
-            _("Key:"),
-            last_key);
+    mvwprintw(stdscr, 1, 1, "%d x %d", max_y, max_x);
 }
 
 static void draw_map() {
@@ -208,6 +244,25 @@ static void draw_inventory() {
     wprintw(W(W_INVENTORY), "ABCDEFJHIJKLMNOPQRSTUVWXYZ0123456789");
 }
 
+/*
+ * Draws lines from *first* to *last* of the history from the top of the
+ * window, the rest of every row is cleared.
+ */
+void draw_lines(int win, lines_t *lines, history_t *history, size_t first,
+        size_t last) {
+    for (size_t n = first; n < last; n++) {
+        line_t *line = lines_get(lines, n);
+        history_record_t *record = history_get(history, line->record);
+        if (record == NULL) {
+            continue;
+        }
+
+        int pad = windows[win].max_x - line->width;
+        MVW(win, n - first, 0, "%.*s%*s", line->len,
+                record->text + line->start, pad > 0 ? pad : 0, "");
+    }
+}
+
 static void draw_by_name(int win) {
     switch(win) {
         case W_STDSCR:    draw_stdscr();    break;
@@ -227,6 +282,46 @@ static void draw_any(int win) {
     mvwprintw(windows[win].w, 0, 1, "%s", windows_names[win]);
 }
 
+static int windows_overlap(int a, int b) {
+    return windows[a].y < windows[b].y + windows[b].max_y &&
+        windows[b].y < windows[a].y + windows[a].max_y &&
+        windows[a].x < windows[b].x + windows[b].max_x &&
+        windows[b].x < windows[a].x + windows[a].max_x;
+}
+
+/*
+ * Draws the window, if it is damaged or overlaps the windows drawn before.
+ *
+ * win    : window
+ * drawn  : windows drawn in this redraw, *win* is added if it is drawn
+ * ndrawn : number of *drawn*
+ */
+static void windows_draw(int win, int *drawn, size_t *ndrawn) {
+    int damage = __atomic_exchange_n(&windows[win].damage, DAMAGE_NONE,
+            __ATOMIC_ACQUIRE);
+
+    // Windows drawn before have painted over this one
+    for (size_t i = 0; i < *ndrawn && damage != DAMAGE_ALL; i++) {
+        if (windows_overlap(win, drawn[i])) {
+            damage = DAMAGE_ALL;
+        }
+    }
+
+    if (damage == DAMAGE_NONE) {
+        return;
+    }
+
+    windows[win].redraw = damage;
+    if (damage == DAMAGE_ALL) {
+        werase(W(win));
+        draw_any(win);
+    }
+    draw_by_name(win);
+    wnoutrefresh(W(win));
+
+    drawn[(*ndrawn)++] = win;
+}
+
 void windows_redraw() {
     if (max_x < 80 || max_y < 24) {
         redrawwin(stdscr);
@@ -246,25 +341,22 @@ void windows_redraw() {
 
     draw_any_before();
 
+    // Only the damaged windows are drawn, the screen is updated once
+    int drawn[W_SIZE];
+    size_t ndrawn = 0;
     for (int i = 0; i < W_SIZE; i++) {
         if (windows_order[i] == focus ||
                 windows[windows_order[i]].state == HIDDEN) {
             continue;
         }
 
-        // TODO check if we really need this heavy stuff.
-        // Also we can call wclear() only for each visibility change
-        //wclear(W(windows_order[i]));
-
-        draw_any(windows_order[i]);
-        draw_by_name(windows_order[i]);
+        windows_draw(windows_order[i], drawn, &ndrawn);
     }
+    windows_draw(focus, drawn, &ndrawn);
 
-    werase(W(focus));
-    draw_any(focus);
-    draw_by_name(focus);
-
-    refresh();
+    if (ndrawn > 0) {
+        doupdate();
+    }
 }
 
 int wcolor(WINDOW *win, int color) {
@@ -287,6 +379,7 @@ void c_inventory_open() {
 
         wtimeout(W(W_INVENTORY), -1);
         last_key = mvwgetch(W(W_INVENTORY), 0, 0);
+        windows_damage(W_INVENTORY, DAMAGE_ALL);
 
         if (last_key == K[K_ONE]) {
             warn("1");
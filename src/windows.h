@@ -23,6 +23,13 @@ extern char *windows_names[];
 
 #define MVW(WIN, ...) do { mvwprintw(W(WIN), __VA_ARGS__); } while(0)
 
+// What has to be drawn again, see windows_damage()
+enum damage {
+    DAMAGE_NONE,
+    DAMAGE_PART,    // what the window tracks itself, e.g. c_area_damage()
+    DAMAGE_ALL
+};
+
 typedef struct win_info {
     WINDOW *w;  // pointer to ncurses
     int y;      // left top corner
@@ -34,6 +41,8 @@ typedef struct win_info {
         SMALL,
         LARGE
     } state;
+    int damage; // to be drawn on the next redraw
+    int redraw; // damage being drawn now
 } win_info_t;
 
 win_info_t windows[W_SIZE];
@@ -45,6 +54,10 @@ void windows_check();
 void windows_init();
 void windows_redraw();
 void windows_fill();
+void windows_damage(int win, int damage);
+void windows_touch();
+void draw_lines(int win, lines_t *lines, history_t *history, size_t first,
+        size_t last);
 void c_inventory_open();
 int wcolor(WINDOW *win, int color);
 
@@ -0,0 +1,241 @@
+// vim: sw=4 ts=4 et :
+#include "itmmorgue.h"
+#include <sys/mman.h>
+
+/*
+ * Maps the world file read-only.
+ *
+ * world : world to fill, world->map is NULL if there is no valid file
+ * path  : world file
+ *
+ * ret   : 0 on success, -1 if the file is missing or broken
+ */
+int world_open(world_t *world, const char *path) {
+    struct stat st;
+    int fd;
+
+    memset(world, '\0', sizeof(world_t));
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(world_header_t)) {
+        close(fd);
+        loggerf("[S] World file %s is broken", path);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        loggerf("[S] Unable to map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    world->map = map;
+    world->size = st.st_size;
+    world->header = (const world_header_t *)map;
+    world->levels = (const world_level_t *)(world->header + 1);
+
+    int broken = memcmp(world->header->magic, WORLD_MAGIC, 4) != 0 ||
+        world->header->version != WORLD_VERSION ||
+        world->header->levels > (world->size - sizeof(world_header_t)) /
+        sizeof(world_level_t);
+
+    for (uint32_t i = 0; ! broken && i < world->header->levels; i++) {
+        const world_level_t *level = world->levels + i;
+
+        broken = level->chunks > world->size / CHUNK_BYTES ||
+            level->index > world->size ||
+            level->chunks * sizeof(chunk_key_t) > world->size - level->index ||
+            (level->chunks > 0 && (level->cells % WORLD_ALIGN != 0 ||
+                level->cells > world->size ||
+                level->chunks * CHUNK_BYTES > world->size - level->cells));
+    }
+
+    if (broken) {
+        loggerf("[S] World file %s is broken", path);
+        world_close(world);
+        return -1;
+    }
+
+    return 0;
+}
+
+void world_close(world_t *world) {
+    if (world->map != NULL) {
+        munmap(world->map, world->size);
+    }
+    memset(world, '\0', sizeof(world_t));
+}
+
+/*
+ * ret : saved cells of the chunk or NULL
+ */
+const cell_t *world_chunk(const world_t *world, const world_level_t *level,
+        uint32_t cy, uint32_t cx) {
+    const chunk_key_t *index;
+    size_t left = 0, right;
+
+    if (world->map == NULL || level == NULL) {
+        return NULL;
+    }
+
+    index = (const chunk_key_t *)((const char *)world->map + level->index);
+    right = level->chunks;
+    while (left < right) {
+        size_t middle = left + (right - left) / 2;
+
+        if (index[middle].cy < cy ||
+                (index[middle].cy == cy && index[middle].cx < cx)) {
+            left = middle + 1;
+        } else {
+            right = middle;
+        }
+    }
+
+    if (left == level->chunks || index[left].cy != cy ||
+            index[left].cx != cx) {
+        return NULL;
+    }
+
+    return (const cell_t *)((const char *)world->map + level->cells) +
+        left * CHUNK_CELLS;
+}
+
+static int world_key_cmp(const void *a, const void *b) {
+    const chunk_key_t *x = (const chunk_key_t *)a;
+    const chunk_key_t *y = (const chunk_key_t *)b;
+
+    if (x->cy != y->cy) {
+        return x->cy < y->cy ? -1 : 1;
+    }
+    return x->cx < y->cx ? -1 : x->cx > y->cx;
+}
+
+/*
+ * Chunks to save: the ones in memory or flushed and the ones saved before.
+ */
+static size_t world_keys(const world_t *world, level_t *level,
+        chunk_key_t **keys) {
+    const world_level_t *saved = level->world;
+    size_t count = chunks_keys(&level->chunks, keys);
+
+    if (world->map != NULL && saved != NULL && saved->chunks > 0) {
+        if ((*keys = (chunk_key_t *)realloc(*keys, sizeof(chunk_key_t) *
+                        (count + saved->chunks))) == NULL) {
+            panic("Error allocating chunk keys!");
+        }
+        memcpy(*keys + count, (const char *)world->map + saved->index,
+                sizeof(chunk_key_t) * saved->chunks);
+        count += saved->chunks;
+    }
+
+    qsort(*keys, count, sizeof(chunk_key_t), &world_key_cmp);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || world_key_cmp(*keys + unique - 1, *keys + i) != 0) {
+            (*keys)[unique++] = (*keys)[i];
+        }
+    }
+
+    return unique;
+}
+
+static void world_write(FILE *file, const void *data, size_t size,
+        const char *path) {
+    if (size > 0 && fwrite(data, size, 1, file) != 1) {
+        panicf("Error writing %s!", path);
+    }
+}
+
+/*
+ * Writes the levels into a new world file, which replaces *path*
+ * atomically. The old file may still be mapped by *world*.
+ *
+ * world  : currently mapped world
+ * path   : world file
+ * levels : levels to save
+ * count  : number of *levels*
+ */
+void world_save(const world_t *world, const char *path, level_t *levels,
+        size_t count) {
+    char tmp[PATH_MAX];
+    world_header_t header;
+    world_level_t *table;
+    chunk_key_t **keys;
+    cell_t cells[CHUNK_CELLS];
+    FILE *file;
+
+    snprintf(tmp, PATH_MAX, "%s.tmp", path);
+    if ((file = fopen(tmp, "wb")) == NULL) {
+        loggerf("[S] Unable to save world to %s: %s", tmp, strerror(errno));
+        return;
+    }
+
+    if ((table = (world_level_t *)calloc(count + 1,
+                    sizeof(world_level_t))) == NULL ||
+            (keys = (chunk_key_t **)calloc(count + 1,
+                    sizeof(chunk_key_t *))) == NULL) {
+        panic("Error allocating world table!");
+    }
+
+    uint64_t offset = sizeof(world_header_t) + sizeof(world_level_t) * count;
+    for (size_t i = 0; i < count; i++) {
+        table[i].id = levels[i].id;
+        memcpy(table[i].name, levels[i].name, MAX_LEVEL_NAME);
+        table[i].seed = levels[i].gen.seed;
+        table[i].max_y = levels[i].max_y;
+        table[i].max_x = levels[i].max_x;
+        table[i].range = levels[i].gen.range;
+        table[i].step_min = levels[i].gen.step_min;
+        table[i].step_max = levels[i].gen.step_max;
+        table[i].castles = levels[i].gen.castles;
+        table[i].chunks = world_keys(world, levels + i, keys + i);
+        table[i].index = offset;
+        offset += sizeof(chunk_key_t) * table[i].chunks;
+        offset = (offset + WORLD_ALIGN - 1) / WORLD_ALIGN * WORLD_ALIGN;
+        table[i].cells = offset;
+        offset += CHUNK_BYTES * table[i].chunks;
+    }
+
+    memset(&header, '\0', sizeof(world_header_t));
+    memcpy(header.magic, WORLD_MAGIC, 4);
+    header.version = WORLD_VERSION;
+    header.levels = count;
+
+    world_write(file, &header, sizeof(world_header_t), tmp);
+    world_write(file, table, sizeof(world_level_t) * count, tmp);
+
+    for (size_t i = 0; i < count; i++) {
+        world_write(file, keys[i], sizeof(chunk_key_t) * table[i].chunks,
+                tmp);
+        if (fseeko(file, table[i].cells, SEEK_SET) < 0) {
+            panicf("Error writing %s!", tmp);
+        }
+
+        for (size_t j = 0; j < table[i].chunks; j++) {
+            uint64_t version;
+            chunks_copy(&levels[i].chunks, keys[i][j].cy, keys[i][j].cx, 0,
+                    cells, &version);
+            world_write(file, cells, CHUNK_BYTES, tmp);
+        }
+
+        free(keys[i]);
+    }
+
+    if (fflush(file) != 0 || fsync(fileno(file)) < 0) {
+        panicf("Error writing %s!", tmp);
+    }
+    fclose(file);
+
+    if (rename(tmp, path) < 0) {
+        loggerf("[S] Unable to save world to %s: %s", path, strerror(errno));
+    } else {
+        loggerf("[S] World saved to %s: %zu bytes", path, (size_t)offset);
+    }
+
+    free(keys);
+    free(table);
+}
@@ -0,0 +1,57 @@
+// vim: sw=4 ts=4 et :
+#ifndef WORLD_H
+#define WORLD_H
+
+/*
+ * World file, laid out to be mapped into memory as is (native byte order):
+ *
+ * world_header_t
+ * world_level_t[levels]
+ * for every level:
+ *   chunk_key_t[chunks], sorted by Y, then X
+ *   padding up to WORLD_ALIGN
+ *   cell_t[chunks][CHUNK_CELLS]
+ *
+ * Chunks missing in the file are generated from the level parameters.
+ */
+#define WORLD_MAGIC "ITMW"
+#define WORLD_VERSION 1
+#define WORLD_ALIGN 4096
+
+typedef struct world_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t levels;
+    uint32_t reserved;
+} world_header_t;
+
+typedef struct world_level {
+    uint64_t id;
+    char name[MAX_LEVEL_NAME];
+    uint64_t seed;
+    uint32_t max_y;
+    uint32_t max_x;
+    uint32_t range;
+    uint32_t step_min;
+    uint32_t step_max;
+    uint32_t castles;
+    uint64_t chunks;            // number of saved chunks
+    uint64_t index;             // offset of chunk_key_t[chunks]
+    uint64_t cells;             // offset of cells, WORLD_ALIGN aligned
+} world_level_t;
+
+typedef struct world {
+    void *map;                  // whole file or NULL
+    size_t size;
+    const world_header_t *header;
+    const world_level_t *levels;
+} world_t;
+
+int world_open(world_t *world, const char *path);
+void world_close(world_t *world);
+const cell_t *world_chunk(const world_t *world, const world_level_t *level,
+        uint32_t cy, uint32_t cx);
+void world_save(const world_t *world, const char *path, level_t *levels,
+        size_t count);
+
+#endif /* WORLD_H */
@@ -0,0 +1,140 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "itmmorgue.h"
+
+/*
+ * Chunked level benchmark: walks a player across a huge world, loading
+ * chunks around it like server does, and reports chunk generation latency
+ * and peak memory. Then modified chunks must survive their eviction.
+ *
+ * cc -o tests/chunks tests/chunks.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/chunk.c src/gen.c -I lib/ -pthread && tests/chunks
+ */
+
+#define RADIUS 2
+#define STEPS 65536
+#define MEMORY (16 << 20)
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+gen_params_t params;
+unsigned long long *latency;
+size_t latency_len;
+
+void generate(void *arg, chunk_t *chunk) {
+    (void)arg;
+    unsigned long long begin = sysutime();
+
+    gen_chunk(&params, chunk->cy, chunk->cx, chunk->cells);
+    latency[latency_len++] = sysutime() - begin;
+}
+
+int compare(const void *a, const void *b) {
+    unsigned long long x = *(unsigned long long *)a;
+    unsigned long long y = *(unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main() {
+    uint32_t sizes[] = { 65536, 1 << 30 };
+    chunks_t chunks;
+
+    params.seed = 375;
+    params.range = 40;
+    params.step_min = 15;
+    params.step_max = 55;
+    params.castles = 1;
+    params.progress = NULL;
+
+    // Every step may bring a new row or column of chunks in sight
+    if ((latency = malloc(sizeof(*latency) * (STEPS / CHUNK_SIZE + 1) *
+                    (2 * RADIUS + 1) * 2 + 1024)) == NULL) {
+        panic("Error allocating latency buffer!");
+    }
+
+    // The same chunk must be the same after eviction
+    params.height = params.width = 65536;
+    cell_t a[CHUNK_CELLS], b[CHUNK_CELLS];
+    gen_chunk(&params, 100, 200, a);
+    gen_chunk(&params, 100, 200, b);
+    if (memcmp(a, b, sizeof(a)) != 0) {
+        fprintf(stderr, "FAIL: chunk generator is not deterministic!\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        params.height = params.width = sizes[i];
+        latency_len = 0;
+        chunks_init(&chunks, MEMORY, &generate, NULL, NULL);
+
+        // Diagonal walk from the middle of the world
+        uint32_t y = sizes[i] / 2, x = sizes[i] / 2;
+        unsigned long long begin = sysutime();
+        for (size_t step = 0; step < STEPS; step++, y++, x++) {
+            uint32_t cy = y >> CHUNK_BITS, cx = x >> CHUNK_BITS;
+            for (uint32_t j = cy - RADIUS; j <= cy + RADIUS; j++) {
+                for (uint32_t k = cx - RADIUS; k <= cx + RADIUS; k++) {
+                    chunks_load(&chunks, j, k);
+                }
+            }
+        }
+        unsigned long long total = sysutime() - begin;
+
+        qsort(latency, latency_len, sizeof(*latency), &compare);
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        printf("%10u^2: %zu chunks in %.3f s, latency p50 %llu us, "
+                "p99 %llu us, max %llu us, %zu evicted, peak RSS %ld KiB\n",
+                sizes[i], latency_len, total / 1e6,
+                latency[latency_len / 2], latency[latency_len * 99 / 100],
+                latency[latency_len - 1], chunks.evicted, usage.ru_maxrss);
+        fflush(stdout);
+
+        chunks_destroy(&chunks);
+    }
+
+    // Every chunk is modified, so the budget holds only with flushes
+    latency_len = 0;
+    chunks_init(&chunks, 0, &generate, NULL, NULL);
+    for (uint32_t i = 0; i < 4 * CHUNKS_MIN; i++) {
+        cell_t cell = i;
+        chunks_write(&chunks, i << CHUNK_BITS, 0, &cell, 1);
+    }
+    for (uint32_t i = 0; i < 4 * CHUNKS_MIN; i++) {
+        if (chunks_cell(&chunks, i << CHUNK_BITS, 0) != (cell_t)i) {
+            fprintf(stderr, "FAIL: modified chunk %u is lost!\n", i);
+            return 1;
+        }
+    }
+    if (chunks.count > chunks.max) {
+        fprintf(stderr, "FAIL: %zu chunks in memory, %zu allowed!\n",
+                chunks.count, chunks.max);
+        return 1;
+    }
+    printf("%d modified chunks: %zu flushed, %zu in memory\n",
+            4 * CHUNKS_MIN, chunks.flushed, chunks.count);
+    chunks_destroy(&chunks);
+
+    return 0;
+}
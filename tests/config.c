@@ -0,0 +1,164 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * Config lookups by name must not allocate: ten million conf() calls, the
+ * resident set size must stay as it was after the first million. Reads by
+ * name and by handle are timed as well. Then the config file is rewritten,
+ * its watcher must publish the new values and keep them when the file gets
+ * broken.
+ *
+ * cc -o tests/config tests/config.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/config.c src/arena.c lib/trie/trie.o -I lib/ -pthread && \
+ *     tests/config
+ */
+
+#define CALLS 10000000
+#define WARMUP 1000000
+#define WAIT 2000000 // us to wait for the watcher
+#define READS 1000000
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void warn(char *str) {
+    fprintf(stderr, "%s\n", str);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int strtoi(const char *nptr, char **endptr, int base) {
+    return (int)strtol(nptr, endptr, base);
+}
+
+void write_config(char *file, char *text) {
+    FILE *config = fopen(file, "w");
+
+    if (config == NULL || fputs(text, config) < 0 || fclose(config) != 0) {
+        panic("Unable to write config file!");
+    }
+}
+
+// Waits until the watcher has reloaded the config *generation* times
+unsigned wait_reload(unsigned generation) {
+    for (int waited = 0; waited < WAIT; waited += 10000) {
+        if (config_generation() >= generation) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    return config_generation();
+}
+
+// Resident set size in pages
+long rss() {
+    long size, resident;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL || fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+        panic("Unable to read /proc/self/statm!");
+    }
+    fclose(statm);
+
+    return resident;
+}
+
+int main() {
+    char *keys[] = { "player_camera", "server_tick_rate", "key_exit",
+        "win_sysmsg_large_max_x_ispercent" };
+    size_t nkeys = sizeof(keys) / sizeof(char *);
+    long sum = 0, before = 0;
+    char file[] = "/tmp/itmmorgue.conf.XXXXXX";
+    int fd;
+
+    if ((fd = mkstemp(file)) < 0) {
+        panic("Unable to create config file!");
+    }
+    close(fd);
+    write_config(file, "server_tick_rate = 30\n");
+
+    config_init(file);
+
+    for (size_t i = 0; i < CALLS; i++) {
+        if (i == WARMUP) {
+            before = rss();
+        }
+        sum += conf(keys[i % nkeys]).ival;
+    }
+
+    long after = rss();
+    printf("RSS after %d calls: %ld pages, after %d calls: %ld pages\n",
+            WARMUP, before, CALLS, after);
+
+    if (sum == 0 || conf("player_camera").ival != CONF_IVAL(CF_PLAYER_CAMERA)) {
+        fprintf(stderr, "FAIL: wrong values are looked up!\n");
+        return 1;
+    }
+
+    // Slack for heap noise, a leak of a byte per call is 2k pages
+    if (after > before + 64) {
+        fprintf(stderr, "FAIL: conf() leaks memory!\n");
+        return 1;
+    }
+
+    long camera = 0;
+    unsigned long long begin = sysutime();
+    for (size_t i = 0; i < READS; i++) {
+        camera += conf("player_camera").ival;
+    }
+    unsigned long long by_name = sysutime() - begin;
+
+    begin = sysutime();
+    for (size_t i = 0; i < READS; i++) {
+        camera -= CONF_IVAL(CF_PLAYER_CAMERA);
+    }
+    unsigned long long by_handle = sysutime() - begin;
+
+    printf("%d reads of player_camera: conf() %.2f ns, CONF_IVAL() %.2f ns\n",
+            READS, by_name * 1e3 / READS, by_handle * 1e3 / READS);
+
+    if (camera != 0) {
+        fprintf(stderr, "FAIL: reads by name and by handle differ!\n");
+        return 1;
+    }
+
+    conf_t *old = conf_values;
+    config_watch();
+
+    write_config(file, "server_tick_rate = 20\n");
+    if (wait_reload(1) != 1 || CONF_IVAL(CF_SERVER_TICK_RATE) != 20 ||
+            old[CF_SERVER_TICK_RATE].ival != 30) {
+        fprintf(stderr, "FAIL: config is not reloaded!\n");
+        return 1;
+    }
+
+    write_config(file, "server_tick_rate = twenty\n");
+    config_reload();
+    if (wait_reload(2) != 1 || CONF_IVAL(CF_SERVER_TICK_RATE) != 20) {
+        fprintf(stderr, "FAIL: broken config is loaded!\n");
+        return 1;
+    }
+
+    unlink(file);
+
+    return 0;
+}
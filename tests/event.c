@@ -0,0 +1,159 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "itmmorgue.h"
+
+/*
+ * Event loop latency: time from the last player's input to the turn
+ * resolution, and CPU time burnt while nobody acts. Then real-time mode
+ * tick accuracy.
+ *
+ * cc -o tests/event tests/event.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/event.c -I lib/ -pthread && tests/event
+ */
+
+#define PLAYERS 4
+#define TURNS 10000
+#define BUCKETS 16
+#define RATE 60
+
+player_t players[MAX_PLAYERS];
+size_t players_len = PLAYERS;
+size_t players_total = PLAYERS;
+
+unsigned long long input, resolved;
+size_t moves = 0;
+sem_t turn;
+conf_t values[CF_SIZE];
+conf_t *conf_values = values;
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+unsigned long long cputime() {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec +
+        usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+}
+
+void player_move(player_move_t *move) {
+    (void)move;
+    moves++;
+}
+
+size_t s_broadcast_players() {
+    resolved = sysutime();
+    sem_post(&turn);
+
+    return 0;
+}
+
+size_t s_sync_players() {
+    return 0;
+}
+
+// Runs real-time scheduler for two seconds
+int realtime() {
+    ev_stats_t stats;
+
+    CONF_IVAL(CF_SERVER_TICK_MODE) = EV_MODE_REALTIME;
+    event_init();
+    sleep(2);
+    event_stats(&stats);
+
+    printf("Real-time at %d Hz: %llu ticks in 2 s, avg %llu ns, "
+            "max %llu ns, %llu overruns, slowest phase %d\n", RATE,
+            (unsigned long long)stats.ticks,
+            (unsigned long long)(stats.ticks ?
+                stats.total_ns / stats.ticks : 0),
+            (unsigned long long)stats.max_ns,
+            (unsigned long long)stats.overruns, stats.slowest);
+
+    return stats.ticks < 2 * RATE - 2 || stats.ticks > 2 * RATE + 1;
+}
+
+int main() {
+    size_t histogram[BUCKETS] = { 0 };
+    pid_t child;
+    int status;
+
+    CONF_IVAL(CF_SERVER_TICK_MODE) = EV_MODE_TURN;
+    CONF_IVAL(CF_SERVER_TICK_RATE) = RATE;
+    CONF_IVAL(CF_SERVER_TURN_TIME) = 4000;
+
+    // Scheduler runs for the whole process, so every mode gets one
+    if ((child = fork()) == 0) {
+        return realtime();
+    }
+    waitpid(child, &status, 0);
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "FAIL: real-time ticks are inaccurate!\n");
+        return 1;
+    }
+
+    sem_init(&turn, 0, 0);
+    for (size_t i = 0; i < PLAYERS; i++) {
+        pthread_mutex_init(&players[i].ev_queue.event_mutex, NULL);
+    }
+    event_init();
+
+    for (size_t t = 0; t < TURNS; t++) {
+        for (size_t i = 0; i < PLAYERS; i++) {
+            input = sysutime();
+            event_player_add(i, EV_MOVE, K_MOVE_DOWN);
+        }
+        sem_wait(&turn);
+
+        // Bucket b holds latencies below 2^b microseconds
+        size_t b = 0;
+        for (unsigned long long us = resolved - input; us > 0 &&
+                b < BUCKETS - 1; us >>= 1, b++);
+        histogram[b]++;
+    }
+
+    printf("Input to turn resolution, %d players, %d turns:\n", PLAYERS,
+            TURNS);
+    for (size_t b = 0; b < BUCKETS; b++) {
+        if (histogram[b] > 0) {
+            printf("  %s%6llu us: %zu\n", b < BUCKETS - 1 ? "< " : ">=",
+                    b < BUCKETS - 1 ? 1ULL << b : 1ULL << (b - 1),
+                    histogram[b]);
+        }
+    }
+
+    if (moves != PLAYERS * TURNS) {
+        fprintf(stderr, "FAIL: %zu moves applied instead of %d!\n", moves,
+                PLAYERS * TURNS);
+        return 1;
+    }
+
+    unsigned long long cpu = cputime();
+    sleep(1);
+    printf("Idle CPU time: %llu us per second\n", cputime() - cpu);
+
+    return histogram[BUCKETS - 1] > 0;
+}
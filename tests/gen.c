@@ -0,0 +1,118 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * Level generation benchmark: native generator against scripts/Gen.sh.
+ * Script pipeline is run only with -s, it takes minutes on large levels.
+ *
+ * cc -o tests/gen tests/gen.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/gen.c -I lib/ && tests/gen -s
+ */
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Runs the script and returns number of characters read
+size_t script(uint32_t height, uint32_t width) {
+    char cmd[BUFSIZ];
+    size_t size = 0;
+    FILE *gen;
+
+    snprintf(cmd, BUFSIZ, "./scripts/Gen.sh -w%u -h%u", width, height);
+    if ((gen = popen(cmd, "r")) == NULL) {
+        panic("Error running Gen.sh!");
+    }
+    while (getc(gen) != EOF) {
+        size++;
+    }
+    pclose(gen);
+
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t sizes[][2] = { { 64, 256 }, { 1024, 1024 }, { 4096, 4096 } };
+    int with_script = argc > 1 && strcmp(argv[1], "-s") == 0;
+    gen_params_t params;
+
+    params.seed = 375;
+    params.range = 40;
+    params.step_min = 15;
+    params.step_max = 55;
+    params.castles = 1;
+    params.progress = NULL;
+
+    // Same parameters must give the same level
+    params.height = 64;
+    params.width = 256;
+    char *a = gen_level(&params), *b = gen_level(&params);
+    if (memcmp(a, b, params.height * params.width) != 0) {
+        fprintf(stderr, "FAIL: generator is not deterministic!\n");
+        return 1;
+    }
+    free(b);
+
+    // Parts of the level must be the same as the whole level
+    for (uint32_t top = 0; top < params.height; top += 24) {
+        for (uint32_t left = 0; left < params.width; left += 40) {
+            uint32_t height = params.height - top < 24 ?
+                params.height - top : 24;
+            uint32_t width = params.width - left < 40 ?
+                params.width - left : 40;
+
+            b = gen_area(&params, top, left, height, width);
+            for (uint32_t y = 0; y < height; y++) {
+                if (memcmp(a + (size_t)(top + y) * params.width + left,
+                            b + (size_t)y * width, width) != 0) {
+                    fprintf(stderr, "FAIL: area %u:%u differs!\n", top,
+                            left);
+                    return 1;
+                }
+            }
+            free(b);
+        }
+    }
+    free(a);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        params.height = sizes[i][0];
+        params.width = sizes[i][1];
+
+        unsigned long long begin = sysutime();
+        free(gen_level(&params));
+        unsigned long long native = sysutime() - begin;
+
+        printf("%5u x %-5u native: %8.3f s", params.height, params.width,
+                native / 1e6);
+
+        if (with_script) {
+            begin = sysutime();
+            size_t size = script(params.height, params.width);
+            unsigned long long perl = sysutime() - begin;
+
+            printf("  Gen.sh: %8.3f s (%zu bytes)  %.0fx", perl / 1e6, size,
+                    (double)perl / (native ? native : 1));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    return 0;
+}
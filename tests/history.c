@@ -0,0 +1,95 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+#include "chat.h"
+
+/*
+ * Chat history benchmark: appends a million messages and reports the cost
+ * of every 100k of them, which must not grow with the history. Then checks
+ * what is kept and how it is encoded.
+ *
+ * cc -o tests/history tests/history.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/history.c -I lib/ -pthread && tests/history
+ */
+
+#define MESSAGES 1000000
+#define BATCH 100000
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int main() {
+    history_t history, copy;
+    unsigned long long first = 0, slowest = 0;
+    char text[CHAT_MSG_MAXLEN];
+
+    history_init(&history, CHAT_MSG_BACKLOG);
+
+    for (size_t batch = 0; batch < MESSAGES / BATCH; batch++) {
+        unsigned long long begin = sysutime();
+
+        for (size_t i = 0; i < BATCH; i++) {
+            int len = snprintf(text, sizeof(text), "<tester> message %zu\n",
+                    batch * BATCH + i);
+            history_add(&history, history.next, begin, i % MAX_PLAYERS,
+                    text, len);
+        }
+
+        unsigned long long spent = sysutime() - begin;
+        printf("  %7zu messages: %.1f ns per append\n", (batch + 1) * BATCH,
+                spent * 1e3 / BATCH);
+        if (batch == 0) {
+            first = spent;
+        }
+        if (spent > slowest) {
+            slowest = spent;
+        }
+    }
+
+    // Only the last messages are kept
+    history_record_t *last = history_get(&history, MESSAGES - 1);
+    if (history.count != CHAT_MSG_BACKLOG || last == NULL ||
+            strcmp(last->text, "<tester> message 999999\n") != 0 ||
+            history_get(&history, MESSAGES - CHAT_MSG_BACKLOG - 1) != NULL) {
+        fprintf(stderr, "FAIL: wrong messages are kept!\n");
+        return 1;
+    }
+
+    // Scrollback page from the server lands in the client's copy as is
+    char *payload;
+    size_t size = history_encode(&history, 10, 20, &payload);
+    history_init(&copy, CHAT_MSG_BACKLOG);
+    if (history_decode(&copy, payload, size) != 20 ||
+            copy.next != MESSAGES - 10 ||
+            strcmp(history_get(&copy, MESSAGES - 11)->text,
+                "<tester> message 999989\n") != 0) {
+        fprintf(stderr, "FAIL: history is encoded wrong!\n");
+        return 1;
+    }
+    free(payload);
+
+    history_destroy(&copy);
+    history_destroy(&history);
+
+    // Generous bound, timer noise of a busy machine
+    return slowest > 3 * first + 1000;
+}
@@ -0,0 +1,137 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * Locale catalog: compiles a locale of 100k strings, looks every one of
+ * them up along with missing ones, then loads the same catalog from the
+ * cache and checks it is used instead of the file.
+ *
+ * cc -o tests/locale tests/locale.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/locale.c -I lib/ -pthread && tests/locale
+ */
+
+#define STRINGS 100000
+#define LOOKUPS 10000000
+
+conf_t values[CF_SIZE];
+conf_t *conf_values = values;
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+void config_watch_file(char *file) {
+    (void)file;
+}
+
+int readall(int fd, void *buf, size_t size) {
+    return read(fd, buf, size) == (ssize_t)size ? (int)size : -1;
+}
+
+size_t anystrlen(char *str) {
+    size_t len = 0;
+
+    while (*str) {
+        len += (*str++ & 0xC0) != 0x80;
+    }
+
+    return len;
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Checks every string of the locale, ret : number of the wrong ones
+int check() {
+    char key[64], value[64];
+    int wrong = 0;
+
+    for (int i = 0; i < STRINGS; i++) {
+        snprintf(key, sizeof(key), "Item %d", i);
+        snprintf(value, sizeof(value), "Пункт %d", i);
+        wrong += strcmp(_(key), value) != 0 ||
+            locale_len(key) != anystrlen(value);
+
+        snprintf(key, sizeof(key), "Missing %d", i);
+        wrong += _(key) != key || locale_len(key) != strlen(key);
+    }
+
+    // The last one of the same keys wins
+    wrong += strcmp(_("Item 0"), "Пункт 0") != 0;
+
+    return wrong;
+}
+
+int main() {
+    char file[] = "/tmp/itmmorgue.lang.XXXXXX";
+    char cache[sizeof(file) + 8];
+    int fd;
+
+    if ((fd = mkstemp(file)) < 0) {
+        panic("Unable to create locale file!");
+    }
+    FILE *locale = fdopen(fd, "w");
+    fprintf(locale, "### Test locale\n{Item 0} = {Old}\n");
+    for (int i = 0; i < STRINGS; i++) {
+        fprintf(locale, "{Item %d} = {Пункт %d}\n", i, i);
+    }
+    fclose(locale);
+
+    snprintf(cache, sizeof(cache), "%s.cache", file);
+    values[CF_FILE_LOCALE_CACHE].value.__sval = cache;
+
+    unsigned long long begin = sysutime();
+    locale_init(file);
+    printf("Compiled %d strings in %llu us\n", STRINGS, sysutime() - begin);
+    if (check() != 0) {
+        fprintf(stderr, "FAIL: wrong strings are compiled!\n");
+        return 1;
+    }
+
+    begin = sysutime();
+    size_t sum = 0;
+    for (int i = 0; i < LOOKUPS; i++) {
+        sum += locale_len("Item 4242");
+    }
+    printf("Lookup: %.1f ns\n", (sysutime() - begin) * 1e3 / LOOKUPS);
+
+    // The file is gone, only the cache can give the strings now
+    struct stat sb;
+    stat(file, &sb);
+    locale = fopen(file, "w");
+    for (off_t i = 0; i < sb.st_size; i++) {
+        fputc('#', locale);
+    }
+    fclose(locale);
+    struct timespec times[2] = { sb.st_mtim, sb.st_mtim };
+    utimensat(AT_FDCWD, file, times, 0);
+
+    begin = sysutime();
+    locale_init(file);
+    printf("Loaded the cache in %llu us\n", sysutime() - begin);
+    if (check() != 0) {
+        fprintf(stderr, "FAIL: cache is not used!\n");
+        return 1;
+    }
+
+    unlink(cache);
+    unlink(file);
+
+    return sum != LOOKUPS * anystrlen("Пункт 4242");
+}
@@ -1,19 +1,231 @@
 // vim: sw=4 ts=4 et :
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "protocol.h"
 
 /*
  * cc -o tests/mqueue tests/mqueue.c -I src/ -Wall -Wextra --std=gnu99 \
- *     src/protocol.c  -I lib/ && tests/mqueue
+ *     src/protocol.c  -I lib/ -pthread && tests/mqueue
  */
 
+#define PRODUCERS 4
+#define MESSAGES 1000000
+#define BENCH_CAPACITY 1024
+
 void panic(char *str) {
     fprintf(stderr, "Caught panic: %s", str);
     _exit(2);
 }
 
-int main() {   
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * The previous mutex-guarded queue, kept here as a reference for throughput
+ * comparison. Overflow waits instead of panic.
+ */
+typedef struct mutex_mqueue {
+    mbuf_t buf[BENCH_CAPACITY];
+    size_t start_position;
+    size_t size;
+    pthread_mutex_t mutex;
+} mutex_mqueue_t;
+
+void mutex_mqueue_put(mutex_mqueue_t *queue, mbuf_t mbuf) {
+    for (;;) {
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->size < BENCH_CAPACITY - 1) {
+            break;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        sched_yield();
+    }
+
+    size_t pos = (queue->start_position + queue->size) % BENCH_CAPACITY;
+    queue->buf[pos] = mbuf;
+    queue->size++;
+
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+int mutex_mqueue_get(mutex_mqueue_t *queue, mbuf_t *mbuf) {
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->size == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return 0;
+    }
+
+    *mbuf = queue->buf[queue->size--, queue->start_position++];
+    if (queue->start_position >= BENCH_CAPACITY) {
+        queue->start_position = 0;
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+// Producer id and sequence number are packed into msg.size
+#define PACK(producer, seq) (((size_t)(producer) << 32) | (seq))
+#define PRODUCER(size) ((size) >> 32)
+#define SEQ(size) ((size) & 0xFFFFFFFF)
+
+typedef struct producer_args {
+    size_t id;
+    void *queue;
+    int mutex;
+} producer_args_t;
+
+void* producer(void *args) {
+    producer_args_t *pa = (producer_args_t *)args;
+    mbuf_t mbuf;
+
+    mbuf.payload = NULL;
+    mbuf.msg.type = MSG_ECHO_REQUEST;
+
+    for (size_t i = 0; i < MESSAGES; i++) {
+        mbuf.msg.size = PACK(pa->id, i);
+        if (pa->mutex) {
+            mutex_mqueue_put((mutex_mqueue_t *)pa->queue, mbuf);
+        } else {
+            mqueue_put((mqueue_t *)pa->queue, mbuf);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs PRODUCERS threads against one consumer, checks per-producer order.
+ *
+ * ret : messages per second
+ */
+double stress(int mutex) {
+    static mutex_mqueue_t mmq;
+    mqueue_t mq;
+    void *queue;
+
+    if (mutex) {
+        mmq.size = 0;
+        mmq.start_position = 0;
+        pthread_mutex_init(&mmq.mutex, NULL);
+        queue = &mmq;
+    } else {
+        mqueue_init_ext(&mq, BENCH_CAPACITY, MQ_BLOCK);
+        queue = &mq;
+    }
+
+    pthread_t threads[PRODUCERS];
+    producer_args_t args[PRODUCERS];
+    size_t expected[PRODUCERS] = { 0 };
+
+    unsigned long long begin = sysutime();
+
+    for (size_t i = 0; i < PRODUCERS; i++) {
+        args[i].id = i;
+        args[i].queue = queue;
+        args[i].mutex = mutex;
+        if (pthread_create(threads + i, NULL, &producer, args + i) != 0) {
+            panic("Unable to create producer!");
+        }
+    }
+
+    mbuf_t mbuf;
+    for (size_t got = 0; got < PRODUCERS * MESSAGES; ) {
+        int rc = mutex ? mutex_mqueue_get(&mmq, &mbuf) :
+            mqueue_get(&mq, &mbuf);
+        if (rc == 0) {
+            sched_yield();
+            continue;
+        }
+
+        size_t id = PRODUCER(mbuf.msg.size);
+        if (id >= PRODUCERS || SEQ(mbuf.msg.size) != expected[id]++) {
+            fprintf(stderr, "FATAL: corrupted or reordered data!\n");
+            exit(1);
+        }
+        got++;
+    }
+
+    unsigned long long elapsed = sysutime() - begin;
+
+    for (size_t i = 0; i < PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (mutex) {
+        pthread_mutex_destroy(&mmq.mutex);
+    } else {
+        if (mqueue_get(&mq, &mbuf) != 0) {
+            fprintf(stderr, "FAIL: extra data in queue!\n");
+            exit(1);
+        }
+        mqueue_destroy(&mq);
+    }
+
+    return 1e6 * PRODUCERS * MESSAGES / (elapsed ? elapsed : 1);
+}
+
+int policies() {
+    mqueue_t mq;
+    mbuf_t mbuf;
+
+    // Drop oldest: 6 messages into 4 slots, 2 oldest are gone
+    mqueue_init_ext(&mq, 4, MQ_DROP_OLDEST);
+    mbuf.payload = NULL;
+    mbuf.msg.type = MSG_PUT_CHAT;
+    for (size_t i = 0; i < 6; i++) {
+        mbuf.msg.size = i;
+        mqueue_put(&mq, mbuf);
+    }
+    for (size_t i = 2; i < 6; i++) {
+        if (mqueue_get(&mq, &mbuf) != 1 || mbuf.msg.size != i) {
+            fprintf(stderr, "FAIL: drop oldest policy!\n");
+            return 1;
+        }
+    }
+    if (mq.dropped != 2 || mqueue_get(&mq, &mbuf) != 0) {
+        fprintf(stderr, "FAIL: drop oldest counters!\n");
+        return 1;
+    }
+    mqueue_destroy(&mq);
+
+    // Coalesce: the oldest state update is superseded by the new one
+    mqueue_init_ext(&mq, 4, MQ_COALESCE);
+    mbuf.msg.type = MSG_PUT_PLAYERS_FULL;
+    mbuf.msg.size = 0;
+    mqueue_put(&mq, mbuf);
+    mbuf.msg.type = MSG_PUT_CHAT;
+    for (size_t i = 1; i < 4; i++) {
+        mbuf.msg.size = i;
+        mqueue_put(&mq, mbuf);
+    }
+    mbuf.msg.type = MSG_PUT_PLAYERS_FULL;
+    mbuf.msg.size = 4;
+    mqueue_put(&mq, mbuf);
+    for (size_t i = 1; i < 5; i++) {
+        if (mqueue_get(&mq, &mbuf) != 1 || mbuf.msg.size != i) {
+            fprintf(stderr, "FAIL: coalesce policy!\n");
+            return 1;
+        }
+    }
+    mqueue_destroy(&mq);
+
+    return 0;
+}
+
+int main() {
     mqueue_t mq;
 
     mqueue_init(&mq);
@@ -25,21 +237,37 @@ int main() {
         return 1;
     }
 
-    for (size_t i = 0; i < MQUEUE_SIZE - 1; i++) {
+    for (size_t i = 0; i < MQUEUE_SIZE; i++) {
         mbuf.payload = NULL;
         mbuf.msg.size = i;
         mqueue_put(&mq, mbuf);
     }
 
-    for (size_t i = 0; i < MQUEUE_SIZE - 1; i++) {
+    for (size_t i = 0; i < MQUEUE_SIZE; i++) {
         if (mqueue_get(&mq, &mbuf) != 1) {
             fprintf(stderr, "FAIL: get from queue!");
+            return 1;
         }
 
         if (mbuf.msg.size != i) {
             fprintf(stderr, "FATAL: corrupted data!");
+            return 1;
         }
     }
 
+    mqueue_destroy(&mq);
+
+    if (policies() != 0) {
+        return 1;
+    }
+
+    double ring = stress(0);
+    double mutex = stress(1);
+
+    printf("%d producers x %d messages, capacity %d\n",
+            PRODUCERS, MESSAGES, BENCH_CAPACITY);
+    printf("lock-free ring: %.2f Mmsg/s\n", ring / 1e6);
+    printf("mutex queue:    %.2f Mmsg/s\n", mutex / 1e6);
+
     return 0;
 }
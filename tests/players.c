@@ -0,0 +1,201 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * Player registry stress test: threads join and leave players concurrently,
+ * then fill the registry up. Ids must stay unique, stale handles must be
+ * detected, lookups must find the right players.
+ *
+ * cc -o tests/players tests/players.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/player.c src/spatial.c -I lib/ -pthread && tests/players
+ */
+
+#define THREADS 8
+#define ROUNDS 64
+#define BATCH (MAX_PLAYERS / THREADS)
+
+char start = 0;
+size_t failures = 0;
+size_t taken[THREADS];
+uint8_t owner[MAX_PLAYERS];
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+size_t event_player_cancel(size_t player_id) {
+    (void)player_id;
+    return 0;
+}
+
+// Broadcasts are not used here
+void mqueue_put(mqueue_t *queue, mbuf_t mbuf) { (void)queue; (void)mbuf; }
+void mqueue_put_shared(mqueue_t *queue, mbuf_t mbuf) {
+    (void)queue;
+    (void)mbuf;
+}
+void *mshared_alloc(size_t size) { (void)size; return NULL; }
+void mshared_release(void *payload) { (void)payload; }
+size_t s_level_look(size_t level, player_t *player, spatial_entity_t **found,
+        size_t max) {
+    (void)level;
+    (void)player;
+    (void)found;
+    (void)max;
+    return 0;
+}
+
+// Neither are the levels
+void s_level_send(size_t level, player_t *player) {
+    (void)level;
+    (void)player;
+}
+void s_level_enter(size_t level, player_t *player) {
+    (void)level;
+    (void)player;
+}
+void s_area_send(size_t level, player_t *player) {
+    (void)level;
+    (void)player;
+}
+size_t s_area_sync(size_t level, player_t *player) {
+    (void)level;
+    (void)player;
+    return 0;
+}
+
+// Client drawing is not used here
+void windows_damage(int win, int damage) { (void)win; (void)damage; }
+void c_area_damage(uint32_t y, uint32_t x, uint32_t height, uint32_t width) {
+    (void)y;
+    (void)x;
+    (void)height;
+    (void)width;
+}
+
+void fail(const char *what) {
+    fprintf(stderr, "FAIL: %s\n", what);
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+// Joins and leaves BATCH players at once, ROUNDS times
+void *churn(void *arg) {
+    size_t thread = (size_t)arg, ids[BATCH];
+    player_handle_t handles[BATCH];
+    connection_t *connections;
+    char nickname[PLAYER_NAME_MAXLEN];
+
+    if ((connections = calloc(BATCH, sizeof(connection_t))) == NULL) {
+        panic("Error allocating connections!");
+    }
+
+    for (size_t round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < BATCH; i++) {
+            snprintf(nickname, PLAYER_NAME_MAXLEN, "p%zu-%zu", thread, i);
+            if ((ids[i] = player_init(L_YELLOW, "bsi",
+                            connections + i)) == MAX_PLAYERS) {
+                fail("registry is full too early");
+                return NULL;
+            }
+            player_rename(ids[i], nickname);
+            handles[i] = player_handle(ids[i]);
+            connections[i].player_id = ids[i];
+            connections[i].player_generation = handles[i].generation;
+        }
+
+        for (size_t i = 0; i < BATCH; i++) {
+            snprintf(nickname, PLAYER_NAME_MAXLEN, "p%zu-%zu", thread, i);
+            if (player_by_nickname(nickname) != ids[i]) {
+                fail("nickname lookup");
+            }
+            if (player_by_connection(connections + i) != players + ids[i]) {
+                fail("connection lookup");
+            }
+        }
+
+        for (size_t i = 0; i < BATCH; i++) {
+            player_free(ids[i]);
+            if (player_get(handles[i]) != NULL ||
+                    player_by_connection(connections + i) != NULL) {
+                fail("stale handle is alive");
+            }
+        }
+    }
+
+    free(connections);
+
+    return NULL;
+}
+
+// Takes as many slots as it can
+void *fill(void *arg) {
+    size_t thread = (size_t)arg, id;
+
+    while ((id = player_init(L_YELLOW, "bsi", NULL)) != MAX_PLAYERS) {
+        if (owner[id] != 0) {
+            fail("slot is taken twice");
+        }
+        owner[id] = thread + 1;
+        taken[thread]++;
+    }
+
+    return NULL;
+}
+
+void run(void *(*routine)(void *)) {
+    pthread_t threads[THREADS];
+
+    for (size_t i = 0; i < THREADS; i++) {
+        if (pthread_create(threads + i, NULL, routine, (void *)i) != 0) {
+            panic("Error creating thread!");
+        }
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main() {
+    unsigned long long begin = sysutime();
+    run(&churn);
+    unsigned long long churned = sysutime() - begin;
+
+    if (players_count != 0 || players_len > MAX_PLAYERS) {
+        fail("players are left after churn");
+    }
+
+    run(&fill);
+
+    size_t total = 0;
+    for (size_t i = 0; i < THREADS; i++) {
+        total += taken[i];
+    }
+    if (total != MAX_PLAYERS || players_count != MAX_PLAYERS) {
+        fail("registry is not filled up");
+    }
+
+    printf("%d threads: %d joins and leaves in %.3f s, %zu players at "
+            "once\n", THREADS, THREADS * ROUNDS * BATCH, churned / 1e6,
+            total);
+
+    return failures != 0;
+}
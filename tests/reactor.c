@@ -0,0 +1,204 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "protocol.h"
+
+/*
+ * Server reactor benchmark: idle CPU and chat round-trip latency with a lot
+ * of simulated clients. Server must be built with enough player slots:
+ *
+ * CFLAGS=-DMAX_PLAYERS=1024 ./configure && make && bin/itmmorgue -s &
+ * cc -o tests/reactor tests/reactor.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/protocol.c -I lib/ -pthread && \
+ *     tests/reactor `pgrep -n itmmorgue` 1000
+ */
+
+#define SERVER_PORT 2607
+#define IDLE_SECONDS 5
+#define SAMPLES 1000
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Returns utime + stime of the process in clock ticks
+unsigned long long cputime(int pid) {
+    char path[64], buf[4096];
+    unsigned long long utime = 0, stime = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL || fgets(buf, sizeof(buf), f) == NULL) {
+        panic("Unable to read server stat!");
+    }
+    fclose(f);
+
+    // Skip comm field, it may contain spaces
+    char *p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u "
+                "%*u %*u %llu %llu", &utime, &stime) != 2) {
+        panic("Unable to parse server stat!");
+    }
+
+    return utime + stime;
+}
+
+int readall(int fd, void *buf, size_t size) {
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t rc = read(fd, (char *)buf + got, size - got);
+        if (rc > 0) {
+            got += rc;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return -1;
+        }
+    }
+
+    return size;
+}
+
+// Reads one message and returns its type
+int recv_msg(int fd) {
+    msg_t msg;
+    uint8_t header[MSG_HEADER_SIZE];
+    char payload[BUFSIZ];
+
+    if (readall(fd, header, sizeof(header)) < 0) {
+        panic("Connection lost!");
+    }
+    msg_decode(header, &msg);
+    for (size_t left = msg.size; left > 0; ) {
+        size_t chunk = left > sizeof(payload) ? sizeof(payload) : left;
+        if (readall(fd, payload, chunk) < 0) {
+            panic("Connection lost!");
+        }
+        left -= chunk;
+    }
+
+    return msg.type;
+}
+
+int cmp(const void *a, const void *b) {
+    unsigned long long x = *(unsigned long long *)a;
+    unsigned long long y = *(unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <server pid> [clients]\n", argv[0]);
+        return 1;
+    }
+
+    int pid = atoi(argv[1]);
+    int clients = argc > 2 ? atoi(argv[2]) : 1000;
+    int *fds, ep;
+
+    if ((fds = malloc(sizeof(int) * clients)) == NULL) {
+        panic("Unable to allocate sockets!");
+    }
+    if ((ep = epoll_create(clients)) < 0) {
+        panic("Unable to create epoll!");
+    }
+
+    struct sockaddr_in addr;
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(SERVER_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    for (int i = 0; i < clients; i++) {
+        if ((fds[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 ||
+                connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            panic("Unable to connect to the server!");
+        }
+        int one = 1;
+        setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+
+    printf("%d clients connected\n", clients);
+    fflush(stdout);
+
+    // 1. Idle CPU usage
+    sleep(1);
+    long hz = sysconf(_SC_CLK_TCK);
+    unsigned long long cpu = cputime(pid);
+    sleep(IDLE_SECONDS);
+    cpu = cputime(pid) - cpu;
+    printf("idle CPU: %.2f%% over %d s\n",
+            100.0 * cpu / hz / IDLE_SECONDS, IDLE_SECONDS);
+
+    // 2. Chat round-trip latency: every client receives PUT_CHAT + SYSMSG
+    static unsigned long long lat[SAMPLES];
+    struct {
+        uint8_t header[MSG_HEADER_SIZE];
+        char text[16];
+    } ping;
+    msg_t msg = { MSG_NEW_CHAT, PROTOCOL_VERSION, sizeof(ping.text) };
+    msg_encode(&msg, ping.header);
+    strncpy(ping.text, "<bench> ping\n", sizeof(ping.text));
+
+    for (int s = 0; s < SAMPLES; s++) {
+        unsigned long long begin = sysutime();
+
+        if (write(fds[0], &ping, sizeof(ping)) < 0) {
+            panic("Unable to send chat message!");
+        }
+
+        long left = 2L * clients;
+        int own = 0;
+        while (left > 0) {
+            struct epoll_event events[256];
+            int rc = epoll_wait(ep, events, 256, 10000);
+            if (rc <= 0) {
+                panic("Timeout waiting for broadcast!");
+            }
+            for (int i = 0; i < rc; i++) {
+                int fd = fds[events[i].data.u32];
+                int type = recv_msg(fd);
+                if (type != MSG_PUT_CHAT && type != MSG_PUT_SYSMSG) {
+                    continue;
+                }
+                if (fd == fds[0] && type == MSG_PUT_CHAT && ! own) {
+                    lat[s] = sysutime() - begin;
+                    own = 1;
+                }
+                left--;
+            }
+        }
+    }
+
+    qsort(lat, SAMPLES, sizeof(lat[0]), cmp);
+    printf("chat latency: p50 %llu us, p99 %llu us, max %llu us\n",
+            lat[SAMPLES / 2], lat[SAMPLES * 99 / 100], lat[SAMPLES - 1]);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * Spatial index benchmark: 10k entities wander over a 1024x1024 level, each
+ * of them looks around every tick. Results are checked against a full scan.
+ *
+ * cc -o tests/spatial tests/spatial.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/spatial.c -I lib/ -pthread && tests/spatial
+ */
+
+#define ENTITIES 10000
+#define SIZE 1024
+#define TICKS 100
+#define RADIUS 8
+#define FOUND 256
+
+spatial_entity_t entities[ENTITIES];
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+uint32_t step(uint32_t coord) {
+    coord += rand() % 3 - 1;
+
+    return coord >= SIZE ? (coord == SIZE ? SIZE - 1 : 0) : coord;
+}
+
+// What the server had to do before: look at everybody
+size_t scan(uint32_t y, uint32_t x) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < ENTITIES; i++) {
+        int64_t dy = (int64_t)entities[i].y - y;
+        int64_t dx = (int64_t)entities[i].x - x;
+
+        count += dy * dy + dx * dx <= RADIUS * RADIUS;
+    }
+
+    return count;
+}
+
+int main() {
+    spatial_entity_t *found[FOUND];
+    unsigned long long moves = 0, queries = 0, scans = 0, begin;
+    size_t neighbours = 0;
+    spatial_t spatial;
+
+    srand(375);
+    spatial_init(&spatial, ENTITIES);
+    for (size_t i = 0; i < ENTITIES; i++) {
+        spatial_insert(&spatial, entities + i, SK_NPC, i, rand() % SIZE,
+                rand() % SIZE);
+    }
+
+    for (size_t tick = 0; tick < TICKS; tick++) {
+        begin = sysutime();
+        for (size_t i = 0; i < ENTITIES; i++) {
+            spatial_move(entities + i, step(entities[i].y),
+                    step(entities[i].x));
+        }
+        moves += sysutime() - begin;
+
+        begin = sysutime();
+        for (size_t i = 0; i < ENTITIES; i++) {
+            neighbours += spatial_radius(&spatial, entities[i].y,
+                    entities[i].x, RADIUS, found, FOUND);
+        }
+        queries += sysutime() - begin;
+
+        // Full scan is slow, check a few entities only
+        for (size_t i = 0; i < ENTITIES; i += ENTITIES / 10) {
+            begin = sysutime();
+            size_t count = scan(entities[i].y, entities[i].x);
+            scans += sysutime() - begin;
+
+            if (count != spatial_radius(&spatial, entities[i].y,
+                        entities[i].x, RADIUS, found, FOUND)) {
+                fprintf(stderr, "FAIL: radius query differs from scan!\n");
+                return 1;
+            }
+        }
+    }
+
+    // Whole level as a rectangle goes slot by slot
+    if (spatial_rect(&spatial, 0, 0, SIZE - 1, SIZE - 1, found, 0) !=
+            ENTITIES || spatial.count != ENTITIES) {
+        fprintf(stderr, "FAIL: entities are lost!\n");
+        return 1;
+    }
+
+    printf("%d entities on %dx%d, %d ticks:\n", ENTITIES, SIZE, SIZE,
+            TICKS);
+    printf("  move:         %6.1f ns\n",
+            moves * 1e3 / TICKS / ENTITIES);
+    printf("  radius %d:    %6.1f ns, %.1f neighbours\n", RADIUS,
+            queries * 1e3 / TICKS / ENTITIES,
+            (double)neighbours / TICKS / ENTITIES);
+    printf("  full scan:    %6.1f ns\n",
+            scans * 1e3 / TICKS / 10);
+
+    spatial_destroy(&spatial);
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+// vim: sw=4 ts=4 et :
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include "itmmorgue.h"
+
+/*
+ * World file benchmark: cold start of a 4096x4096 world from the mapped file
+ * against its regeneration.
+ *
+ * cc -o tests/world tests/world.c -I src/ -Wall -Wextra --std=gnu99 \
+ *     src/world.c src/chunk.c src/gen.c -I lib/ -pthread && tests/world
+ */
+
+#define SIZE 4096
+#define MEMORY (64 << 20)
+#define PATH "/tmp/itmmorgue-test.world"
+
+void panic(char *str) {
+    fprintf(stderr, "Caught panic: %s\n", str);
+    _exit(2);
+}
+
+void logger(char *str) {
+    printf("%s\n", str);
+}
+
+unsigned long long sysutime() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        panic("Unable to get system time!");
+    }
+
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+world_t world;
+
+void generate(void *arg, chunk_t *chunk) {
+    gen_chunk(&((level_t *)arg)->gen, chunk->cy, chunk->cx, chunk->cells);
+}
+
+const cell_t *map(void *arg, uint32_t cy, uint32_t cx) {
+    return world_chunk(&world, ((level_t *)arg)->world, cy, cx);
+}
+
+// Loads every chunk of the level and returns checksum of its cells
+uint64_t load(level_t *level) {
+    cell_t cells[CHUNK_CELLS];
+    uint64_t sum = 0, version;
+
+    for (uint32_t cy = 0; cy < SIZE / CHUNK_SIZE; cy++) {
+        for (uint32_t cx = 0; cx < SIZE / CHUNK_SIZE; cx++) {
+            chunks_copy(&level->chunks, cy, cx, 0, cells, &version);
+            for (size_t i = 0; i < CHUNK_CELLS; i++) {
+                sum = sum * 31 + cells[i];
+            }
+        }
+    }
+
+    return sum;
+}
+
+int main() {
+    level_t level;
+
+    memset(&level, '\0', sizeof(level_t));
+    strcpy(level.name, "375");
+    level.max_y = level.max_x = SIZE;
+    level.gen.seed = 375;
+    level.gen.height = level.gen.width = SIZE;
+    level.gen.range = 40;
+    level.gen.step_min = 15;
+    level.gen.step_max = 55;
+    level.gen.castles = 1;
+
+    chunks_init(&level.chunks, MEMORY, &generate, &map, &level);
+    unsigned long long begin = sysutime();
+    uint64_t generated = load(&level);
+    unsigned long long regen = sysutime() - begin;
+
+    world_save(&world, PATH, &level, 1);
+    chunks_destroy(&level.chunks);
+
+    // Drop the file from the page cache to measure really cold start
+    int fd = open(PATH, O_RDONLY);
+    if (fd < 0) {
+        panic("Unable to open world file!");
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    begin = sysutime();
+    if (world_open(&world, PATH) < 0) {
+        panic("Unable to load world file!");
+    }
+    level.world = world.levels;
+    chunks_init(&level.chunks, MEMORY, &generate, &map, &level);
+    uint64_t loaded = load(&level);
+    unsigned long long cold = sysutime() - begin;
+
+    if (loaded != generated || level.chunks.generated != 0) {
+        fprintf(stderr, "FAIL: saved world differs from generated one!\n");
+        return 1;
+    }
+
+    // Changes must not reach the file until it is saved
+    cell_t cell = TILE_CELL(S_PLAYER, 0), saved = world_chunk(&world,
+            level.world, 0, 0)[0];
+    chunks_write(&level.chunks, 0, 0, &cell, 1);
+    if (world_chunk(&world, level.world, 0, 0)[0] != saved ||
+            chunks_cell(&level.chunks, 0, 0) != cell) {
+        fprintf(stderr, "FAIL: mapped chunk is not copied on write!\n");
+        return 1;
+    }
+
+    printf("%u x %u: regeneration %.3f s, cold start %.3f s, %.0fx\n",
+            SIZE, SIZE, regen / 1e6, cold / 1e6,
+            (double)regen / (cold ? cold : 1));
+
+    chunks_destroy(&level.chunks);
+    world_close(&world);
+    unlink(PATH);
+
+    return 0;
+}